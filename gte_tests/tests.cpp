@@ -1,6 +1,15 @@
 #include "pscx_gte.h"
+#include "pscx_audio.h"
+#include "pscx_crc.h"
+#include "pscx_disc_image.h"
+#include "pscx_lz.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <random>
 #include <unordered_map>
 #include <string>
 #include <vector>
@@ -939,10 +948,364 @@ static void test_divider()
 	CHECK("divide(0xe5d7, 0x72ec)", divide(0xe5d7, 0x72ec) == 0x1ffff);
 }
 
+// Bit at a time definition of the sector EDC, independent of the tables
+static uint32_t crc32Bitwise(const uint8_t* data, size_t size)
+{
+	uint32_t crc = 0x0;
+	for (size_t i = 0; i < size; ++i)
+	{
+		crc ^= data[i];
+		for (uint32_t bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xd8018001 : 0x0);
+		}
+	}
+	return crc;
+}
+
+static void test_crc()
+{
+	// Check value of the CD-ROM EDC CRC
+	const uint8_t check[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+	CHECK("crc32(\"123456789\")", crc32(check, sizeof(check)) == 0x6ec2edc4);
+	CHECK("crc32Bitwise(\"123456789\")", crc32Bitwise(check, sizeof(check)) == 0x6ec2edc4);
+
+	// EDC of a Mode 2 Form 1 sector: sub-header and data, the data being
+	// an incrementing byte pattern
+	std::vector<uint8_t> sector(2056, 0x0);
+	sector[2] = 0x08;
+	sector[6] = 0x08;
+	for (size_t i = 0; i < 2048; ++i)
+	{
+		sector[8 + i] = (uint8_t)i;
+	}
+	CHECK("crc32(sector)", crc32(sector) == 0x59d00ce9);
+	CHECK("crc32Bytewise(sector)", crc32Bytewise(sector.data(), sector.size()) == 0x59d00ce9);
+
+	// Slice-by-8 against the bytewise loop, every length and alignment of
+	// the 8 byte steps
+	std::mt19937 random(0x1234);
+	std::vector<uint8_t> buffer(4096 + 8);
+	for (uint8_t& byte : buffer)
+	{
+		byte = (uint8_t)random();
+	}
+
+	bool match = true;
+	for (size_t start = 0; start < 8; ++start)
+	{
+		for (size_t size = 0; size <= 64; ++size)
+		{
+			match = match && crc32(buffer.data() + start, size) == crc32Bytewise(buffer.data() + start, size);
+		}
+		match = match && crc32(buffer.data() + start, 4096) == crc32Bytewise(buffer.data() + start, 4096);
+	}
+	CHECK("crc32 matches crc32Bytewise on random buffers", match);
+}
+
+// Data looking like a disc image: runs of repeated bytes, copies of
+// earlier data and random bytes
+static std::vector<uint8_t> makeCompressibleData(std::mt19937& random, size_t size)
+{
+	std::vector<uint8_t> data;
+	while (data.size() < size)
+	{
+		size_t count = 1 + random() % 300;
+		uint32_t kind = random() % 3;
+
+		// Nothing to repeat yet, use random bytes
+		if (kind == 1 && data.empty())
+		{
+			kind = 2;
+		}
+
+		switch (kind)
+		{
+		case 0:
+			data.insert(data.end(), count, (uint8_t)random());
+			break;
+		case 1:
+		{
+			size_t start = random() % data.size();
+			for (size_t i = 0; i < count; ++i)
+			{
+				data.push_back(data[start + i % (data.size() - start)]);
+			}
+			break;
+		}
+		default:
+			for (size_t i = 0; i < count; ++i)
+			{
+				data.push_back((uint8_t)random());
+			}
+			break;
+		}
+	}
+	data.resize(size);
+	return data;
+}
+
+static void test_lz()
+{
+	std::mt19937 random(0x5678);
+
+	bool roundTrip = true;
+	const size_t sizes[] = { 1, 4, 15, 16, 17, 100, 4096, 16 * 2352 };
+	for (size_t size : sizes)
+	{
+		std::vector<uint8_t> data = makeCompressibleData(random, size);
+		std::vector<uint8_t> packed(size + size / 16 + 64);
+		size_t packedSize = lzCompress(data.data(), size, packed.data(), packed.size());
+
+		std::vector<uint8_t> unpacked(size);
+		roundTrip = roundTrip && packedSize > 0 &&
+			lzDecompress(packed.data(), packedSize, unpacked.data(), size) && unpacked == data;
+	}
+	CHECK("LZ round trip", roundTrip);
+
+	std::vector<uint8_t> data = makeCompressibleData(random, 4096);
+	std::vector<uint8_t> packed(8192);
+	size_t packedSize = lzCompress(data.data(), data.size(), packed.data(), packed.size());
+	CHECK("LZ compresses repeated data", packedSize > 0 && packedSize < data.size());
+
+	// A stream cut anywhere is rejected. The only exception is an empty
+	// last sequence after a match, the data is complete without it.
+	std::vector<uint8_t> unpacked(data.size() + 16);
+	bool truncated = true;
+	for (size_t size = 0; size < packedSize; ++size)
+	{
+		if (lzDecompress(packed.data(), size, unpacked.data(), data.size()))
+		{
+			truncated = truncated && size == packedSize - 1 && packed[size] == 0x00 &&
+				std::equal(data.begin(), data.end(), unpacked.begin());
+		}
+	}
+	CHECK("LZ rejects truncated streams", truncated);
+
+	// Corrupted streams may decode to wrong data but never write past the
+	// end of the output
+	bool inBounds = true;
+	for (uint32_t i = 0; i < 1000; ++i)
+	{
+		std::vector<uint8_t> corrupted(packed.begin(), packed.begin() + packedSize);
+		corrupted[random() % packedSize] ^= (uint8_t)(1 + random() % 255);
+
+		std::fill(unpacked.begin(), unpacked.end(), 0xcc);
+		lzDecompress(corrupted.data(), corrupted.size(), unpacked.data(), data.size());
+		inBounds = inBounds && std::all_of(unpacked.begin() + data.size(), unpacked.end(), [](uint8_t b) { return b == 0xcc; });
+	}
+	CHECK("LZ corrupted streams stay in bounds", inBounds);
+}
+
+// Disc image held in memory
+struct MemoryDiscImage : public DiscImage
+{
+	MemoryDiscImage(const std::vector<uint8_t>& data) :
+		m_data(data)
+	{}
+
+	uint64_t getSize() const override { return m_data.size(); }
+
+	bool read(uint64_t offset, uint8_t* dst, size_t size) override
+	{
+		if (offset > m_data.size() || size > m_data.size() - offset)
+			return false;
+
+		memcpy(dst, m_data.data() + offset, size);
+		return true;
+	}
+
+	std::vector<uint8_t> m_data;
+};
+
+static bool readWholeImage(DiscImage& image, const std::vector<uint8_t>& expected)
+{
+	std::vector<uint8_t> data(expected.size());
+	return image.getSize() == expected.size() && image.read(0, data.data(), data.size()) && data == expected;
+}
+
+static void test_compressed_image()
+{
+	std::mt19937 random(0x9abc);
+
+	// A bit more than 3 blocks, the last one is shorter. The second block
+	// is random and stored as is.
+	const size_t blockSize = COMPRESSED_BLOCK_SECTORS * 2352;
+	std::vector<uint8_t> source = makeCompressibleData(random, blockSize * 3 + 1000);
+	for (size_t i = blockSize; i < blockSize * 2; ++i)
+	{
+		source[i] = (uint8_t)random();
+	}
+
+	const char* sourcePath = "psxz_test_source.bin";
+	const char* imagePath = "psxz_test_image.psxz";
+	std::ofstream(sourcePath, std::ios::binary).write((const char*)source.data(), source.size());
+
+	bool converted = CompressedDiscImage::convert(sourcePath, imagePath);
+	std::unique_ptr<DiscImage> image = DiscImage::open(imagePath);
+	CHECK("Compressed image round trip", converted && image && readWholeImage(*image, source));
+
+	// Reads straddling the blocks, in any order
+	bool partialReads = image != nullptr;
+	for (uint32_t i = 0; i < 200 && partialReads; ++i)
+	{
+		size_t offset = random() % source.size();
+		size_t size = std::min<size_t>(1 + random() % (2 * blockSize), source.size() - offset);
+		std::vector<uint8_t> data(size);
+		partialReads = image->read(offset, data.data(), size) && memcmp(data.data(), source.data() + offset, size) == 0;
+	}
+	CHECK("Compressed image random reads", partialReads);
+	image.reset();
+
+	std::ifstream file(imagePath, std::ios::binary);
+	std::vector<uint8_t> packed((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	file.close();
+
+	std::remove(sourcePath);
+	std::remove(imagePath);
+
+	CompressedImageHeader header;
+	memcpy(&header, packed.data(), sizeof(header));
+	std::vector<CompressedBlockEntry> index(header.m_blockCount);
+	memcpy(index.data(), packed.data() + sizeof(header), index.size() * sizeof(CompressedBlockEntry));
+
+	// A corrupted block fails its reads, the other blocks are still readable
+	for (uint32_t block = 0; block < 2; ++block)
+	{
+		std::vector<uint8_t> corrupted = packed;
+		corrupted[(size_t)index[block].m_offset + index[block].m_size / 2] ^= 0x5a;
+
+		std::unique_ptr<CompressedDiscImage> image = CompressedDiscImage::open(std::unique_ptr<DiscImage>(new MemoryDiscImage(corrupted)));
+		std::vector<uint8_t> data(blockSize);
+		bool detected = image && !image->read(block * blockSize, data.data(), 16) &&
+			image->read((block + 1) * blockSize, data.data(), blockSize) &&
+			memcmp(data.data(), source.data() + (block + 1) * blockSize, blockSize) == 0;
+		CHECK(block == 0 ? "Compressed image corrupted block" : "Compressed image corrupted stored block", detected);
+	}
+
+	// Cutting the file drops blocks the index points to, the image is rejected
+	bool truncated = true;
+	const size_t cuts[] = { 0, 4, sizeof(header), sizeof(header) + 8, (size_t)index.back().m_offset, packed.size() - 1 };
+	for (size_t cut : cuts)
+	{
+		std::vector<uint8_t> data(packed.begin(), packed.begin() + cut);
+		truncated = truncated && !CompressedDiscImage::open(std::unique_ptr<DiscImage>(new MemoryDiscImage(data)));
+	}
+	CHECK("Compressed image truncated", truncated);
+}
+
+static void test_audio_resampler()
+{
+	// 44.1kHz to 48kHz: a ramp stays a ramp, the output count follows the
+	// ratio
+	std::vector<int16_t> ramp;
+	for (int32_t i = 0; i < 44100; ++i)
+	{
+		ramp.push_back((int16_t)(i / 2));
+		ramp.push_back((int16_t)-(i / 2));
+	}
+
+	AudioResampler resampler;
+	resampler.setStep(44100.0 / 48000.0);
+	std::vector<int16_t> output;
+	for (size_t i = 0; i < ramp.size() / 2; i += 128)
+	{
+		resampler.process(&ramp[i * 2], std::min<size_t>(128, ramp.size() / 2 - i), output);
+	}
+	CHECK("Resampler output count", output.size() / 2 >= 47999 && output.size() / 2 <= 48001);
+
+	// The ramp rises by half a step per input frame, less per output frame
+	bool interpolated = true;
+	for (size_t i = 1; i < output.size() / 2; ++i)
+	{
+		int32_t delta = output[i * 2] - output[(i - 1) * 2];
+		interpolated = interpolated && delta >= 0 && delta <= 1 && output[i * 2 + 1] == -output[i * 2];
+	}
+	CHECK("Resampler interpolation", interpolated);
+}
+
+static void test_audio_rate_control()
+{
+	// The emulated clock runs 0.3% slower, exactly at and 0.3% faster than
+	// the device one. The device plays 44.1kHz, 512 frames at a time, and
+	// starts once 3 buffers are queued like SdlAudioSink does.
+	const std::pair<double, const char*> drifts[] =
+	{
+		{ -0.003, "-0.3%" },
+		{ 0.0, "0%" },
+		{ 0.003, "+0.3%" }
+	};
+	for (auto& drift : drifts)
+	{
+		const size_t blockFrames = 128;
+		const size_t deviceFrames = 512;
+		const double targetFill = 3.0 * deviceFrames;
+
+		SpscAudioRing ring(8192);
+		AudioResampler resampler;
+		AudioRateControl rateControl;
+		rateControl.reset(1.0, targetFill);
+
+		std::vector<int16_t> block(blockFrames * 2, 0x0);
+		std::vector<int16_t> resampled;
+		std::vector<int16_t> deviceBuffer(deviceFrames * 2);
+
+		bool started = false;
+		size_t underruns = 0;
+		size_t dropped = 0;
+		size_t minFill = ~(size_t)0;
+		size_t maxFill = 0;
+
+		// Ten minutes of host time, in seconds
+		double producerTime = 0.0;
+		double deviceTime = 0.0;
+		while (producerTime < 600.0)
+		{
+			if (!started || producerTime <= deviceTime)
+			{
+				resampler.setStep(rateControl.update(ring.getFrameCount()));
+				resampled.clear();
+				resampler.process(block.data(), blockFrames, resampled);
+				dropped += resampled.size() / 2 - ring.push(resampled.data(), resampled.size() / 2);
+
+				if (!started && ring.getFrameCount() >= targetFill)
+				{
+					started = true;
+					rateControl.resetAverage();
+					deviceTime = producerTime;
+				}
+
+				producerTime += blockFrames / (44100.0 * (1.0 + drift.first));
+			}
+			else
+			{
+				underruns += deviceFrames - ring.pop(deviceBuffer.data(), deviceFrames);
+				deviceTime += deviceFrames / 44100.0;
+
+				// Once the control loop had time to settle
+				if (deviceTime > 60.0)
+				{
+					minFill = std::min(minFill, ring.getFrameCount());
+					maxFill = std::max(maxFill, ring.getFrameCount());
+				}
+			}
+		}
+
+		std::string name = std::string("Audio rate control, clock drift ") + drift.second;
+		CHECK(name + ": no underrun or dropped frame", underruns == 0 && dropped == 0);
+		CHECK(name + ": fill level stays around the target", minFill > 0 && maxFill < targetFill * 2);
+	}
+}
+
 int main()
 {
 	CHECK("Calculate leading zeroes", gte_lzcr() == true);
 	CHECK("Test commands", gte_ops() == 0x0);
 	test_divider();
+	test_crc();
+	test_lz();
+	test_compressed_image();
+	test_audio_resampler();
+	test_audio_rate_control();
 	return EXIT_SUCCESS;
 }
@@ -1,9 +1,76 @@
 #version 450
 
-in vec4 color;
+// Decoded texture pages, one per layer
+uniform sampler2DArray textures;
+
+// Copy of the VRAM used as the background of semi-transparent primitives
+uniform sampler2D blend_source;
+
+// Texture window: AND mask in xy, OR value in zw
+uniform ivec4 texture_window;
+
+in vec3 color;
+in vec2 texcoord;
+flat in int texture_layer;
+flat in int texture_mode;
+flat in int blend_mode;
+
 out vec4 frag_color;
 
+// Combine the primitive color with the VRAM pixel below it
+vec3 blend(vec3 foreground)
+{
+	vec3 background = texelFetch(blend_source, ivec2(gl_FragCoord.xy), 0).rgb;
+
+	switch (blend_mode)
+	{
+	case 0:
+		return (background + foreground) * 0.5;
+	case 1:
+		return min(background + foreground, vec3(1.0));
+	case 2:
+		return max(background - foreground, vec3(0.0));
+	default:
+		return min(background + foreground * 0.25, vec3(1.0));
+	}
+}
+
 void main()
 {
-	frag_color = color;
+	// No texture
+	if (texture_mode == 0)
+	{
+		vec3 rgb = (blend_mode == 4) ? color : blend(color);
+		frag_color = vec4(rgb, 0.0);
+		return;
+	}
+
+	ivec2 texel_position = ivec2(floor(texcoord)) & 0xff;
+	texel_position = (texel_position & texture_window.xy) | texture_window.zw;
+
+	vec4 texel = texelFetch(textures, ivec3(texel_position, texture_layer), 0);
+
+	// The texel value 0x0000 is fully transparent
+	if (texel.a == 0.0)
+	{
+		discard;
+	}
+
+	vec3 rgb = texel.rgb;
+
+	// Texture blending, a vertex color of 0x80 leaves the texel unchanged
+	if (texture_mode == 1)
+	{
+		rgb = min(rgb * color * (255.0 / 128.0), vec3(1.0));
+	}
+
+	// Only the texels with the semi-transparency bit are blended, the
+	// bit ends up in the mask bit of the VRAM pixel
+	bool semi_transparent = texel.a > 0.75;
+	if (semi_transparent && blend_mode != 4)
+	{
+		rgb = blend(rgb);
+	}
+
+	frag_color = vec4(rgb, semi_transparent ? 1.0 : 0.0);
 }
@@ -5,9 +5,16 @@ uniform ivec2 offset;
 
 in ivec2 vertex_position;
 in vec3 vertex_color;
-in float alpha;
+in int vertex_blend_mode;
+in vec2 vertex_texcoord;
+in int vertex_texture_layer;
+in int vertex_texture_mode;
 
-out vec4 color;
+out vec3 color;
+out vec2 texcoord;
+flat out int blend_mode;
+flat out int texture_layer;
+flat out int texture_mode;
 
 void main()
 {
@@ -17,12 +24,17 @@ void main()
 	// OpenGL coordinates (-1; 1, -1; 1)
 	float xpos = (float(position.x) / 512.0) - 1.0;
 
-	// VRAM puts 0 at the top, OpenGL at the bottom
-	// just mirror it vertically
-	float ypos = 1.0 - (float(position.y) / 256.0);
+	// We render into the VRAM texture which stores line 0
+	// at the bottom, no need to mirror
+	float ypos = (float(position.y) / 256.0) - 1.0;
 
 	gl_Position = vec4(xpos, ypos, 0.0, 1.0);
 
 	// Convert the components from [0; 255] to [0; 1]
-	color = vec4(vertex_color, alpha);
+	color = vertex_color;
+
+	texcoord = vertex_texcoord;
+	texture_layer = vertex_texture_layer;
+	texture_mode = vertex_texture_mode;
+	blend_mode = vertex_blend_mode;
 }
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "pscx_audio.h"
+
+// ********************** AudioFifo implementation **********************
+AudioFifo::AudioFifo(size_t capacity) :
+	m_samples(capacity * 2, 0),
+	m_capacity(capacity),
+	m_readIndex(0x0),
+	m_count(0x0)
+{
+}
+
+size_t AudioFifo::push(const int16_t* samples, size_t frames)
+{
+	frames = std::min(frames, getFreeCount());
+
+	// At most two copies, before and after the end of the buffer
+	size_t writeIndex = (m_readIndex + m_count) % m_capacity;
+	size_t first = std::min(frames, m_capacity - writeIndex);
+	memcpy(&m_samples[writeIndex * 2], samples, first * 2 * sizeof(int16_t));
+	memcpy(&m_samples[0], samples + first * 2, (frames - first) * 2 * sizeof(int16_t));
+
+	m_count += frames;
+	return frames;
+}
+
+bool AudioFifo::pop(int16_t& left, int16_t& right)
+{
+	if (m_count == 0x0)
+	{
+		left = 0;
+		right = 0;
+		return false;
+	}
+
+	left = m_samples[m_readIndex * 2];
+	right = m_samples[m_readIndex * 2 + 1];
+	m_readIndex = (m_readIndex + 1) % m_capacity;
+	m_count -= 1;
+	return true;
+}
+
+size_t AudioFifo::pop(int16_t* samples, size_t frames)
+{
+	frames = std::min(frames, m_count);
+
+	size_t first = std::min(frames, m_capacity - m_readIndex);
+	memcpy(samples, &m_samples[m_readIndex * 2], first * 2 * sizeof(int16_t));
+	memcpy(samples + first * 2, &m_samples[0], (frames - first) * 2 * sizeof(int16_t));
+
+	m_readIndex = (m_readIndex + frames) % m_capacity;
+	m_count -= frames;
+	return frames;
+}
+
+void AudioFifo::clear()
+{
+	m_readIndex = 0x0;
+	m_count = 0x0;
+}
+
+// ********************** SpscAudioRing implementation **********************
+SpscAudioRing::SpscAudioRing(size_t capacity) :
+	m_samples(capacity * 2, 0),
+	m_mask(capacity - 1),
+	m_writeIndex(0x0),
+	m_readIndex(0x0)
+{
+	assert(("Audio ring capacity must be a power of two", (capacity & (capacity - 1)) == 0));
+}
+
+size_t SpscAudioRing::push(const int16_t* samples, size_t frames)
+{
+	size_t writeIndex = m_writeIndex.load(std::memory_order_relaxed);
+	size_t readIndex = m_readIndex.load(std::memory_order_acquire);
+
+	frames = std::min(frames, getCapacity() - (writeIndex - readIndex));
+
+	// At most two copies, before and after the end of the buffer
+	size_t start = writeIndex & m_mask;
+	size_t first = std::min(frames, getCapacity() - start);
+	memcpy(&m_samples[start * 2], samples, first * 2 * sizeof(int16_t));
+	memcpy(&m_samples[0], samples + first * 2, (frames - first) * 2 * sizeof(int16_t));
+
+	// Publish the frames once they're written
+	m_writeIndex.store(writeIndex + frames, std::memory_order_release);
+	return frames;
+}
+
+size_t SpscAudioRing::pop(int16_t* samples, size_t frames)
+{
+	size_t readIndex = m_readIndex.load(std::memory_order_relaxed);
+	size_t writeIndex = m_writeIndex.load(std::memory_order_acquire);
+
+	frames = std::min(frames, writeIndex - readIndex);
+
+	size_t start = readIndex & m_mask;
+	size_t first = std::min(frames, getCapacity() - start);
+	memcpy(samples, &m_samples[start * 2], first * 2 * sizeof(int16_t));
+	memcpy(samples + first * 2, &m_samples[0], (frames - first) * 2 * sizeof(int16_t));
+
+	// Give the space back once the frames are copied out
+	m_readIndex.store(readIndex + frames, std::memory_order_release);
+	return frames;
+}
+
+size_t SpscAudioRing::getFrameCount() const
+{
+	return m_writeIndex.load(std::memory_order_acquire) - m_readIndex.load(std::memory_order_acquire);
+}
+
+// ********************** AudioResampler implementation **********************
+AudioResampler::AudioResampler() :
+	m_step(1.0),
+	m_position(0.0)
+{
+	m_last[0] = 0x0;
+	m_last[1] = 0x0;
+}
+
+void AudioResampler::process(const int16_t* samples, size_t frames, std::vector<int16_t>& output)
+{
+	for (size_t i = 0; i < frames; ++i)
+	{
+		int16_t left = samples[i * 2];
+		int16_t right = samples[i * 2 + 1];
+
+		// Output frames between the previous input frame and this one
+		while (m_position < 1.0)
+		{
+			output.push_back((int16_t)(m_last[0] + (left - m_last[0]) * m_position));
+			output.push_back((int16_t)(m_last[1] + (right - m_last[1]) * m_position));
+			m_position += m_step;
+		}
+
+		m_position -= 1.0;
+		m_last[0] = left;
+		m_last[1] = right;
+	}
+}
+
+// ********************** AudioRateControl implementation **********************
+AudioRateControl::AudioRateControl() :
+	m_nominalStep(1.0),
+	m_averageFill(0.0),
+	m_targetFill(0.0)
+{
+}
+
+void AudioRateControl::reset(double nominalStep, double targetFill)
+{
+	m_nominalStep = nominalStep;
+	m_averageFill = 0.0;
+	m_targetFill = targetFill;
+}
+
+double AudioRateControl::update(size_t fill)
+{
+	// Smooth the fill level: the device drains the ring a buffer at a
+	// time, the instant level jumps around
+	m_averageFill += ((double)fill - m_averageFill) * 0.05;
+
+	// Consume the input a bit faster when the ring fills up, a bit slower
+	// when it runs low
+	double error = std::min(std::max((m_averageFill - m_targetFill) / m_targetFill, -1.0), 1.0);
+	return m_nominalStep * (1.0 + AUDIO_MAX_RATE_ADJUST * error);
+}
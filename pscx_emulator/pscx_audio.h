@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sample rate of the SPU output and of CD-DA audio
+const uint32_t AUDIO_SAMPLE_RATE = 44100;
+
+// Most the resampling ratio is moved away from the nominal one, 0.5% is
+// well below what can be heard as a pitch change
+const double AUDIO_MAX_RATE_ADJUST = 0.005;
+
+// Ring of interleaved stereo 16 bit samples between two parts of the
+// emulated hardware, e.g. the CD-ROM mixer and the SPU CD input. Both
+// sides run on the emulation thread.
+struct AudioFifo
+{
+	// 'capacity' is a number of stereo frames
+	AudioFifo(size_t capacity);
+
+	// Append up to 'frames' frames from 'samples', return the number of
+	// frames written
+	size_t push(const int16_t* samples, size_t frames);
+
+	// Remove the oldest frame, return false and silence if it's empty
+	bool pop(int16_t& left, int16_t& right);
+
+	// Remove up to 'frames' frames to 'samples', return the number of
+	// frames read
+	size_t pop(int16_t* samples, size_t frames);
+
+	void clear();
+
+	size_t getFrameCount() const { return m_count; }
+	size_t getFreeCount() const { return m_capacity - m_count; }
+
+private:
+	std::vector<int16_t> m_samples;
+	size_t m_capacity;
+	// Frame index of the oldest frame
+	size_t m_readIndex;
+	size_t m_count;
+};
+
+// Ring of stereo frames with one producer and one consumer thread. Neither
+// side ever waits for the other.
+struct SpscAudioRing
+{
+	// 'capacity' is a number of frames, a power of two
+	SpscAudioRing(size_t capacity);
+
+	// Producer: append up to 'frames' frames, return the number written
+	size_t push(const int16_t* samples, size_t frames);
+
+	// Consumer: remove up to 'frames' frames, return the number read
+	size_t pop(int16_t* samples, size_t frames);
+
+	// Approximate when called from the producer or the consumer, the
+	// other side may be moving
+	size_t getFrameCount() const;
+	size_t getCapacity() const { return m_mask + 1; }
+
+private:
+	std::vector<int16_t> m_samples;
+	size_t m_mask;
+
+	// Free running frame counters, each written by one side only. Kept on
+	// separate cache lines so that the two threads don't share one.
+	alignas(64) std::atomic<size_t> m_writeIndex;
+	alignas(64) std::atomic<size_t> m_readIndex;
+};
+
+// Linear interpolation resampler whose ratio can change between calls
+struct AudioResampler
+{
+	AudioResampler();
+
+	// Input frames consumed per output frame
+	void setStep(double step) { m_step = step; }
+	double getStep() const { return m_step; }
+
+	// Resample 'frames' frames from 'samples', appending to 'output'
+	void process(const int16_t* samples, size_t frames, std::vector<int16_t>& output);
+
+private:
+	double m_step;
+
+	// Position of the next output frame after m_last, in [0, 1) when
+	// waiting for the next input frame
+	double m_position;
+
+	int16_t m_last[2];
+};
+
+// Keeps the ring between the emulation and an audio device around a target
+// fill level. The emulated and the device clocks never match exactly and
+// would otherwise drift into underruns or overflows, the resampling ratio
+// is nudged away from its nominal value to compensate.
+struct AudioRateControl
+{
+	AudioRateControl();
+
+	// 'nominalStep' is the resampling step at nominal speed, 'targetFill'
+	// the fill level aimed for in frames
+	void reset(double nominalStep, double targetFill);
+
+	// Restart the smoothing from the target, e.g. when the device starts
+	void resetAverage() { m_averageFill = m_targetFill; }
+
+	// Return the resampling step to use given the current ring fill level
+	double update(size_t fill);
+
+	double getTargetFill() const { return m_targetFill; }
+
+private:
+	double m_nominalStep;
+
+	// Smoothed ring fill level and the level aimed for, in frames
+	double m_averageFill;
+	double m_targetFill;
+};
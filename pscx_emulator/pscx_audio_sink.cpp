@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cstring>
+
+#include "SDL.h"
+
+#include "pscx_audio_sink.h"
+#include "pscx_common.h"
+
+// ********************** AudioOut implementation **********************
+void AudioOut::push(const int16_t* samples, size_t frames)
+{
+	for (AudioSink* sink : m_sinks)
+	{
+		sink->pushAudio(samples, frames);
+	}
+}
+
+void AudioOut::addSink(AudioSink* sink)
+{
+	m_sinks.push_back(sink);
+}
+
+void AudioOut::removeSink(AudioSink* sink)
+{
+	m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink), m_sinks.end());
+}
+
+// ********************** SdlAudioSink implementation **********************
+SdlAudioSink::SdlAudioSink() :
+	m_device(0x0),
+	m_ring(AUDIO_RING_FRAMES),
+	m_started(false),
+	m_underrunCount(0x0),
+	m_droppedCount(0x0)
+{
+}
+
+SdlAudioSink::~SdlAudioSink()
+{
+	close();
+}
+
+bool SdlAudioSink::open()
+{
+	close();
+
+	// The renderer only initializes the video and the controllers
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0)
+	{
+		WARN("Can't initialize the SDL audio: " << SDL_GetError());
+		return false;
+	}
+
+	SDL_AudioSpec desired;
+	SDL_zero(desired);
+	desired.freq = AUDIO_SAMPLE_RATE;
+	desired.format = AUDIO_S16SYS;
+	desired.channels = 2;
+	desired.samples = AUDIO_DEVICE_BUFFER_FRAMES;
+	desired.callback = &SdlAudioSink::audioCallback;
+	desired.userdata = this;
+
+	// The rate may differ, the resampler takes care of it
+	SDL_AudioSpec obtained;
+	m_device = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if (m_device == 0x0)
+	{
+		WARN("Can't open the audio device: " << SDL_GetError());
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+		return false;
+	}
+
+	// Input frames per device frame at nominal speed
+	double nominalStep = (double)AUDIO_SAMPLE_RATE / obtained.freq;
+	m_resampler.setStep(nominalStep);
+	m_rateControl.reset(nominalStep, (double)AUDIO_TARGET_BUFFERS * obtained.samples);
+	m_started = false;
+
+	LOG("Audio device opened at " << std::dec << obtained.freq << "Hz, " << obtained.samples << " frame buffers");
+	return true;
+}
+
+void SdlAudioSink::close()
+{
+	if (m_device == 0x0) return;
+
+	// Waits for the callback to return
+	SDL_CloseAudioDevice(m_device);
+	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+	m_device = 0x0;
+}
+
+void SdlAudioSink::pushAudio(const int16_t* samples, size_t frames)
+{
+	if (m_device == 0x0) return;
+
+	m_resampler.setStep(m_rateControl.update(m_ring.getFrameCount()));
+
+	m_resampled.clear();
+	m_resampler.process(samples, frames, m_resampled);
+
+	size_t resampledFrames = m_resampled.size() / 2;
+	size_t written = m_ring.push(m_resampled.data(), resampledFrames);
+	m_droppedCount += (uint32_t)(resampledFrames - written);
+
+	// Start playing once there's enough buffered to absorb the jitter
+	if (!m_started && m_ring.getFrameCount() >= m_rateControl.getTargetFill())
+	{
+		m_started = true;
+		m_rateControl.resetAverage();
+		SDL_PauseAudioDevice(m_device, 0);
+	}
+}
+
+void SdlAudioSink::audioCallback(void* userData, uint8_t* stream, int length)
+{
+	SdlAudioSink* sink = (SdlAudioSink*)userData;
+
+	size_t frames = (size_t)length / (2 * sizeof(int16_t));
+	size_t read = sink->m_ring.pop((int16_t*)stream, frames);
+
+	// Underrun: play silence rather than wait
+	if (read < frames)
+	{
+		memset(stream + read * 2 * sizeof(int16_t), 0x0, (frames - read) * 2 * sizeof(int16_t));
+		sink->m_underrunCount.fetch_add((uint32_t)(frames - read), std::memory_order_relaxed);
+	}
+}
+
+// ********************** WavFileSink implementation **********************
+WavFileSink::WavFileSink() :
+	m_frameCount(0x0)
+{
+}
+
+WavFileSink::~WavFileSink()
+{
+	close();
+}
+
+bool WavFileSink::open(const std::string& path)
+{
+	close();
+
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open())
+	{
+		WARN("Can't create the audio file " << path);
+		return false;
+	}
+
+	// Sizes are patched when closing
+	m_frameCount = 0x0;
+	writeHeader();
+	return true;
+}
+
+void WavFileSink::close()
+{
+	if (!m_file.is_open()) return;
+
+	m_file.seekp(0);
+	writeHeader();
+	m_file.close();
+}
+
+void WavFileSink::pushAudio(const int16_t* samples, size_t frames)
+{
+	if (!m_file.is_open()) return;
+
+	// WAV files are little endian like the samples on every supported host
+	m_file.write((const char*)samples, frames * 2 * sizeof(int16_t));
+	m_frameCount += (uint32_t)frames;
+}
+
+void WavFileSink::writeHeader()
+{
+	const uint16_t channels = 2;
+	const uint16_t bitsPerSample = 16;
+	const uint16_t blockAlign = channels * bitsPerSample / 8;
+	const uint32_t byteRate = AUDIO_SAMPLE_RATE * blockAlign;
+	const uint32_t dataSize = m_frameCount * blockAlign;
+
+	uint8_t header[44];
+	auto put16 = [&header](size_t offset, uint16_t value)
+	{
+		header[offset] = (uint8_t)value;
+		header[offset + 1] = (uint8_t)(value >> 8);
+	};
+	auto put32 = [&put16](size_t offset, uint32_t value)
+	{
+		put16(offset, (uint16_t)value);
+		put16(offset + 2, (uint16_t)(value >> 16));
+	};
+
+	memcpy(header + 0, "RIFF", 4);
+	put32(4, 36 + dataSize);
+	memcpy(header + 8, "WAVE", 4);
+
+	memcpy(header + 12, "fmt ", 4);
+	put32(16, 16);
+	put16(20, 1); // PCM
+	put16(22, channels);
+	put32(24, AUDIO_SAMPLE_RATE);
+	put32(28, byteRate);
+	put16(32, blockAlign);
+	put16(34, bitsPerSample);
+
+	memcpy(header + 36, "data", 4);
+	put32(40, dataSize);
+
+	m_file.write((const char*)header, sizeof(header));
+}
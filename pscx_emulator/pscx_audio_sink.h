@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "pscx_audio.h"
+
+// Frames buffered between the emulation thread and the audio device,
+// a power of two (~190ms)
+const size_t AUDIO_RING_FRAMES = 8192;
+
+// Frames requested by the device callback at a time
+const uint16_t AUDIO_DEVICE_BUFFER_FRAMES = 512;
+
+// Fill level the rate control aims for, in device buffers
+const uint32_t AUDIO_TARGET_BUFFERS = 3;
+
+// Consumer of the SPU output
+struct AudioSink
+{
+	virtual ~AudioSink() {}
+
+	// Called on the emulation thread with 'frames' interleaved stereo
+	// frames at AUDIO_SAMPLE_RATE. Must not block.
+	virtual void pushAudio(const int16_t* samples, size_t frames) = 0;
+};
+
+// Audio output stage: forwards the SPU output to the sinks
+struct AudioOut
+{
+	void push(const int16_t* samples, size_t frames);
+
+	void addSink(AudioSink* sink);
+	void removeSink(AudioSink* sink);
+
+	bool hasSinks() const { return !m_sinks.empty(); }
+
+private:
+	std::vector<AudioSink*> m_sinks;
+};
+
+// Audio sink playing the output on the default SDL audio device. The
+// emulation thread resamples to the device rate into a lock-free ring
+// which the device callback drains. The resampling ratio is nudged to keep
+// the ring around its target fill ( see AudioRateControl ).
+struct SdlAudioSink : public AudioSink
+{
+	SdlAudioSink();
+	~SdlAudioSink();
+
+	// Initialize the SDL audio subsystem and open the device
+	bool open();
+	void close();
+
+	bool isOpen() const { return m_device != 0x0; }
+
+	void pushAudio(const int16_t* samples, size_t frames) override;
+
+	// Frames the device asked for while the ring was empty
+	uint32_t getUnderrunCount() const { return m_underrunCount.load(std::memory_order_relaxed); }
+
+	// Frames which didn't fit in the ring, e.g. when fast forwarding
+	uint32_t getDroppedCount() const { return m_droppedCount; }
+
+private:
+	static void audioCallback(void* userData, uint8_t* stream, int length);
+
+	// SDL_AudioDeviceID, 0 when closed
+	uint32_t m_device;
+
+	SpscAudioRing m_ring;
+	AudioResampler m_resampler;
+	AudioRateControl m_rateControl;
+	std::vector<int16_t> m_resampled;
+
+	// The device starts paused until the ring reaches its target
+	bool m_started;
+
+	std::atomic<uint32_t> m_underrunCount;
+	uint32_t m_droppedCount;
+};
+
+// Audio sink recording the output to a 16 bit stereo WAV file
+struct WavFileSink : public AudioSink
+{
+	WavFileSink();
+	~WavFileSink();
+
+	bool open(const std::string& path);
+
+	// Write the final sizes in the header and close the file
+	void close();
+
+	bool isOpen() const { return m_file.is_open(); }
+
+	void pushAudio(const int16_t* samples, size_t frames) override;
+
+	uint32_t getWrittenCount() const { return m_frameCount; }
+
+private:
+	void writeHeader();
+
+	std::ofstream m_file;
+	uint32_t m_frameCount;
+};
+
+// Audio sink discarding the output, for running without an audio device
+struct NullAudioSink : public AudioSink
+{
+	NullAudioSink() :
+		m_frameCount(0x0)
+	{}
+
+	void pushAudio(const int16_t* /*samples*/, size_t frames) override { m_frameCount += frames; }
+
+	uint64_t getFrameCount() const { return m_frameCount; }
+
+private:
+	uint64_t m_frameCount;
+};
@@ -0,0 +1,346 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+#include "pscx_capture.h"
+#include "pscx_common.h"
+
+// ***************** FrameCapture implementation ******************
+FrameCapture::FrameCapture() :
+	m_format(CaptureFormat::CAPTURE_FORMAT_RAW),
+	m_queueHead(0x0),
+	m_queueCount(0x0),
+	m_stopping(false),
+	m_hasFrame(false),
+	m_streamWidth(0x0),
+	m_streamHeight(0x0),
+	m_headerWritten(false),
+	m_writeFailed(false),
+	m_writtenCount(0x0),
+	m_droppedCount(0x0)
+{
+}
+
+FrameCapture::~FrameCapture()
+{
+	stop();
+}
+
+CaptureFormat FrameCapture::formatFromPath(const std::string& path)
+{
+	std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : std::string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	return (extension == ".y4m") ? CaptureFormat::CAPTURE_FORMAT_Y4M : CaptureFormat::CAPTURE_FORMAT_RAW;
+}
+
+bool FrameCapture::start(const std::string& path, CaptureFormat format)
+{
+	stop();
+
+	m_file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!m_file.good())
+	{
+		WARN("Can't create the capture file " << path);
+		return false;
+	}
+
+	// Allocate everything up front, the emulation thread never allocates
+	m_freeBuffers.clear();
+	for (uint8_t i = 0; i < CAPTURE_POOL_SIZE; ++i)
+	{
+		m_buffers[i].m_pixels.resize((size_t)DISPLAY_MAX_WIDTH * DISPLAY_MAX_HEIGHT);
+		m_freeBuffers.push_back(i);
+	}
+
+	m_format = format;
+	m_queueHead = 0x0;
+	m_queueCount = 0x0;
+	m_stopping = false;
+	m_hasFrame = false;
+	m_headerWritten = false;
+	m_writeFailed = false;
+	m_writtenCount = 0x0;
+	m_droppedCount = 0x0;
+
+	m_writer = std::thread(&FrameCapture::writerLoop, this);
+	return true;
+}
+
+void FrameCapture::stop()
+{
+	if (!m_writer.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wake.notify_one();
+	m_writer.join();
+
+	m_file.close();
+}
+
+bool FrameCapture::enqueue(uint8_t entry)
+{
+	if (m_queueCount == CAPTURE_QUEUE_SIZE) return false;
+
+	m_queue[(m_queueHead + m_queueCount) % CAPTURE_QUEUE_SIZE] = entry;
+	m_queueCount += 1;
+	return true;
+}
+
+void FrameCapture::pushFrame(const DisplayFrame& frame)
+{
+	if (!m_writer.joinable()) return;
+
+	uint8_t index = REPEAT_ENTRY;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_freeBuffers.empty())
+		{
+			index = m_freeBuffers.back();
+			m_freeBuffers.pop_back();
+		}
+	}
+
+	if (index == REPEAT_ENTRY)
+	{
+		// The writer is behind, keep the timing with a repeat of the
+		// previous picture if there's room for it
+		m_droppedCount += 1;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_hasFrame && enqueue(REPEAT_ENTRY))
+		{
+			m_wake.notify_one();
+		}
+		return;
+	}
+
+	// The buffer belongs to this thread until it's queued, no need to
+	// hold the lock during the copy
+	Buffer& buffer = m_buffers[index];
+	buffer.m_width = frame.m_width;
+	buffer.m_height = frame.m_height;
+	buffer.m_fieldRate = frame.m_fieldRate;
+	memcpy(buffer.m_pixels.data(), frame.m_pixels.data(), frame.m_pixels.size() * sizeof(uint32_t));
+
+	bool queued;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		queued = enqueue(index);
+		if (queued)
+		{
+			m_hasFrame = true;
+		}
+		else
+		{
+			m_freeBuffers.push_back(index);
+		}
+	}
+
+	if (queued)
+	{
+		m_wake.notify_one();
+	}
+	else
+	{
+		m_droppedCount += 1;
+	}
+}
+
+void FrameCapture::repeatFrame(const DisplayFrame& /*frame*/)
+{
+	if (!m_writer.joinable()) return;
+
+	bool queued;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_hasFrame) return;
+
+		queued = enqueue(REPEAT_ENTRY);
+	}
+
+	if (queued)
+	{
+		m_wake.notify_one();
+	}
+	else
+	{
+		m_droppedCount += 1;
+	}
+}
+
+void FrameCapture::writerLoop()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		m_wake.wait(lock, [this] { return m_queueCount != 0x0 || m_stopping; });
+
+		// Drain the queue before honoring a stop request
+		if (m_queueCount == 0x0) break;
+
+		uint8_t entry = m_queue[m_queueHead];
+		m_queueHead = (m_queueHead + 1) % CAPTURE_QUEUE_SIZE;
+		m_queueCount -= 1;
+
+		lock.unlock();
+
+		if (entry != REPEAT_ENTRY)
+		{
+			const Buffer& buffer = m_buffers[entry];
+			if (!m_headerWritten)
+			{
+				writeHeader(buffer);
+			}
+			encode(buffer);
+		}
+
+		// A repeat outputs m_encoded again, there's always a frame before it
+		writeEncoded();
+
+		lock.lock();
+
+		if (entry != REPEAT_ENTRY)
+		{
+			m_freeBuffers.push_back(entry);
+		}
+	}
+}
+
+void FrameCapture::writeHeader(const Buffer& buffer)
+{
+	m_streamWidth = buffer.m_width;
+	m_streamHeight = buffer.m_height;
+	m_headerWritten = true;
+
+	if (m_format == CaptureFormat::CAPTURE_FORMAT_Y4M)
+	{
+		// Field rate as a fraction with a 1/1000 Hz precision
+		uint32_t rate = (uint32_t)std::lround(buffer.m_fieldRate * 1000.0);
+
+		std::ostringstream header;
+		header << "YUV4MPEG2 W" << m_streamWidth << " H" << m_streamHeight
+			   << " F" << rate << ":1000 Ip A0:0 C420jpeg\n";
+
+		std::string text = header.str();
+		m_file.write(text.data(), text.size());
+	}
+}
+
+void FrameCapture::encode(const Buffer& buffer)
+{
+	if (m_format == CaptureFormat::CAPTURE_FORMAT_Y4M)
+	{
+		encodeY4m(buffer);
+	}
+	else
+	{
+		encodeRaw(buffer);
+	}
+}
+
+void FrameCapture::encodeRaw(const Buffer& buffer)
+{
+	size_t lineSize = (size_t)m_streamWidth * sizeof(uint32_t);
+	m_encoded.resize(lineSize * m_streamHeight);
+
+	uint16_t width = std::min(buffer.m_width, m_streamWidth);
+	uint16_t height = std::min(buffer.m_height, m_streamHeight);
+
+	uint32_t* dst = (uint32_t*)m_encoded.data();
+	for (uint16_t y = 0; y < m_streamHeight; ++y)
+	{
+		uint32_t* line = dst + (size_t)y * m_streamWidth;
+		if (y < height)
+		{
+			memcpy(line, &buffer.m_pixels[(size_t)y * buffer.m_width], width * sizeof(uint32_t));
+		}
+		std::fill(line + (y < height ? width : 0), line + m_streamWidth, DISPLAY_BLACK);
+	}
+}
+
+// RGBA8 pixel of 'buffer' at 'x', 'y', black outside of the picture
+static uint32_t getPixel(const std::vector<uint32_t>& pixels, uint16_t width, uint16_t height, uint16_t x, uint16_t y)
+{
+	if (x >= width || y >= height) return DISPLAY_BLACK;
+	return pixels[(size_t)y * width + x];
+}
+
+void FrameCapture::encodeY4m(const Buffer& buffer)
+{
+	// Chroma planes are subsampled by 2 in both directions, rounded up
+	uint16_t chromaWidth = (m_streamWidth + 1) / 2;
+	uint16_t chromaHeight = (m_streamHeight + 1) / 2;
+
+	size_t lumaSize = (size_t)m_streamWidth * m_streamHeight;
+	size_t chromaSize = (size_t)chromaWidth * chromaHeight;
+	m_encoded.resize(lumaSize + chromaSize * 2);
+
+	uint8_t* planeY = m_encoded.data();
+	uint8_t* planeU = planeY + lumaSize;
+	uint8_t* planeV = planeU + chromaSize;
+
+	for (uint16_t y = 0; y < m_streamHeight; ++y)
+	{
+		for (uint16_t x = 0; x < m_streamWidth; ++x)
+		{
+			uint32_t pixel = getPixel(buffer.m_pixels, buffer.m_width, buffer.m_height, x, y);
+			int32_t r = pixel & 0xff;
+			int32_t g = (pixel >> 8) & 0xff;
+			int32_t b = (pixel >> 16) & 0xff;
+
+			planeY[(size_t)y * m_streamWidth + x] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		}
+	}
+
+	for (uint16_t y = 0; y < chromaHeight; ++y)
+	{
+		for (uint16_t x = 0; x < chromaWidth; ++x)
+		{
+			// Average of the 2x2 block, the last line and column are
+			// repeated for odd sizes
+			int32_t r = 0, g = 0, b = 0;
+			for (uint16_t i = 0; i < 4; ++i)
+			{
+				uint16_t px = std::min<uint16_t>(x * 2 + (i & 1), m_streamWidth - 1);
+				uint16_t py = std::min<uint16_t>(y * 2 + (i >> 1), m_streamHeight - 1);
+
+				uint32_t pixel = getPixel(buffer.m_pixels, buffer.m_width, buffer.m_height, px, py);
+				r += pixel & 0xff;
+				g += (pixel >> 8) & 0xff;
+				b += (pixel >> 16) & 0xff;
+			}
+			r = (r + 2) >> 2;
+			g = (g + 2) >> 2;
+			b = (b + 2) >> 2;
+
+			size_t offset = (size_t)y * chromaWidth + x;
+			planeU[offset] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			planeV[offset] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+	}
+}
+
+void FrameCapture::writeEncoded()
+{
+	if (m_writeFailed) return;
+
+	if (m_format == CaptureFormat::CAPTURE_FORMAT_Y4M)
+	{
+		m_file.write("FRAME\n", 6);
+	}
+	m_file.write((const char*)m_encoded.data(), m_encoded.size());
+
+	if (!m_file.good())
+	{
+		WARN("Capture file write failed, stopping the capture");
+		m_writeFailed = true;
+		return;
+	}
+
+	m_writtenCount += 1;
+}
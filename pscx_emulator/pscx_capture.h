@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pscx_display.h"
+
+// Number of preallocated frame buffers. When the writer falls behind by
+// that many frames the new ones are dropped.
+const uint8_t CAPTURE_POOL_SIZE = 8;
+
+// Maximum number of pending entries (frames and repeats) in the queue
+const uint8_t CAPTURE_QUEUE_SIZE = 32;
+
+enum CaptureFormat
+{
+	// Uncompressed RGBA8 frames, one after the other, no header
+	CAPTURE_FORMAT_RAW,
+
+	// YUV4MPEG2 stream, 4:2:0 BT.601 limited range
+	CAPTURE_FORMAT_Y4M
+};
+
+// Frame sink writing the video output to a file. The emulation thread only
+// copies the frame into a pooled buffer, the conversion and the file I/O
+// are done by a writer thread. Frames which don't fit in the pool are
+// dropped and replaced by a repeat of the previous picture to keep the
+// timing of the stream.
+struct FrameCapture : public FrameSink
+{
+	FrameCapture();
+	~FrameCapture();
+
+	// Create 'path' and start the writer thread. The stream resolution and
+	// frame rate are taken from the first frame.
+	bool start(const std::string& path, CaptureFormat format);
+
+	// Write the pending frames, stop the writer thread and close the file
+	void stop();
+
+	bool isActive() const { return m_writer.joinable(); }
+
+	void pushFrame(const DisplayFrame& frame) override;
+	void repeatFrame(const DisplayFrame& frame) override;
+
+	// Number of frames written to the file, repeats included
+	uint32_t getWrittenCount() const { return m_writtenCount; }
+
+	// Number of frames whose picture didn't make it to the file
+	uint32_t getDroppedCount() const { return m_droppedCount; }
+
+	// Y4M for '.y4m' files, raw otherwise
+	static CaptureFormat formatFromPath(const std::string& path);
+
+private:
+	// Queue entry asking the writer to output the previous frame again
+	static const uint8_t REPEAT_ENTRY = 0xff;
+
+	struct Buffer
+	{
+		Buffer() :
+			m_width(0x0),
+			m_height(0x0),
+			m_fieldRate(0.0)
+		{}
+
+		uint16_t m_width, m_height;
+		double m_fieldRate;
+		std::vector<uint32_t> m_pixels;
+	};
+
+	// Add 'entry' to the queue, return false if the queue is full.
+	// m_mutex must be held.
+	bool enqueue(uint8_t entry);
+
+	void writerLoop();
+
+	// Write the stream header, sized after 'buffer'
+	void writeHeader(const Buffer& buffer);
+
+	// Convert 'buffer' to the stream format into m_encoded. Frames of a
+	// different size than the stream are cropped or padded with black.
+	void encode(const Buffer& buffer);
+	void encodeY4m(const Buffer& buffer);
+	void encodeRaw(const Buffer& buffer);
+
+	// Write m_encoded as the next frame of the stream
+	void writeEncoded();
+
+	CaptureFormat m_format;
+	std::ofstream m_file;
+
+	Buffer m_buffers[CAPTURE_POOL_SIZE];
+
+	// Indices of the buffers not owned by the queue or the writer
+	std::vector<uint8_t> m_freeBuffers;
+
+	// Circular queue of buffer indices and REPEAT_ENTRY
+	uint8_t m_queue[CAPTURE_QUEUE_SIZE];
+	uint8_t m_queueHead;
+	uint8_t m_queueCount;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::thread m_writer;
+	bool m_stopping;
+
+	// Set by the emulation thread once a frame has been queued, repeats
+	// before the first frame are ignored
+	bool m_hasFrame;
+
+	// Writer thread state: stream size, header and last encoded frame
+	uint16_t m_streamWidth, m_streamHeight;
+	bool m_headerWritten;
+	bool m_writeFailed;
+	std::vector<uint8_t> m_encoded;
+
+	std::atomic<uint32_t> m_writtenCount;
+	std::atomic<uint32_t> m_droppedCount;
+};
@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
 
 #include "pscx_cdrom.h"
 #include "pscx_common.h"
 #include "pscx_cpu.h"
+#include "pscx_simd.h"
 
 // ***************** Fifo implementation *********************
 Fifo Fifo::fromBytes(const std::vector<uint8_t>& bytes)
@@ -55,6 +58,40 @@ uint8_t Fifo::pop()
 }
 
 // ***************** CdRom implementation *********************
+void Mixer::apply(const int16_t* input, int16_t* output, size_t frames) const
+{
+	size_t i = 0;
+
+#ifdef PSCX_SSE2
+	// Each output sample is the dot product of an input frame with a pair
+	// of volumes, madd computes it for 4 frames at once
+	const __m128i toLeft = _mm_set1_epi32((int32_t)((uint32_t)m_cdLeftToSpuLeft | ((uint32_t)m_cdRightToSpuLeft << 16)));
+	const __m128i toRight = _mm_set1_epi32((int32_t)((uint32_t)m_cdLeftToSpuRight | ((uint32_t)m_cdRightToSpuRight << 16)));
+
+	for (; i + 4 <= frames; i += 4)
+	{
+		__m128i samples = _mm_loadu_si128((const __m128i*)(input + i * 2));
+		__m128i left = _mm_srai_epi32(_mm_madd_epi16(samples, toLeft), 7);
+		__m128i right = _mm_srai_epi32(_mm_madd_epi16(samples, toRight), 7);
+
+		// Interleave again, saturating to 16 bits
+		__m128i low = _mm_unpacklo_epi32(left, right);
+		__m128i high = _mm_unpackhi_epi32(left, right);
+		_mm_storeu_si128((__m128i*)(output + i * 2), _mm_packs_epi32(low, high));
+	}
+#endif
+
+	auto clamp = [](int32_t value) -> int16_t { return (int16_t)std::min(std::max(value, -0x8000), 0x7fff); };
+
+	for (; i < frames; ++i)
+	{
+		int32_t left = input[i * 2];
+		int32_t right = input[i * 2 + 1];
+		output[i * 2] = clamp((left * m_cdLeftToSpuLeft + right * m_cdRightToSpuLeft) >> 7);
+		output[i * 2 + 1] = clamp((left * m_cdLeftToSpuRight + right * m_cdRightToSpuRight) >> 7);
+	}
+}
+
 template<typename T>
 T CdRom::load(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t offset)
 {
@@ -123,7 +160,7 @@ void CdRom::store(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t off
 		}
 		else if (m_index == 0x3)
 		{
-			m_mixer.m_cdRightToSpuRight = valueToStore;
+			m_nextMixer.m_cdRightToSpuRight = valueToStore;
 		}
 		break;
 	}
@@ -141,11 +178,11 @@ void CdRom::store(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t off
 		}
 		else if (m_index == 0x2)
 		{
-			m_mixer.m_cdLeftToSpuLeft = valueToStore;
+			m_nextMixer.m_cdLeftToSpuLeft = valueToStore;
 		}
 		else if (m_index == 0x3)
 		{
-			m_mixer.m_cdRightToSpuLeft = valueToStore;
+			m_nextMixer.m_cdRightToSpuLeft = valueToStore;
 		}
 		break;
 	}
@@ -158,6 +195,12 @@ void CdRom::store(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t off
 		else if (m_index == 0x1)
 		{
 			irqAck(valueToStore & 0x1f);
+
+			// The acknowledge might have brought the next sector forward
+			if (m_readState == ReadState::READ_STATE_READING)
+			{
+				timeKeeper.setNextSyncDeltaIfCloser(Peripheral::PERIPHERAL_CDROM, (Cycles)m_helperReading.m_delay);
+			}
 			if (valueToStore & 0x40)
 			{
 				m_params.clear();
@@ -167,11 +210,16 @@ void CdRom::store(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t off
 		}
 		else if (m_index == 0x2)
 		{
-			m_mixer.m_cdLeftToSpuRight = valueToStore;
+			m_nextMixer.m_cdLeftToSpuRight = valueToStore;
 		}
 		else if (m_index == 0x3)
 		{
 			LOG("CDROM Mixer apply 0x" << std::hex << value);
+			m_adpcmMuted = valueToStore & 0x01;
+			if (valueToStore & 0x20)
+			{
+				m_mixer = m_nextMixer;
+			}
 		}
 		break;
 	}
@@ -251,7 +299,7 @@ void CdRom::sync(TimeKeeper& timeKeeper, InterruptState& irqState)
 	m_commandState = newCommandState;
 
 	// See if we have a read pending.
-	if (ReadState::READ_STATE_READING == m_readState)
+	if (ReadState::READ_STATE_IDLE != m_readState)
 	{
 		uint32_t nextSync;
 		if ((Cycles)m_helperReading.m_delay > delta)
@@ -262,13 +310,22 @@ void CdRom::sync(TimeKeeper& timeKeeper, InterruptState& irqState)
 		else
 		{
 			// A sector has been read from the disc.
-			sectorRead(irqState);
+			if (ReadState::READ_STATE_PLAYING == m_readState)
+			{
+				sectorPlayed(irqState);
+			}
+			else
+			{
+				sectorRead(irqState);
+			}
 			// Prepare for the next one.
-			nextSync = getCyclesPerSector();
+			nextSync = getSectorDelay();
 		}
 		m_helperReading.m_delay = nextSync;
-		m_readState = ReadState::READ_STATE_READING;
-		timeKeeper.setNextSyncDeltaIfCloser(Peripheral::PERIPHERAL_CDROM, (Cycles)nextSync);
+		if (ReadState::READ_STATE_IDLE != m_readState)
+		{
+			timeKeeper.setNextSyncDeltaIfCloser(Peripheral::PERIPHERAL_CDROM, (Cycles)nextSync);
+		}
 	}
 }
 
@@ -286,13 +343,42 @@ uint8_t CdRom::readByte()
 
 uint32_t CdRom::dmaReadWord()
 {
-	uint32_t b0 = readByte();
-	uint32_t b1 = readByte();
-	uint32_t b2 = readByte();
-	uint32_t b3 = readByte();
+	uint8_t bytes[4];
+	dmaRead(bytes, sizeof(bytes));
 
 	// Pack in a little endian word.
-	return b0 | (b1 << 8) | (b2 << 16) | (b3 << 24);
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+void CdRom::dmaRead(uint8_t* dst, uint32_t size)
+{
+	assert(("Read byte while !m_rxActive", m_rxActive));
+
+	uint32_t available = m_rxIndex < m_rxLen ? m_rxLen - m_rxIndex : 0x0;
+	uint32_t count = m_rxSector ? std::min(size, available) : 0x0;
+
+	uint32_t position = m_rxOffset + m_rxIndex;
+	if (count > 0)
+	{
+		memcpy(dst, m_rxSector->getRawSectorInBytes() + position, count);
+	}
+
+	if (count < size)
+	{
+		assert(("Unhandled CDROM long read", false));
+
+		// Like readByte() the bytes following the RX window are read,
+		// up to the end of the sector
+		uint32_t extra = 0x0;
+		if (m_rxSector && position + count < (uint32_t)SECTOR_SIZE)
+		{
+			extra = std::min(size - count, (uint32_t)SECTOR_SIZE - (position + count));
+			memcpy(dst + count, m_rxSector->getRawSectorInBytes() + position + count, extra);
+		}
+		memset(dst + count + extra, 0x0, size - count - extra);
+	}
+
+	m_rxIndex += (uint16_t)size;
 }
 
 void CdRom::doSeek()
@@ -301,6 +387,13 @@ void CdRom::doSeek()
 	assert(("Seek to track 1 pregap", m_seekTarget >= MinuteSecondFrame::fromBCD(0x0, 0x2, 0x0)));
 
 	m_readPosition = m_seekTarget;
+
+	// The ADPCM stream starts over at the new position
+	m_xaDecoder.reset();
+
+	// Start reading the sectors in the background while the drive
+	// head moves
+	m_readAhead.seek(m_readPosition);
 	//std::cout << "seekTarget= " << (uint32_t)m_seekTarget.getMinute() << " " << (uint32_t)m_seekTarget.getSecond() << " " << (uint32_t)m_seekTarget.getFrame() << std::endl;
 	m_seekTargetPending = false;
 }
@@ -315,13 +408,41 @@ void CdRom::sectorRead(InterruptState& irqState)
 	LOG("CDROM: read sector at position " << std::hex << m_readPosition.getMinute() << ":" << m_readPosition.getSecond() << ":" << m_readPosition.getFrame());
 	//std::cout << "readPosition before= " << (uint32_t)m_readPosition.getMinute() << " " << (uint32_t)m_readPosition.getSecond() << " " << (uint32_t)m_readPosition.getFrame() << std::endl;
 
-	XaSector::ResultXaSector resultXaSector = const_cast<Disc*>(getDiscOrDie())->readDataSector(m_readPosition);
+	XaSector::ResultXaSector resultXaSector = m_readAhead.take(m_readPosition);
 	assert(("Couldn't read sector", resultXaSector.getSectorStatus() == XaSector::XaSectorStatus::XA_SECTOR_STATUS_OK));
-	m_rxSector = resultXaSector.getSectorPtr();
 
-	if (m_readWholeSector)
+	// Sub-mode byte of the XA sub-header: audio ( bit 2 ), video ( bit 1 )
+	// or real-time ( bit 6 ) sectors are streamed.
+	const XaSector* sector = resultXaSector.getSectorPtr();
+	uint8_t subMode = sector->getDataByte(18);
+
+	// Form 2 ( bit 5 ) audio sectors are XA-ADPCM. When ADPCM playback is
+	// enabled they go to the SPU and never reach the RX buffer.
+	if (m_xaAdpcmToSpu && (subMode & 0x24) == 0x24 && !m_disc->isAudioSector(m_readPosition))
+	{
+		if (!m_xaFilter || (sector->getDataByte(16) == m_xaFilterFile && sector->getDataByte(17) == m_xaFilterChannel))
+		{
+			playXaAdpcm(*sector);
+		}
+		m_readPosition = m_readPosition.getNextSector();
+		return;
+	}
+
+	// The previous sector buffer goes back to the pool
+	m_rxSector = resultXaSector.takeSector();
+	m_streamingSector = (subMode & 0x46) != 0x0;
+
+	if (m_disc->isAudioSector(m_readPosition))
+	{
+		// CD-DA sectors are read whole, they have no header
+		m_rxOffset = 0;
+		m_rxLen = 2352;
+		m_streamingSector = true;
+	}
+	else if (m_readWholeSector)
 	{
 		// Read the entire sector except for the sync pattern
+		m_rxSector->completeEdc();
 		m_rxOffset = 12;
 		m_rxLen = 2340;
 	}
@@ -345,6 +466,94 @@ void CdRom::sectorRead(InterruptState& irqState)
 	//std::cout << "readPosition= " << (uint32_t)m_readPosition.getMinute() << " " << (uint32_t)m_readPosition.getSecond() << " " << (uint32_t)m_readPosition.getFrame() << std::endl;
 }
 
+void CdRom::playXaAdpcm(const XaSector& sector)
+{
+	// The decoder runs even when muted so that it follows the stream
+	size_t frames = m_xaDecoder.decodeSector(sector.getRawSectorInBytes(), m_xaFrames.data());
+	if (m_muted || m_adpcmMuted) return;
+
+	m_mixer.apply(m_xaFrames.data(), m_xaFrames.data(), frames);
+	m_audioOut.push(m_xaFrames.data(), frames);
+}
+
+static uint8_t toBcd(uint32_t value)
+{
+	return (uint8_t)(((value / 10) << 4) | (value % 10));
+}
+
+void CdRom::sectorPlayed(InterruptState& irqState)
+{
+	uint8_t track = m_disc->getTrackAt(m_readPosition);
+
+	// Playback stops at the end of the disc, or of the track in AutoPause mode
+	if (track == 0x0 || (m_autoPause && track != m_playTrack))
+	{
+		m_readState = ReadState::READ_STATE_IDLE;
+		if (m_irqFlags == 0x0)
+		{
+			m_response = Fifo::fromBytes({ getDriveStatus() });
+			triggerIrq(irqState, IrqCode::IRQ_CODE_DATA_END);
+		}
+		return;
+	}
+	m_playTrack = track;
+
+	XaSector::ResultXaSector resultXaSector = m_readAhead.take(m_readPosition);
+
+	// Data sectors play as silence
+	const int16_t* samples = nullptr;
+	if (resultXaSector.getSectorStatus() == XaSector::XaSectorStatus::XA_SECTOR_STATUS_OK && m_disc->isAudioSector(m_readPosition))
+	{
+		samples = (const int16_t*)resultXaSector.getSectorPtr()->getRawSectorInBytes();
+	}
+
+	if (samples && !m_muted)
+	{
+		// 588 stereo frames per sector at 44.1kHz
+		int16_t mixed[SECTOR_SIZE / 2];
+		m_mixer.apply(samples, mixed, SECTOR_SIZE / 4);
+		m_audioOut.push(mixed, SECTOR_SIZE / 4);
+	}
+
+	// Reports are sent on every 10th frame, alternating between the
+	// absolute position and the position relative to the track start
+	uint8_t frame = m_readPosition.getFrame();
+	if (m_report && (frame & 0xf) == 0x0 && m_irqFlags == 0x0)
+	{
+		uint32_t sectorIndex = m_readPosition.getSectorIndex() - 150;
+		uint32_t trackStart = m_disc->getTracks()[track - 1].m_startSector;
+		bool pregap = sectorIndex < trackStart;
+
+		uint16_t peak = 0x0;
+		for (size_t i = 0; samples && i < SECTOR_SIZE / 2; ++i)
+		{
+			peak = std::max(peak, (uint16_t)std::min(std::abs((int32_t)samples[i]), 0x7fff));
+		}
+
+		MinuteSecondFrame position = m_readPosition;
+		uint8_t secondFlag = 0x0;
+		if (frame & 0x10)
+		{
+			position = MinuteSecondFrame::fromSectorIndex(pregap ? trackStart - sectorIndex : sectorIndex - trackStart);
+			secondFlag = 0x80;
+		}
+
+		m_response = Fifo::fromBytes({
+			getDriveStatus(),
+			toBcd(track),
+			(uint8_t)(pregap ? 0x0 : 0x1),
+			position.getMinute(),
+			(uint8_t)(position.getSecond() | secondFlag),
+			position.getFrame(),
+			(uint8_t)peak,
+			(uint8_t)(peak >> 8)
+			});
+		triggerIrq(irqState, IrqCode::IRQ_CODE_SECTOR_READY);
+	}
+
+	m_readPosition = m_readPosition.getNextSector();
+}
+
 uint8_t CdRom::getStatus()
 {
 	uint8_t status = m_index;
@@ -391,8 +600,15 @@ void CdRom::setIndex(uint8_t index)
 
 void CdRom::irqAck(uint8_t value)
 {
+	bool sectorAcknowledged = m_irqFlags == IrqCode::IRQ_CODE_SECTOR_READY;
 	m_irqFlags &= (~value);
 
+	if (m_irqFlags == 0 && sectorAcknowledged && m_speedUp.m_deliverOnAck &&
+		m_readState == ReadState::READ_STATE_READING && isReadAccelerated())
+	{
+		m_helperReading.m_delay = std::min(m_helperReading.m_delay, CDROM_ACK_SECTOR_DELAY);
+	}
+
 	if (m_irqFlags == 0)
 	{
 		assert(("CDROM IRQ acknowledge while controller is busy", m_commandState == CommandState::COMMAND_STATE_IDLE));
@@ -431,12 +647,44 @@ void CdRom::irqMask(uint8_t value)
 	m_irqMask = value & 0x1f;
 }
 
-uint32_t CdRom::getCyclesPerSector()
+uint32_t CdRom::getCyclesPerSector() const
 {
 	// 1x speed: 75 sectors per second
 	return (CPU_FREQ_HZ / 75) >> (uint32_t)m_doubleSpeed;
 }
 
+uint32_t CdRom::getSectorDelay() const
+{
+	uint32_t cycles = getCyclesPerSector();
+	if (isReadAccelerated())
+	{
+		cycles /= m_speedUp.m_readSpeedFactor;
+	}
+	return cycles;
+}
+
+bool CdRom::isReadAccelerated() const
+{
+	// Streams are consumed at the drive's rate, reading them faster would
+	// overrun the ADPCM decoder or the MDEC
+	return m_readState == ReadState::READ_STATE_READING && !m_xaAdpcmToSpu && !m_streamingSector;
+}
+
+uint32_t CdRom::getMechanicalDelay(uint32_t cycles) const
+{
+	if (m_speedUp.m_seekDivider == 0x0)
+	{
+		return CDROM_MIN_MECHANICAL_DELAY;
+	}
+	return std::max(cycles / m_speedUp.m_seekDivider, std::min(cycles, CDROM_MIN_MECHANICAL_DELAY));
+}
+
+void CdRom::setSpeedUp(const CdRomSpeedUp& speedUp)
+{
+	assert(("CDROM: read speed factor must be at least 1", speedUp.m_readSpeedFactor >= 1));
+	m_speedUp = speedUp;
+}
+
 void CdRom::command(TimeKeeper& timeKeeper, uint8_t cmd)
 {
 	assert(("CDROM command while controller is busy", m_commandState == CommandState::COMMAND_STATE_IDLE));
@@ -456,11 +704,23 @@ void CdRom::command(TimeKeeper& timeKeeper, uint8_t cmd)
 		onAcknowledge = &CdRom::cmdSetLoc;
 		break;
 	}
+	case 0x03:
+	{
+		onAcknowledge = &CdRom::cmdPlay;
+		break;
+	}
 	case 0x06:
+	// ReadS reads without retrying on errors, there are none here
+	case 0x1b:
 	{
 		onAcknowledge = &CdRom::cmdReadN;
 		break;
 	}
+	case 0x08:
+	{
+		onAcknowledge = &CdRom::cmdStop;
+		break;
+	}
 	case 0x09:
 	{
 		onAcknowledge = &CdRom::cmdPause;
@@ -471,17 +731,39 @@ void CdRom::command(TimeKeeper& timeKeeper, uint8_t cmd)
 		onAcknowledge = &CdRom::cmdInit;
 		break;
 	}
+	case 0x0b:
+	{
+		onAcknowledge = &CdRom::cmdMute;
+		break;
+	}
 	case 0x0c:
 	{
 		onAcknowledge = &CdRom::cmdDemute;
 		break;
 	}
+	case 0x0d:
+	{
+		onAcknowledge = &CdRom::cmdSetFilter;
+		break;
+	}
 	case 0x0e:
 	{
 		onAcknowledge = &CdRom::cmdSetMode;
 		break;
 	}
+	case 0x13:
+	{
+		onAcknowledge = &CdRom::cmdGetTN;
+		break;
+	}
+	case 0x14:
+	{
+		onAcknowledge = &CdRom::cmdGetTD;
+		break;
+	}
 	case 0x15:
+	// SeekP seeks using the subchannel position, the result is the same
+	case 0x16:
 	{
 		onAcknowledge = &CdRom::cmdSeekl;
 		break;
@@ -526,7 +808,7 @@ void CdRom::command(TimeKeeper& timeKeeper, uint8_t cmd)
 		m_onAcknowledge = onAcknowledge;
 	}
 
-	if (m_readState == ReadState::READ_STATE_READING)
+	if (m_readState != ReadState::READ_STATE_IDLE)
 	{
 		timeKeeper.setNextSyncDeltaIfCloser(Peripheral::PERIPHERAL_CDROM, (Cycles)m_helperReading.m_delay);
 	}
@@ -538,12 +820,14 @@ uint8_t CdRom::getDriveStatus() const
 {
 	if (m_disc)
 	{
-		bool reading = !(m_readState == ReadState::READ_STATE_IDLE);
+		bool reading = m_readState == ReadState::READ_STATE_READING;
+		bool playing = m_readState == ReadState::READ_STATE_PLAYING;
 
 		uint8_t driveStatus = 0x0;
 		// Motor on.
 		driveStatus |= 1 << 1;
 		driveStatus |= ((uint8_t)reading) << 5;
+		driveStatus |= ((uint8_t)playing) << 7;
 		return driveStatus;
 	}
 	// No disc, pretend that the shell is open ( bit 4 ).
@@ -612,13 +896,13 @@ CommandState CdRom::cmdSetLoc()
 
 CommandState CdRom::cmdReadN()
 {
-	assert(("CDROM read command while we're already reading", m_readState == ReadState::READ_STATE_IDLE));
+	assert(("CDROM read command while we're already reading", m_readState != ReadState::READ_STATE_READING));
 	if (m_seekTargetPending)
 	{
 		doSeek();
 	}
-	m_helperReading.m_delay = getCyclesPerSector();
 	m_readState = ReadState::READ_STATE_READING;
+	m_helperReading.m_delay = getSectorDelay();
 
 	m_helperRxPending.m_rxDelay = 28'000;
 	m_helperRxPending.m_irqDelay = 28'000; //+ 5401;
@@ -627,6 +911,142 @@ CommandState CdRom::cmdReadN()
 	return CommandState::COMMAND_STATE_RX_PENDING;
 }
 
+CommandState CdRom::cmdPlay()
+{
+	if (!m_disc)
+	{
+		// Pretend the shell is open.
+		m_helperRxPending.m_rxDelay = 20'000;
+		m_helperRxPending.m_irqDelay = 20'000;
+		m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_ERROR;
+		m_helperRxPending.m_response = Fifo::fromBytes({ 0x11, 0x80 });
+		return CommandState::COMMAND_STATE_RX_PENDING;
+	}
+
+	// The optional parameter is a BCD track number, 0 plays from the
+	// seek target
+	uint8_t track = m_params.isEmpty() ? 0x0 : m_params.pop();
+	track = (track >> 4) * 10 + (track & 0xf);
+
+	const std::vector<DiscTrack>& tracks = m_disc->getTracks();
+	if (track > 0x0 && track <= tracks.size())
+	{
+		m_seekTarget = MinuteSecondFrame::fromSectorIndex(tracks[track - 1].m_startSector + 150);
+		m_seekTargetPending = true;
+	}
+
+	if (m_seekTargetPending)
+	{
+		doSeek();
+	}
+
+	m_playTrack = m_disc->getTrackAt(m_readPosition);
+	m_readState = ReadState::READ_STATE_PLAYING;
+	m_helperReading.m_delay = getSectorDelay();
+
+	m_helperRxPending.m_rxDelay = 28'000;
+	m_helperRxPending.m_irqDelay = 28'000;
+	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_OK;
+	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus() });
+	return CommandState::COMMAND_STATE_RX_PENDING;
+}
+
+CommandState CdRom::cmdStop()
+{
+	m_onAcknowledge = &CdRom::ackStop;
+	m_readState = ReadState::READ_STATE_IDLE;
+
+	m_helperRxPending.m_rxDelay = 25'000;
+	m_helperRxPending.m_irqDelay = 25'000;
+	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_OK;
+	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus() });
+	return CommandState::COMMAND_STATE_RX_PENDING;
+}
+
+CommandState CdRom::cmdMute()
+{
+	m_muted = true;
+
+	m_helperRxPending.m_rxDelay = 32'000;
+	m_helperRxPending.m_irqDelay = 32'000;
+	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_OK;
+	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus() });
+	return CommandState::COMMAND_STATE_RX_PENDING;
+}
+
+CommandState CdRom::cmdSetFilter()
+{
+	assert(("CDROM: bad number of parameters for SetFilter", m_params.len() == 2));
+
+	m_xaFilterFile = m_params.pop();
+	m_xaFilterChannel = m_params.pop();
+
+	m_helperRxPending.m_rxDelay = 25'000;
+	m_helperRxPending.m_irqDelay = 25'000;
+	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_OK;
+	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus() });
+	return CommandState::COMMAND_STATE_RX_PENDING;
+}
+
+CommandState CdRom::cmdGetTN()
+{
+	if (!m_disc)
+	{
+		// Pretend the shell is open.
+		m_helperRxPending.m_rxDelay = 20'000;
+		m_helperRxPending.m_irqDelay = 20'000;
+		m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_ERROR;
+		m_helperRxPending.m_response = Fifo::fromBytes({ 0x11, 0x80 });
+		return CommandState::COMMAND_STATE_RX_PENDING;
+	}
+
+	const std::vector<DiscTrack>& tracks = m_disc->getTracks();
+
+	m_helperRxPending.m_rxDelay = 25'000;
+	m_helperRxPending.m_irqDelay = 25'000;
+	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_OK;
+	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus(), toBcd(tracks.front().m_number), toBcd(tracks.back().m_number) });
+	return CommandState::COMMAND_STATE_RX_PENDING;
+}
+
+CommandState CdRom::cmdGetTD()
+{
+	if (!m_disc)
+	{
+		// Pretend the shell is open.
+		m_helperRxPending.m_rxDelay = 20'000;
+		m_helperRxPending.m_irqDelay = 20'000;
+		m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_ERROR;
+		m_helperRxPending.m_response = Fifo::fromBytes({ 0x11, 0x80 });
+		return CommandState::COMMAND_STATE_RX_PENDING;
+	}
+
+	assert(("CDROM: bad number of parameters for GetTD", m_params.len() == 1));
+
+	uint8_t track = m_params.pop();
+	track = (track >> 4) * 10 + (track & 0xf);
+
+	const std::vector<DiscTrack>& tracks = m_disc->getTracks();
+	if (track > tracks.size())
+	{
+		// Invalid parameter
+		m_helperRxPending.m_rxDelay = 25'000;
+		m_helperRxPending.m_irqDelay = 25'000;
+		m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_ERROR;
+		m_helperRxPending.m_response = Fifo::fromBytes({ (uint8_t)(getDriveStatus() | 0x1), 0x10 });
+		return CommandState::COMMAND_STATE_RX_PENDING;
+	}
+
+	// Track 0 is the lead-out
+	MinuteSecondFrame start = track == 0x0 ? m_disc->getLeadOut() : MinuteSecondFrame::fromSectorIndex(tracks[track - 1].m_startSector + 150);
+
+	m_helperRxPending.m_rxDelay = 25'000;
+	m_helperRxPending.m_irqDelay = 25'000;
+	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_OK;
+	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus(), start.getMinute(), start.getSecond() });
+	return CommandState::COMMAND_STATE_RX_PENDING;
+}
+
 CommandState CdRom::cmdPause()
 {
 	assert(("Pause when we're not reading", m_readState != ReadState::READ_STATE_IDLE));
@@ -655,6 +1075,8 @@ CommandState CdRom::cmdInit()
 
 CommandState CdRom::cmdDemute()
 {
+	m_muted = false;
+
 	// Fixme: irq delay.
 	m_helperRxPending.m_rxDelay = 32'000;
 	m_helperRxPending.m_irqDelay = 32'000; //+ 5401;
@@ -671,8 +1093,13 @@ CommandState CdRom::cmdSetMode()
 
 	m_doubleSpeed = mode & 0x80;
 	m_readWholeSector = mode & 0x20;
+	m_autoPause = mode & 0x02;
+	m_report = mode & 0x04;
+	m_xaFilter = mode & 0x08;
+	m_xaAdpcmToSpu = mode & 0x40;
 
-	assert(("CDROM: unhandled mode", (mode & 0x5f) == 0x0));
+	// Bit 0 allows reading CD-DA sectors, they're always readable here
+	assert(("CDROM: unhandled mode", (mode & 0x10) == 0x0));
 
 	// Fixme: irq delay.
 	m_helperRxPending.m_rxDelay = 22'000;
@@ -778,8 +1205,9 @@ CommandState CdRom::ackSeekl()
 	// The seek itself takes a while to finish since the drive has
 	// to physically move the head.
 	// Fixme: irq delay.
-	m_helperRxPending.m_rxDelay = 1'000'000;
-	m_helperRxPending.m_irqDelay = 1'000'000; //+ 1859;
+	uint32_t seekDelay = getMechanicalDelay(1'000'000);
+	m_helperRxPending.m_rxDelay = seekDelay;
+	m_helperRxPending.m_irqDelay = seekDelay; //+ 1859;
 	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_DONE;
 	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus() });
 	return CommandState::COMMAND_STATE_RX_PENDING;
@@ -840,7 +1268,7 @@ CommandState CdRom::ackReadToc()
 	uint32_t rxDelay = 11'000;
 	if (m_disc)
 	{
-		rxDelay = 16'000'000;
+		rxDelay = getMechanicalDelay(16'000'000);
 	}
 
 	m_readState = ReadState::READ_STATE_IDLE;
@@ -857,8 +1285,9 @@ CommandState CdRom::ackPause()
 	m_readState = ReadState::READ_STATE_IDLE;
 
 	// Fixme: irq delay.
-	m_helperRxPending.m_rxDelay = 2'000'000;
-	m_helperRxPending.m_irqDelay = 2'000'000; //+ 1858;
+	uint32_t pauseDelay = getMechanicalDelay(2'000'000);
+	m_helperRxPending.m_rxDelay = pauseDelay;
+	m_helperRxPending.m_irqDelay = pauseDelay; //+ 1858;
 	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_DONE;
 	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus() });
 	return CommandState::COMMAND_STATE_RX_PENDING;
@@ -872,10 +1301,27 @@ CommandState CdRom::ackInit()
 	m_readState = ReadState::READ_STATE_IDLE;
 	m_doubleSpeed = false;
 	m_readWholeSector = true;
+	m_streamingSector = false;
+	m_autoPause = false;
+	m_report = false;
+	m_xaFilter = false;
+	m_xaAdpcmToSpu = false;
 
 	// Fixme: irq delay.
-	m_helperRxPending.m_rxDelay = 2'000'000;
-	m_helperRxPending.m_irqDelay = 2'000'000; //+ 1870;
+	uint32_t initDelay = getMechanicalDelay(2'000'000);
+	m_helperRxPending.m_rxDelay = initDelay;
+	m_helperRxPending.m_irqDelay = initDelay; //+ 1870;
+	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_DONE;
+	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus() });
+	return CommandState::COMMAND_STATE_RX_PENDING;
+}
+
+CommandState CdRom::ackStop()
+{
+	// The motor takes a while to spin down
+	uint32_t stopDelay = getMechanicalDelay(2'000'000);
+	m_helperRxPending.m_rxDelay = stopDelay;
+	m_helperRxPending.m_irqDelay = stopDelay;
 	m_helperRxPending.m_irqCode = IrqCode::IRQ_CODE_DONE;
 	m_helperRxPending.m_response = Fifo::fromBytes({ getDriveStatus() });
 	return CommandState::COMMAND_STATE_RX_PENDING;
@@ -4,10 +4,13 @@
 #include <string.h>
 #include <vector>
 
+#include "pscx_audio.h"
 #include "pscx_timekeeper.h"
 #include "pscx_interrupts.h"
 #include "pscx_disc.h"
+#include "pscx_readahead.h"
 #include "pscx_minutesecondframe.h"
+#include "pscx_xa.h"
 
 // Various IRQ codes used by the CDROM controller and their
 // signification.
@@ -19,6 +22,8 @@ enum IrqCode
 	IRQ_CODE_DONE = 2,
 	// Command succesful, used for the 1st response.
 	IRQ_CODE_OK = 3,
+	// Playback reached the end of the track ( AutoPause ) or of the disc.
+	IRQ_CODE_DATA_END = 4,
 	// Error: invalid command, disc command while do disc is present.
 	IRQ_CODE_ERROR = 5
 };
@@ -49,7 +54,9 @@ enum ReadState
 {
 	READ_STATE_IDLE,
 	// We're expection a sector
-	READ_STATE_READING
+	READ_STATE_READING,
+	// Playing CD-DA audio
+	READ_STATE_PLAYING
 };
 
 // 16 byte FIFO used to store command arguments and results.
@@ -96,6 +103,11 @@ struct Mixer
 		m_cdRightToSpuLeft(0x0),
 		m_cdRightToSpuRight(0x0)
 	{}
+
+	// Mix 'frames' interleaved stereo frames from 'input' to 'output',
+	// which can be the same buffer. A volume of 0x80 is 100%.
+	void apply(const int16_t* input, int16_t* output, size_t frames) const;
+
 //private:
 	uint8_t m_cdLeftToSpuLeft;
 	uint8_t m_cdLeftToSpuRight;
@@ -103,6 +115,41 @@ struct Mixer
 	uint8_t m_cdRightToSpuRight;
 };
 
+// Frames buffered between the CD-ROM and the SPU. A sector of 18.9kHz
+// mono XA-ADPCM is the largest output of a sector ( 16 sectors of CD-DA ).
+const size_t CDROM_AUDIO_FIFO_FRAMES = 2 * XA_MAX_SECTOR_FRAMES;
+
+// Shortest delay left when the speed-up shrinks a mechanical delay, the
+// guest still gets the response after its command returned
+const uint32_t CDROM_MIN_MECHANICAL_DELAY = 5'000;
+
+// Delay of the next sector when it's delivered on acknowledge. Leaves the
+// interrupt handler time to copy the previous sector out of the RX buffer.
+const uint32_t CDROM_ACK_SECTOR_DELAY = 20'000;
+
+// Loading acceleration. Only plain data reads are affected: sectors read
+// while XA-ADPCM playback is enabled and real-time ( audio/video ) sectors
+// keep the hardware timings so that streamed audio and FMVs play normally.
+struct CdRomSpeedUp
+{
+	CdRomSpeedUp() :
+		m_seekDivider(1),
+		m_readSpeedFactor(1),
+		m_deliverOnAck(false)
+	{}
+
+	// Seek, spin up and TOC delays are divided by this value, 0 makes
+	// them ( almost ) instant.
+	uint32_t m_seekDivider;
+
+	// Multiplier of the drive's sector rate.
+	uint32_t m_readSpeedFactor;
+
+	// Deliver the next sector as soon as the guest acknowledged the
+	// previous one instead of waiting for the drive.
+	bool m_deliverOnAck;
+};
+
 // CDROM Controller.
 struct CdRom
 {
@@ -119,12 +166,26 @@ struct CdRom
 		m_readPosition(MinuteSecondFrame::createZeroTimestamp()),
 		m_doubleSpeed(false),
 		m_xaAdpcmToSpu(false),
+		m_xaFilter(false),
+		m_xaFilterFile(0x0),
+		m_xaFilterChannel(0x0),
+		m_xaFrames(2 * XA_MAX_SECTOR_FRAMES),
 		m_rxActive(false),
 		m_rxIndex(0x0),
 		m_rxOffset(0x0),
 		m_rxLen(0x0),
-		m_readWholeSector(true)
-	{}
+		m_readWholeSector(true),
+		m_streamingSector(false),
+		m_autoPause(false),
+		m_report(false),
+		m_muted(false),
+		m_adpcmMuted(false),
+		m_playTrack(0x0),
+		m_audioOut(CDROM_AUDIO_FIFO_FRAMES)
+	{
+		if (m_disc)
+			m_readAhead.start(const_cast<Disc*>(m_disc));
+	}
 
 	template<typename T>
 	T load(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t offset);
@@ -134,12 +195,24 @@ struct CdRom
 
 	void sync(TimeKeeper& timeKeeper, InterruptState& irqState);
 
+	const SectorReadAhead& getReadAhead() const { return m_readAhead; }
+
+	// Audio sent to the SPU CD input, 44.1kHz stereo after the mixer.
+	AudioFifo& getAudioOutput() { return m_audioOut; }
+
+	void setSpeedUp(const CdRomSpeedUp& speedUp);
+	const CdRomSpeedUp& getSpeedUp() const { return m_speedUp; }
+
 	// Retrieve a single byte from the RX buffer.
 	uint8_t readByte();
 
 	// The DMA can read the RX buffer one word at a time.
 	uint32_t dmaReadWord();
 
+	// Copy 'size' bytes of the RX buffer to 'dst' in one go, the same as
+	// 'size' calls to readByte().
+	void dmaRead(uint8_t* dst, uint32_t size);
+
 	void doSeek();
 
 	// Retrieve the current disc or panic if there's none. Used in
@@ -150,6 +223,12 @@ struct CdRom
 	// The function is called when a new sector has been read.
 	void sectorRead(InterruptState& irqState);
 
+	// Called when the next audio sector is reached while playing.
+	void sectorPlayed(InterruptState& irqState);
+
+	// Decode an XA-ADPCM sector and send it to the SPU.
+	void playXaAdpcm(const XaSector& sector);
+
 	uint8_t getStatus();
 
 	bool irq() const;
@@ -163,7 +242,16 @@ struct CdRom
 	// Return the number of CPU cycles needed to read a single sector
 	// depending on the current drive speed. The PSC drive can read 75 sectors
 	// per second at 1x or 150 sectors per second at 2x.
-	uint32_t getCyclesPerSector();
+	uint32_t getCyclesPerSector() const;
+
+	// Delay until the next sector, shortened by the speed-up for data reads.
+	uint32_t getSectorDelay() const;
+
+	// True if the current read can be accelerated.
+	bool isReadAccelerated() const;
+
+	// Apply the seek speed-up to a delay caused by the drive mechanics.
+	uint32_t getMechanicalDelay(uint32_t cycles) const;
 
 	void command(TimeKeeper& timeKeeper, uint8_t cmd);
 	// Return the first status byte returned by many commands.
@@ -174,6 +262,18 @@ struct CdRom
 	CommandState cmdSetLoc();
 	// Start data read sequence, the controller will return sectors.
 	CommandState cmdReadN();
+	// Start CD-DA playback at the given track or at the seek target.
+	CommandState cmdPlay();
+	// Stop reading or playing and stop the motor.
+	CommandState cmdStop();
+	// Mute the CD audio output.
+	CommandState cmdMute();
+	// Select the file and channel of the XA-ADPCM sectors to play.
+	CommandState cmdSetFilter();
+	// Return the first and last track numbers.
+	CommandState cmdGetTN();
+	// Return the start of a track, or of the lead-out for track 0.
+	CommandState cmdGetTD();
 	// Stop reading sectors, but remain at the same position on the disc.
 	CommandState cmdPause();
 	// Reinitialize the CD ROM controller.
@@ -202,6 +302,7 @@ struct CdRom
 	CommandState ackReadToc();
 	CommandState ackPause();
 	CommandState ackInit();
+	CommandState ackStop();
 
 	void pushParam(uint8_t param);
 
@@ -265,6 +366,9 @@ private:
 	// Currently loaded disc or None if no disc is present.
 	const Disc* m_disc;
 
+	// Reads the sectors following m_readPosition in the background
+	SectorReadAhead m_readAhead;
+
 	// Target of the next seek command.
 	MinuteSecondFrame m_seekTarget;
 
@@ -281,8 +385,20 @@ private:
 	// If true, send ADPCM samples to spu
 	bool m_xaAdpcmToSpu;
 
-	// Sector in the RX buffer.
-	const XaSector* m_rxSector;
+	// If true only the XA-ADPCM sectors matching the file and channel
+	// below are played, the others are skipped.
+	bool m_xaFilter;
+	uint8_t m_xaFilterFile;
+	uint8_t m_xaFilterChannel;
+
+	XaAdpcmDecoder m_xaDecoder;
+
+	// Output of the decoder for the current sector.
+	std::vector<int16_t> m_xaFrames;
+
+	// Sector in the RX buffer. The controller owns it until the next sector
+	// is read, the DMA only borrows it through dmaRead().
+	PooledSector m_rxSector;
 
 	// When this bit is set, the data RX buffer is active, otherwise it's reset.
 	// The software is supposed to reset it between sectors.
@@ -300,6 +416,35 @@ private:
 	// (0x924 bytes), otherwise it only reads 0x800 bytes.
 	bool m_readWholeSector;
 
+	// True if the last sector read is flagged as real-time audio or video
+	// in its XA sub-header.
+	bool m_streamingSector;
+
+	// Loading acceleration settings.
+	CdRomSpeedUp m_speedUp;
+
+	// Mode bit 1: pause at the end of the track while playing.
+	bool m_autoPause;
+
+	// Mode bit 2: send position reports while playing.
+	bool m_report;
+
+	// Set by Mute, cleared by Demute.
+	bool m_muted;
+
+	// Mixer register bit muting XA-ADPCM only.
+	bool m_adpcmMuted;
+
+	// Track being played.
+	uint8_t m_playTrack;
+
+	// Mixed audio waiting to be consumed by the SPU.
+	AudioFifo m_audioOut;
+
 	// CDROM audio mixer connected to the SPU.
 	Mixer m_mixer;
+
+	// Volumes written by the software, they're moved to m_mixer when
+	// the "apply" bit is set.
+	Mixer m_nextMixer;
 };
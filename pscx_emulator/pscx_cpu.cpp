@@ -19,6 +19,26 @@ std::vector<Profile*> Cpu::getPadProfiles()
 	return m_inter.getPadProfiles();
 }
 
+FramePacer& Cpu::getFramePacer()
+{
+	return m_inter.getFramePacer();
+}
+
+DisplayOut& Cpu::getDisplayOut()
+{
+	return m_inter.getDisplayOut();
+}
+
+CdRom& Cpu::getCdRom()
+{
+	return m_inter.getCdRom();
+}
+
+Spu& Cpu::getSpu()
+{
+	return m_inter.getSpu();
+}
+
 template<typename T>
 Instruction Cpu::load(uint32_t addr)
 {
@@ -134,6 +134,13 @@ struct Cpu
 
 	std::vector<Profile*> getPadProfiles();
 
+	FramePacer& getFramePacer();
+
+	DisplayOut& getDisplayOut();
+
+	CdRom& getCdRom();
+	Spu& getSpu();
+
 private:
 	struct RegisterData
 	{
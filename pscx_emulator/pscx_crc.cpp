@@ -49,9 +49,66 @@ static const uint32_t CRC32_TABLE[] = {
 };
 
 uint32_t crc32(const std::vector<uint8_t>& data)
+{
+	return crc32(data.data(), data.size());
+}
+
+uint32_t crc32Bytewise(const uint8_t* data, size_t size)
 {
 	uint32_t crc = 0x0;
-	for (size_t i = 0; i < data.size(); ++i)
+	for (size_t i = 0; i < size; ++i)
 		crc = (crc >> 8) ^ CRC32_TABLE[((uint8_t)crc) ^ data[i]];
 	return crc;
 }
+
+// Tables for the slice-by-8 algorithm. Table k gives the contribution of
+// a byte followed by k zero bytes, table 0 is CRC32_TABLE.
+struct Crc32SliceTables
+{
+	Crc32SliceTables()
+	{
+		for (size_t i = 0; i < 256; ++i)
+			m_tables[0][i] = CRC32_TABLE[i];
+
+		for (size_t k = 1; k < 8; ++k)
+		{
+			for (size_t i = 0; i < 256; ++i)
+			{
+				uint32_t previous = m_tables[k - 1][i];
+				m_tables[k][i] = (previous >> 8) ^ CRC32_TABLE[previous & 0xff];
+			}
+		}
+	}
+
+	uint32_t m_tables[8][256];
+};
+
+static const Crc32SliceTables CRC32_SLICE_TABLES;
+
+uint32_t crc32(const uint8_t* data, size_t size)
+{
+	const uint32_t (*t)[256] = CRC32_SLICE_TABLES.m_tables;
+
+	uint32_t crc = 0x0;
+	while (size >= 8)
+	{
+		// The CRC is reflected: the first byte goes in the low bits
+		uint32_t low = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+							  ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+
+		crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+			  t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+
+		data += 8;
+		size -= 8;
+	}
+
+	while (size > 0)
+	{
+		crc = (crc >> 8) ^ t[0][((uint8_t)crc) ^ *data];
+		data += 1;
+		size -= 1;
+	}
+
+	return crc;
+}
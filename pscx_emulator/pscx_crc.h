@@ -1,8 +1,15 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 // Compute the CRC32 of data
 // Uses polynomial (x^16 + x^15 + x^2 + 1) * (x^16 + x^2 + x + 1)
 uint32_t crc32(const std::vector<uint8_t>& data);
+
+// Same CRC computed 8 bytes at a time (slice-by-8)
+uint32_t crc32(const uint8_t* data, size_t size);
+
+// Reference implementation, one byte at a time
+uint32_t crc32Bytewise(const uint8_t* data, size_t size);
@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+#include "pscx_cue.h"
+#include "pscx_common.h"
+
+static std::string toUpper(std::string text)
+{
+	std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return (char)toupper(c); });
+	return text;
+}
+
+// Parse a "mm:ss:ff" timestamp into a number of sectors
+static bool parseTimestamp(const std::string& text, uint32_t& sectors)
+{
+	unsigned minute, second, frame;
+	char separator1, separator2;
+
+	std::istringstream stream(text);
+	if (!(stream >> minute >> separator1 >> second >> separator2 >> frame) ||
+		separator1 != ':' || separator2 != ':' || second >= 60 || frame >= 75)
+		return false;
+
+	sectors = (minute * 60 + second) * 75 + frame;
+	return true;
+}
+
+CueSheet::CueStatus CueSheet::parse(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.good())
+		return CueStatus::CUE_STATUS_INVALID_PATH;
+
+	m_files.clear();
+	m_tracks.clear();
+
+	size_t separator = path.find_last_of("/\\");
+	std::string directory = separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+
+	std::string line;
+	uint32_t lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		lineNumber += 1;
+
+		std::istringstream stream(line);
+		std::string keyword;
+		if (!(stream >> keyword))
+			continue;
+		keyword = toUpper(keyword);
+
+		if (keyword == "FILE")
+		{
+			// The name is quoted when it contains spaces, the type follows it
+			std::string rest;
+			std::getline(stream, rest);
+			size_t begin = rest.find_first_not_of(" \t");
+			size_t end;
+			std::string name;
+			if (begin != std::string::npos && rest[begin] == '"')
+			{
+				end = rest.find('"', begin + 1);
+				if (end == std::string::npos)
+				{
+					WARN("CUE line " << lineNumber << ": unterminated file name");
+					return CueStatus::CUE_STATUS_INVALID_DATA;
+				}
+				name = rest.substr(begin + 1, end - begin - 1);
+				end += 1;
+			}
+			else
+			{
+				end = rest.find_last_of(" \t");
+				if (begin == std::string::npos || end == std::string::npos || end < begin)
+				{
+					WARN("CUE line " << lineNumber << ": missing file name");
+					return CueStatus::CUE_STATUS_INVALID_DATA;
+				}
+				name = rest.substr(begin, end - begin);
+			}
+
+			std::string type;
+			std::istringstream(rest.substr(end)) >> type;
+			if (toUpper(type) != "BINARY")
+			{
+				// WAVE and MP3 need a decoder, MOTOROLA is big endian audio
+				WARN("CUE line " << lineNumber << ": unsupported file type " << type);
+				return CueStatus::CUE_STATUS_INVALID_DATA;
+			}
+
+			// Absolute paths are kept as is
+			bool absolute = name.size() > 0 && (name[0] == '/' || name[0] == '\\' || (name.size() > 1 && name[1] == ':'));
+			m_files.push_back(absolute ? name : directory + name);
+		}
+		else if (keyword == "TRACK")
+		{
+			unsigned number;
+			std::string mode;
+			if (!(stream >> number >> mode) || number == 0 || number > 99 || m_files.empty())
+			{
+				WARN("CUE line " << lineNumber << ": invalid TRACK");
+				return CueStatus::CUE_STATUS_INVALID_DATA;
+			}
+
+			CueTrack track;
+			track.m_number = (uint8_t)number;
+			track.m_file = (uint32_t)m_files.size() - 1;
+
+			mode = toUpper(mode);
+			if (mode == "AUDIO")
+			{
+				track.m_type = TrackType::TRACK_TYPE_AUDIO;
+				track.m_sectorSize = 2352;
+			}
+			else if (mode == "MODE1/2352" || mode == "MODE2/2352")
+			{
+				track.m_sectorSize = 2352;
+			}
+			else if (mode == "MODE1/2048" || mode == "MODE2/2048")
+			{
+				track.m_sectorSize = 2048;
+			}
+			else
+			{
+				WARN("CUE line " << lineNumber << ": unsupported track mode " << mode);
+				return CueStatus::CUE_STATUS_INVALID_DATA;
+			}
+
+			if (!m_tracks.empty() && track.m_number != m_tracks.back().m_number + 1)
+			{
+				WARN("CUE line " << lineNumber << ": tracks must be numbered in order");
+				return CueStatus::CUE_STATUS_INVALID_DATA;
+			}
+
+			// Keeps the index 01 check below simple
+			track.m_index1 = UINT32_MAX;
+			m_tracks.push_back(track);
+		}
+		else if (keyword == "INDEX" || keyword == "PREGAP")
+		{
+			unsigned number = 1;
+			std::string timestamp;
+			uint32_t sectors;
+			if (m_tracks.empty() || (keyword == "INDEX" && !(stream >> number)) ||
+				!(stream >> timestamp) || !parseTimestamp(timestamp, sectors))
+			{
+				WARN("CUE line " << lineNumber << ": invalid " << keyword);
+				return CueStatus::CUE_STATUS_INVALID_DATA;
+			}
+
+			CueTrack& track = m_tracks.back();
+			if (keyword == "PREGAP")
+			{
+				track.m_pregap = sectors;
+			}
+			else if (number == 0)
+			{
+				track.m_hasIndex0 = true;
+				track.m_index0 = sectors;
+			}
+			else if (number == 1)
+			{
+				track.m_index1 = sectors;
+			}
+			// Later indices only matter for the subchannel position
+		}
+		// REM, CATALOG, FLAGS, TITLE, POSTGAP... don't change the layout
+	}
+
+	if (m_tracks.empty())
+	{
+		WARN("CUE sheet without tracks");
+		return CueStatus::CUE_STATUS_INVALID_DATA;
+	}
+
+	for (const CueTrack& track : m_tracks)
+	{
+		if (track.m_index1 == UINT32_MAX || (track.m_hasIndex0 && track.m_index0 > track.m_index1))
+		{
+			WARN("CUE track " << (uint32_t)track.m_number << " has no valid INDEX 01");
+			return CueStatus::CUE_STATUS_INVALID_DATA;
+		}
+	}
+
+	return CueStatus::CUE_STATUS_OK;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Contents of a track
+enum TrackType
+{
+	// Red Book audio, 588 stereo 16 bit samples per sector
+	TRACK_TYPE_AUDIO,
+	// Mode 1 or Mode 2 data sectors
+	TRACK_TYPE_DATA
+};
+
+// Track as described by a CUE sheet. Positions are in sectors from the
+// start of the track's file.
+struct CueTrack
+{
+	CueTrack() :
+		m_number(0x0),
+		m_file(0x0),
+		m_type(TrackType::TRACK_TYPE_DATA),
+		m_sectorSize(0x0),
+		m_pregap(0x0),
+		m_hasIndex0(false),
+		m_index0(0x0),
+		m_index1(0x0)
+	{}
+
+	uint8_t m_number;
+	// Index in CueSheet::m_files
+	uint32_t m_file;
+	TrackType m_type;
+	// Bytes per sector in the file: 2352, or 2048 for cooked data tracks
+	uint32_t m_sectorSize;
+	// Sectors of silence inserted before the track ( PREGAP ), not
+	// stored in the file
+	uint32_t m_pregap;
+	// Start of the pregap stored in the file ( INDEX 00 ), if any
+	bool m_hasIndex0;
+	uint32_t m_index0;
+	// Start of the track ( INDEX 01 )
+	uint32_t m_index1;
+};
+
+// Parsed CUE sheet
+struct CueSheet
+{
+	enum CueStatus
+	{
+		CUE_STATUS_OK,
+		CUE_STATUS_INVALID_PATH,
+		CUE_STATUS_INVALID_DATA
+	};
+
+	// Parse the CUE sheet at 'path'. File names are made relative to
+	// the sheet's directory.
+	CueStatus parse(const std::string& path);
+
+	// Paths of the image files, in order of appearance
+	std::vector<std::string> m_files;
+
+	// Tracks in order
+	std::vector<CueTrack> m_tracks;
+};
@@ -1,30 +1,96 @@
 #include <cassert>
-#include <vector>
 #include <algorithm>
+#include <cctype>
 #include <iostream>
 
 #include "pscx_disc.h"
 #include "pscx_crc.h"
+#include "pscx_common.h"
+
+// ********************** PooledSector implementation **********************
+PooledSector::PooledSector(PooledSector&& other) :
+	m_pool(other.m_pool),
+	m_sector(other.m_sector)
+{
+	other.m_pool = nullptr;
+	other.m_sector = nullptr;
+}
+
+PooledSector& PooledSector::operator=(PooledSector&& other)
+{
+	if (this != &other)
+	{
+		reset();
+		m_pool = other.m_pool;
+		m_sector = other.m_sector;
+		other.m_pool = nullptr;
+		other.m_sector = nullptr;
+	}
+	return *this;
+}
+
+void PooledSector::reset()
+{
+	if (m_sector)
+	{
+		m_pool->release(m_sector);
+	}
+	m_pool = nullptr;
+	m_sector = nullptr;
+}
+
+// ********************** SectorPool implementation **********************
+SectorPool::SectorPool() :
+	m_freeCount(SECTOR_POOL_SIZE)
+{
+	for (uint8_t i = 0; i < SECTOR_POOL_SIZE; ++i)
+	{
+		m_free[i] = i;
+	}
+}
+
+PooledSector SectorPool::acquire()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_freeCount == 0x0)
+		return PooledSector();
+
+	m_freeCount -= 1;
+	return PooledSector(this, &m_sectors[m_free[m_freeCount]]);
+}
+
+void SectorPool::release(XaSector* sector)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	assert(("Sector released twice", m_freeCount < SECTOR_POOL_SIZE));
+
+	m_free[m_freeCount] = (uint8_t)(sector - m_sectors);
+	m_freeCount += 1;
+}
 
 // ********************** XaSector implementation **********************
-XaSector::XaSector()
+XaSector::XaSector() :
+	m_data(m_raw),
+	m_edcPending(false)
 {
 	memset(m_raw, 0x0, sizeof(m_raw));
 }
 
 uint8_t XaSector::getDataByte(uint16_t index) const
 {
-	return m_raw[index];
+	return m_data[index];
 }
 
-XaSector::ResultXaSector XaSector::validateMode1_2(const MinuteSecondFrame& minuteSecondFrame)
+XaSector::XaSectorStatus XaSector::validateMode1_2(const MinuteSecondFrame& minuteSecondFrame) const
 {
 	// Check sync pattern.
 	for (size_t i = 0; i < _countof(SECTOR_SYNC_PATTERN); ++i)
 	{
-		if (m_raw[i] != SECTOR_SYNC_PATTERN[i])
+		if (m_data[i] != SECTOR_SYNC_PATTERN[i])
 		{
-			return ResultXaSector(nullptr, XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA);
+			return XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA;
 		}
 	}
 
@@ -32,10 +98,10 @@ XaSector::ResultXaSector XaSector::validateMode1_2(const MinuteSecondFrame& minu
 	//if (getMinuteSecondFrame() != MinuteSecondFrame::fromBCD(minuteSecondFrame.getMinute(), minuteSecondFrame.getSecond(), minuteSecondFrame.getFrame()))
 	if (getMinuteSecondFrame() != minuteSecondFrame)
 	{
-		return ResultXaSector(nullptr, XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA);
+		return XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA;
 	}
 
-	uint8_t mode = m_raw[15];
+	uint8_t mode = m_data[15];
 	switch (mode)
 	{
 	case 1:
@@ -47,10 +113,10 @@ XaSector::ResultXaSector XaSector::validateMode1_2(const MinuteSecondFrame& minu
 		return validateMode2();
 	}
 	}
-	return ResultXaSector(nullptr, XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA);
+	return XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA;
 }
 
-XaSector::ResultXaSector XaSector::validateMode2()
+XaSector::XaSectorStatus XaSector::validateMode2() const
 {
 	// Mode 2 sub-header
 	// byte 16: File number
@@ -64,13 +130,13 @@ XaSector::ResultXaSector XaSector::validateMode2()
 
 	// Make sure that the two copies of the subcode are the same,
 	// otherwise the sector is probably corrupted or is in the wrong format.
-	uint8_t submode = m_raw[18];
-	uint8_t submodeCopy = m_raw[22];
+	uint8_t submode = m_data[18];
+	uint8_t submodeCopy = m_data[22];
 
 	if (submode != submodeCopy)
 	{
 		// Sector msf mode 2 submode missmatch.
-		return ResultXaSector(nullptr, XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA);
+		return XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA;
 	}
 
 	// Look for form in submode bit 5.
@@ -79,64 +145,331 @@ XaSector::ResultXaSector XaSector::validateMode2()
 	return validateMode2Form1();
 }
 
-XaSector::ResultXaSector XaSector::validateMode2Form1() const
+XaSector::XaSectorStatus XaSector::validateMode2Form1() const
 {
-	 // Slice ?
-	std::vector<uint8_t> rawSlice;
-	rawSlice.resize(2056);
+	// Validate CRC of the sub-header and data, in place.
+	uint32_t crc = crc32(m_data + 16, 2056);
 
-	memcpy(rawSlice.data(), m_raw + 16, 2056 * sizeof(uint8_t));
-
-	// Validate CRC.
-	uint32_t crc = crc32(rawSlice);
-
-	uint32_t sectorCrc = (uint32_t)m_raw[2072]
-		| ((uint32_t)m_raw[2073] << 8)
-		| ((uint32_t)m_raw[2074] << 16)
-		| ((uint32_t)m_raw[2075] << 24);
+	uint32_t sectorCrc = (uint32_t)m_data[2072]
+		| ((uint32_t)m_data[2073] << 8)
+		| ((uint32_t)m_data[2074] << 16)
+		| ((uint32_t)m_data[2075] << 24);
 
 	if (crc != sectorCrc)
 	{
 		// Sector appears corrupted.
 		// Mode 2 Form 1 CRC missmatch.
-		return ResultXaSector(nullptr, XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA);
+		return XaSectorStatus::XA_SECTOR_STATUS_INVALID_DATA;
 	}
-	return ResultXaSector(this, XaSectorStatus::XA_SECTOR_STATUS_OK);
+	return XaSectorStatus::XA_SECTOR_STATUS_OK;
 }
 
-XaSector::ResultXaSector XaSector::validateMode2Form2() const
+XaSector::XaSectorStatus XaSector::validateMode2Form2() const
 {
 	//assert(0, "Unhandled Mode 2 Form 2 sector");
-	return ResultXaSector(this, XaSectorStatus::XA_SECTOR_STATUS_OK);
+	return XaSectorStatus::XA_SECTOR_STATUS_OK;
 }
 
 MinuteSecondFrame XaSector::getMinuteSecondFrame() const
 {
 	// The MSF is recorded just after the sync pattern.
-	return MinuteSecondFrame::fromBCD(m_raw[12], m_raw[13], m_raw[14]);
+	return MinuteSecondFrame::fromBCD(m_data[12], m_data[13], m_data[14]);
 }
 
 const uint8_t* XaSector::getRawSectorInBytes() const
 {
+	return m_data;
+}
+
+uint8_t* XaSector::getBuffer()
+{
+	m_data = m_raw;
+	m_edcPending = false;
 	return m_raw;
 }
 
+void XaSector::setView(const uint8_t* data)
+{
+	m_data = data;
+	m_edcPending = false;
+}
+
+void XaSector::completeEdc()
+{
+	if (!m_edcPending)
+		return;
+
+	// Over the sub-header and data
+	uint32_t edc = crc32(m_raw + 16, 2056);
+	m_raw[2072] = (uint8_t)edc;
+	m_raw[2073] = (uint8_t)(edc >> 8);
+	m_raw[2074] = (uint8_t)(edc >> 16);
+	m_raw[2075] = (uint8_t)(edc >> 24);
+	m_edcPending = false;
+}
+
 // ********************** Disc implementation **********************
-Disc::Disc(std::ifstream&& file, Region region) :
-	m_file(std::move(file)), // ?
+Disc::Disc(Region region) :
+	m_sectorCount(0x0),
+	m_prescanStop(false),
+	m_nextSectorIndex(0x0),
+	m_prefetchEnd(0x0),
 	m_region(region)
 {
 }
 
-Disc::ResultDisc Disc::initializeFromPath(const std::string& path)
+Disc::Disc(std::unique_ptr<DiscImage> image, Region region) :
+	Disc(region)
 {
-	std::ifstream file(path, std::ios::in | std::ios::binary);
-	if (!file.good())
+	DiscExtent extent;
+	extent.m_firstSector = 0x0;
+	extent.m_image = image.get();
+	extent.m_imageOffset = 0x0;
+	extent.m_sectorSize = detectImageSectorSize(*image);
+	extent.m_sectorCount = (uint32_t)(image->getSize() / extent.m_sectorSize);
+	extent.m_track = 1;
+	extent.m_type = TrackType::TRACK_TYPE_DATA;
+
+	m_images.push_back(std::move(image));
+	m_extents.push_back(extent);
+	m_tracks.push_back({ 1, TrackType::TRACK_TYPE_DATA, 0x0 });
+
+	finalizeLayout();
+}
+
+Disc::~Disc()
+{
+	stopPrescan();
+}
+
+void Disc::finalizeLayout()
+{
+	const DiscExtent& last = m_extents.back();
+	m_sectorCount = last.m_firstSector + last.m_sectorCount;
+	m_validated.reset(new std::atomic<uint64_t>[(m_sectorCount + 63) / 64]());
+}
+
+Disc::ResultDisc Disc::initializeFromPath(const std::string& path, bool prescan)
+{
+	std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : std::string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+
+	Disc* disc = nullptr;
+	if (extension == ".cue")
+	{
+		ResultDisc cue = initializeFromCue(path);
+		if (cue.m_status != DiscStatus::DISC_STATUS_OK)
+			return cue;
+		disc = const_cast<Disc*>(cue.m_disc);
+	}
+	else
+	{
+		std::unique_ptr<DiscImage> image = DiscImage::open(path);
+		if (!image)
+			return ResultDisc(nullptr, DiscStatus::DISC_STATUS_INVALID_PATH);
+
+		// Use dummy id for now.
+		disc = new Disc(std::move(image), Region::REGION_JAPAN);
+	}
+
+	ResultDisc result = disc->extractRegion();
+	if (result.m_status == DiscStatus::DISC_STATUS_OK && prescan)
+		disc->startPrescan();
+
+	return result;
+}
+
+Disc::ResultDisc Disc::initializeFromCue(const std::string& path)
+{
+	CueSheet sheet;
+	switch (sheet.parse(path))
+	{
+	case CueSheet::CueStatus::CUE_STATUS_OK:
+		break;
+	case CueSheet::CueStatus::CUE_STATUS_INVALID_PATH:
 		return ResultDisc(nullptr, DiscStatus::DISC_STATUS_INVALID_PATH);
+	default:
+		return ResultDisc(nullptr, DiscStatus::DISC_STATUS_INVALID_DATA);
+	}
+
+	std::unique_ptr<Disc> disc(new Disc(Region::REGION_JAPAN));
+
+	// Each file follows the previous one on the disc, the INDEX positions
+	// are relative to the start of their file
+	uint32_t fileStart = 0x0;
+	for (uint32_t file = 0; file < sheet.m_files.size(); ++file)
+	{
+		std::unique_ptr<DiscImage> image = DiscImage::open(sheet.m_files[file]);
+		if (!image)
+		{
+			WARN("Can't open " << sheet.m_files[file]);
+			return ResultDisc(nullptr, DiscStatus::DISC_STATUS_INVALID_PATH);
+		}
+
+		std::vector<const CueTrack*> tracks;
+		for (const CueTrack& track : sheet.m_tracks)
+		{
+			if (track.m_file == file)
+				tracks.push_back(&track);
+		}
+
+		if (tracks.empty())
+			continue;
+
+		uint32_t sectorSize = tracks[0]->m_sectorSize;
+		uint32_t fileSectors = (uint32_t)(image->getSize() / sectorSize);
+
+		// Sectors inserted by PREGAP commands shift the rest of the file
+		uint32_t gap = 0x0;
+		for (size_t i = 0; i < tracks.size(); ++i)
+		{
+			const CueTrack& track = *tracks[i];
+			if (track.m_sectorSize != sectorSize)
+			{
+				WARN("Tracks of different sector sizes in " << sheet.m_files[file]);
+				return ResultDisc(nullptr, DiscStatus::DISC_STATUS_INVALID_DATA);
+			}
+
+			uint32_t first = track.m_hasIndex0 ? track.m_index0 : track.m_index1;
+			uint32_t end = fileSectors;
+			if (i + 1 < tracks.size())
+				end = tracks[i + 1]->m_hasIndex0 ? tracks[i + 1]->m_index0 : tracks[i + 1]->m_index1;
+
+			if (first > end || end > fileSectors)
+			{
+				WARN("Track " << (uint32_t)track.m_number << " is outside of " << sheet.m_files[file]);
+				return ResultDisc(nullptr, DiscStatus::DISC_STATUS_INVALID_DATA);
+			}
+
+			if (track.m_pregap > 0)
+			{
+				DiscExtent silence = { fileStart + gap + first, track.m_pregap, nullptr, 0x0, SECTOR_SIZE, track.m_number, track.m_type };
+				disc->m_extents.push_back(silence);
+				gap += track.m_pregap;
+			}
+
+			if (end > first)
+			{
+				DiscExtent extent = { fileStart + gap + first, end - first, image.get(), (uint64_t)first * sectorSize,
+									  sectorSize == ISO_SECTOR_SIZE ? (uint32_t)ISO_SECTOR_SIZE : (uint32_t)SECTOR_SIZE,
+									  track.m_number, track.m_type };
+				disc->m_extents.push_back(extent);
+			}
+
+			disc->m_tracks.push_back({ track.m_number, track.m_type, fileStart + gap + track.m_index1 });
+		}
+
+		fileStart += gap + fileSectors;
+		disc->m_images.push_back(std::move(image));
+	}
+
+	if (disc->m_extents.empty() || disc->m_extents[0].m_firstSector != 0x0)
+	{
+		WARN("The first track of " << path << " doesn't start at the beginning of its file");
+		return ResultDisc(nullptr, DiscStatus::DISC_STATUS_INVALID_DATA);
+	}
+
+	disc->finalizeLayout();
+
+	return ResultDisc(disc.release(), DiscStatus::DISC_STATUS_OK);
+}
+
+const DiscExtent* Disc::findExtent(uint32_t sectorIndex) const
+{
+	auto it = std::upper_bound(m_extents.begin(), m_extents.end(), sectorIndex,
+							   [](uint32_t index, const DiscExtent& extent) { return index < extent.m_firstSector; });
+	if (it == m_extents.begin())
+		return nullptr;
 
-	// Use dummy id for now.
-	Disc* disc = new Disc(std::move(file), Region::REGION_JAPAN);
-	return disc->extractRegion();
+	const DiscExtent& extent = *(it - 1);
+	if (sectorIndex - extent.m_firstSector >= extent.m_sectorCount)
+		return nullptr;
+
+	return &extent;
+}
+
+uint8_t Disc::getTrackAt(const MinuteSecondFrame& minuteSecondFrame) const
+{
+	const DiscExtent* extent = findExtent(minuteSecondFrame.getSectorIndex() - 150);
+	return extent ? extent->m_track : 0x0;
+}
+
+bool Disc::isAudioSector(const MinuteSecondFrame& minuteSecondFrame) const
+{
+	const DiscExtent* extent = findExtent(minuteSecondFrame.getSectorIndex() - 150);
+	return extent && extent->m_type == TrackType::TRACK_TYPE_AUDIO;
+}
+
+MinuteSecondFrame Disc::getLeadOut() const
+{
+	return MinuteSecondFrame::fromSectorIndex(m_sectorCount + 150);
+}
+
+void Disc::startPrescan()
+{
+	if (m_prescan.joinable())
+		return;
+
+	m_prescanStop = false;
+	m_prescan = std::thread(&Disc::prescanLoop, this);
+}
+
+void Disc::stopPrescan()
+{
+	if (!m_prescan.joinable())
+		return;
+
+	m_prescanStop = true;
+	m_prescan.join();
+}
+
+void Disc::prescanLoop()
+{
+	// Stack buffer, the pool is for the drive
+	XaSector sector;
+
+	for (const DiscExtent& extent : m_extents)
+	{
+		// Streamed images can't be read from two threads, ISO sectors are
+		// synthesized and never need validating
+		if (extent.m_type != TrackType::TRACK_TYPE_DATA || extent.m_sectorSize != SECTOR_SIZE ||
+			extent.m_image == nullptr || extent.m_image->view(extent.m_imageOffset, SECTOR_SIZE) == nullptr)
+			continue;
+
+		for (uint32_t i = 0; i < extent.m_sectorCount && !m_prescanStop; ++i)
+		{
+			uint32_t sectorIndex = extent.m_firstSector + i;
+			if (isValidated(sectorIndex))
+				continue;
+
+			sector.setView(extent.m_image->view(extent.m_imageOffset + (uint64_t)i * SECTOR_SIZE, SECTOR_SIZE));
+
+			// Mode 1 sectors are left to the normal path, the validation
+			// doesn't handle them
+			if (sector.getDataByte(15) != 2)
+				continue;
+
+			MinuteSecondFrame minuteSecondFrame = MinuteSecondFrame::fromSectorIndex(sectorIndex + 150);
+			if (sector.validateMode1_2(minuteSecondFrame) == XaSector::XaSectorStatus::XA_SECTOR_STATUS_OK)
+				setValidated(sectorIndex);
+		}
+	}
+}
+
+bool Disc::isValidated(uint32_t sectorIndex) const
+{
+	if (sectorIndex >= m_sectorCount)
+		return false;
+
+	return (m_validated[sectorIndex / 64].load(std::memory_order_relaxed) >> (sectorIndex % 64)) & 1;
+}
+
+void Disc::setValidated(uint32_t sectorIndex)
+{
+	if (sectorIndex >= m_sectorCount)
+		return;
+
+	m_validated[sectorIndex / 64].fetch_or(1ULL << (sectorIndex % 64), std::memory_order_relaxed);
 }
 
 Region Disc::getRegion() const
@@ -182,11 +515,25 @@ Disc::ResultDisc Disc::extractRegion()
 
 XaSector::ResultXaSector Disc::readDataSector(const MinuteSecondFrame& minuteSecondFrame)
 {
-	XaSector::ResultXaSector sector = readSector(minuteSecondFrame);
-	if (sector.getSectorStatus() == XaSector::XaSectorStatus::XA_SECTOR_STATUS_OK)
+	uint32_t sectorIndex = minuteSecondFrame.getSectorIndex() - 150;
+
+	const DiscExtent* extent = findExtent(sectorIndex);
+	if (extent == nullptr || extent->m_type != TrackType::TRACK_TYPE_DATA)
+		return XaSector::ResultXaSector(XaSector::XaSectorStatus::XA_SECTOR_STATUS_INVALID_INPUT);
+
+	XaSector::ResultXaSector sector = readExtentSector(*extent, sectorIndex);
+
+	// Synthesized sectors are valid by construction
+	if (sector.getSectorStatus() == XaSector::XaSectorStatus::XA_SECTOR_STATUS_OK && extent->m_sectorSize == SECTOR_SIZE)
 	{
-		XaSector* ptr = const_cast<XaSector*>(sector.getSectorPtr());
-		return ptr->validateMode1_2(minuteSecondFrame);
+		if (isValidated(sectorIndex))
+			return sector;
+
+		XaSector::XaSectorStatus status = sector.getSectorPtr()->validateMode1_2(minuteSecondFrame);
+		if (status != XaSector::XaSectorStatus::XA_SECTOR_STATUS_OK)
+			return XaSector::ResultXaSector(status);
+
+		setValidated(sectorIndex);
 	}
 	return sector;
 }
@@ -195,13 +542,131 @@ XaSector::ResultXaSector Disc::readSector(const MinuteSecondFrame& minuteSecondF
 {
 	uint32_t sectorIndex = minuteSecondFrame.getSectorIndex() - 150;
 
-	// Convert in a byte offset in the bin file
-	uint64_t byteOffset = (uint64_t)sectorIndex * SECTOR_SIZE;
-	m_file.seekg(byteOffset, std::ios_base::beg);
+	const DiscExtent* extent = findExtent(sectorIndex);
+	if (extent == nullptr)
+		return XaSector::ResultXaSector(XaSector::XaSectorStatus::XA_SECTOR_STATUS_INVALID_INPUT);
 
-	XaSector* sector = new XaSector;
-	if (!m_file.read((char*)sector->m_raw, SECTOR_SIZE))
-		return XaSector::ResultXaSector(nullptr, XaSector::XaSectorStatus::XA_SECTOR_STATUS_INVALID_INPUT);
-	
-	return XaSector::ResultXaSector(sector, XaSector::XaSectorStatus::XA_SECTOR_STATUS_OK);
+	return readExtentSector(*extent, sectorIndex);
+}
+
+XaSector::ResultXaSector Disc::readDriveSector(const MinuteSecondFrame& minuteSecondFrame)
+{
+	if (isAudioSector(minuteSecondFrame))
+		return readSector(minuteSecondFrame);
+
+	return readDataSector(minuteSecondFrame);
+}
+
+XaSector::ResultXaSector Disc::readExtentSector(const DiscExtent& extent, uint32_t sectorIndex)
+{
+	// Keep the prefetch window ahead of the read position, and restart it
+	// after a seek
+	if (sectorIndex != m_nextSectorIndex || sectorIndex + DISC_PREFETCH_SECTORS / 2 >= m_prefetchEnd)
+	{
+		prefetch(MinuteSecondFrame::fromSectorIndex(sectorIndex + 150));
+	}
+	m_nextSectorIndex = sectorIndex + 1;
+
+	// Every byte of the buffer is overwritten, no need to clear it
+	PooledSector sector = m_sectorPool.acquire();
+	if (!sector)
+	{
+		WARN("No free sector buffer");
+		return XaSector::ResultXaSector(XaSector::XaSectorStatus::XA_SECTOR_STATUS_INVALID_INPUT);
+	}
+
+	if (extent.m_image == nullptr)
+	{
+		// Pregap which isn't in the image: digital silence
+		memset(sector->getBuffer(), 0x0, SECTOR_SIZE);
+	}
+	else if (extent.m_sectorSize == ISO_SECTOR_SIZE)
+	{
+		if (!synthesizeSector(extent, sectorIndex, sector->getBuffer()))
+			return XaSector::ResultXaSector(XaSector::XaSectorStatus::XA_SECTOR_STATUS_INVALID_INPUT);
+		sector->setEdcPending();
+	}
+	else
+	{
+		// Convert in a byte offset in the bin file
+		uint64_t byteOffset = extent.m_imageOffset + (uint64_t)(sectorIndex - extent.m_firstSector) * SECTOR_SIZE;
+
+		// Mapped images are used in place
+		const uint8_t* view = extent.m_image->view(byteOffset, SECTOR_SIZE);
+		if (view)
+		{
+			sector->setView(view);
+		}
+		else if (!extent.m_image->read(byteOffset, sector->getBuffer(), SECTOR_SIZE))
+		{
+			return XaSector::ResultXaSector(XaSector::XaSectorStatus::XA_SECTOR_STATUS_INVALID_INPUT);
+		}
+	}
+
+	return XaSector::ResultXaSector(std::move(sector), XaSector::XaSectorStatus::XA_SECTOR_STATUS_OK);
+}
+
+void Disc::prefetch(const MinuteSecondFrame& minuteSecondFrame)
+{
+	uint32_t sectorIndex = minuteSecondFrame.getSectorIndex() - 150;
+	m_prefetchEnd = sectorIndex + DISC_PREFETCH_SECTORS;
+
+	// The window can span several extents, and files
+	uint32_t remaining = DISC_PREFETCH_SECTORS;
+	const DiscExtent* extent = findExtent(sectorIndex);
+	while (extent && remaining > 0)
+	{
+		uint32_t offset = sectorIndex - extent->m_firstSector;
+		uint32_t count = std::min(remaining, extent->m_sectorCount - offset);
+
+		if (extent->m_image)
+			extent->m_image->prefetch(extent->m_imageOffset + (uint64_t)offset * extent->m_sectorSize, (size_t)count * extent->m_sectorSize);
+
+		sectorIndex += count;
+		remaining -= count;
+		extent = findExtent(sectorIndex);
+	}
+}
+
+uint32_t Disc::detectImageSectorSize(DiscImage& image)
+{
+	// Raw PlayStation images start with the sync pattern of the first data
+	// sector, ISO images with the system area
+	uint8_t sync[sizeof(SECTOR_SYNC_PATTERN)];
+	if (image.read(0, sync, sizeof(sync)) && memcmp(sync, SECTOR_SYNC_PATTERN, sizeof(sync)) == 0)
+		return SECTOR_SIZE;
+
+	if (image.getSize() % ISO_SECTOR_SIZE == 0)
+		return ISO_SECTOR_SIZE;
+
+	return SECTOR_SIZE;
+}
+
+bool Disc::synthesizeSector(const DiscExtent& extent, uint32_t sectorIndex, uint8_t* buffer)
+{
+	uint64_t byteOffset = extent.m_imageOffset + (uint64_t)(sectorIndex - extent.m_firstSector) * ISO_SECTOR_SIZE;
+	if (!extent.m_image->read(byteOffset, buffer + 24, ISO_SECTOR_SIZE))
+		return false;
+
+	memcpy(buffer, SECTOR_SYNC_PATTERN, sizeof(SECTOR_SYNC_PATTERN));
+
+	// Header: BCD MSF and mode
+	MinuteSecondFrame minuteSecondFrame = MinuteSecondFrame::fromSectorIndex(sectorIndex + 150);
+	buffer[12] = minuteSecondFrame.getMinute();
+	buffer[13] = minuteSecondFrame.getSecond();
+	buffer[14] = minuteSecondFrame.getFrame();
+	buffer[15] = 2;
+
+	// Sub-header, twice: file 0, channel 0, submode "data", no coding.
+	// The ISO doesn't say where the files end so the EOR/EOF bits are
+	// never set.
+	const uint8_t subHeader[] = { 0x00, 0x00, 0x08, 0x00 };
+	memcpy(buffer + 16, subHeader, sizeof(subHeader));
+	memcpy(buffer + 20, subHeader, sizeof(subHeader));
+
+	// The EDC is left to XaSector::completeEdc. The ECC isn't checked by
+	// the drive emulation or the games, it's left cleared.
+	memset(buffer + 2072, 0x0, SECTOR_SIZE - 2072);
+
+	return true;
 }
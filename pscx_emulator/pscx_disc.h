@@ -1,12 +1,27 @@
 #pragma once
 
-#include <fstream>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "pscx_cue.h"
+#include "pscx_disc_image.h"
 #include "pscx_minutesecondframe.h"
 
 // Size of a CD sector in bytes.
 const size_t SECTOR_SIZE = 2352;
 
+// Size of a sector in ISO images, which only store the user data of
+// Mode 2 Form 1 sectors.
+const size_t ISO_SECTOR_SIZE = 2048;
+
+// Number of sectors the disc image is asked to prefetch ahead of the read
+// position, one second of reading at 1x
+const uint32_t DISC_PREFETCH_SECTORS = 75;
+
 // CD-ROM sector sync pattern: 10 0xff surrounded by two 0x00. Not
 // used in CD-DA audio tracks.
 const uint8_t SECTOR_SYNC_PATTERN[] = {
@@ -27,11 +42,59 @@ enum Region
 	REGION_EUROPE
 };
 
+// Number of sector buffers. The controller has 32KB of buffer RAM, the
+// emulated drive never holds more than a couple of sectors at a time.
+const uint8_t SECTOR_POOL_SIZE = 8;
+
+struct XaSector;
+struct SectorPool;
+
+// Owner of a sector buffer taken from a SectorPool. The buffer goes back
+// to the pool when the owner is destroyed or reset, ownership can only be
+// moved.
+struct PooledSector
+{
+	PooledSector() :
+		m_pool(nullptr),
+		m_sector(nullptr)
+	{}
+
+	PooledSector(SectorPool* pool, XaSector* sector) :
+		m_pool(pool),
+		m_sector(sector)
+	{}
+
+	PooledSector(PooledSector&& other);
+	PooledSector& operator=(PooledSector&& other);
+
+	PooledSector(const PooledSector&) = delete;
+	PooledSector& operator=(const PooledSector&) = delete;
+
+	~PooledSector() { reset(); }
+
+	// Give the buffer back to the pool
+	void reset();
+
+	XaSector* get() const { return m_sector; }
+	XaSector* operator->() const { return m_sector; }
+
+	explicit operator bool() const { return m_sector != nullptr; }
+
+private:
+	SectorPool* m_pool;
+	XaSector* m_sector;
+};
+
 // Structure representing a single CD-ROM XA sector.
 struct XaSector
 {
 	XaSector();
 
+	// The sector points to its own buffer or to a disc image mapping,
+	// a copy would point to the buffer of the original
+	XaSector(const XaSector&) = delete;
+	XaSector& operator=(const XaSector&) = delete;
+
 	// Return payload data byte at "index".
 	uint8_t getDataByte(uint16_t index) const;
 
@@ -42,42 +105,52 @@ struct XaSector
 		XA_SECTOR_STATUS_INVALID_INPUT
 	};
 
+	// Sector read from a disc. The result owns the sector buffer until
+	// takeSector() is called, the buffer is only set when the status is OK.
 	struct ResultXaSector
 	{
-		ResultXaSector(const XaSector* sector, XaSectorStatus status) :
-			m_sector(sector),
+		ResultXaSector(PooledSector&& sector, XaSectorStatus status) :
+			m_sector(std::move(sector)),
+			m_status(status)
+		{
+		}
+
+		ResultXaSector(XaSectorStatus status) :
 			m_status(status)
 		{
 		}
-		
-		const XaSector* getSectorPtr() const { return m_sector; }
+
+		const XaSector* getSectorPtr() const { return m_sector.get(); }
 		XaSectorStatus getSectorStatus() const { return m_status; }
 
+		// Hand the sector buffer over to the caller
+		PooledSector takeSector() { return std::move(m_sector); }
+
 	private:
-		const XaSector* m_sector;
+		PooledSector m_sector;
 		XaSectorStatus m_status;
 	};
 
 	// Validate CD-ROM XA Mode 1 or 2 sector.
-	ResultXaSector validateMode1_2(const MinuteSecondFrame& minuteSecondFrame);
+	XaSectorStatus validateMode1_2(const MinuteSecondFrame& minuteSecondFrame) const;
 
 	// Parse and validate CD-ROM XA mode 2 sector.
 	// Regular CD-ROM defines mode 2 as just containing 0x920 bytes of
 	// "raw" data after the 16 byte sector header. However the CD-ROM XA spec
 	// defines two possible "forms" for this mode 2 data, there's an 8 byte sub-header
 	// at the beginning of the data that will tell us how to interpret it.
-	ResultXaSector validateMode2();
+	XaSectorStatus validateMode2() const;
 
 	// CD-ROM XA Mode 2 Form 1: 0x800 bytes of data protected by a
 	// 32 bit CRC for error detection and 276 bytes of error correction codes.
-	ResultXaSector validateMode2Form1() const;
+	XaSectorStatus validateMode2Form1() const;
 
 	// CD-ROM XA Mode 2 Form 2: 0x914 bytes of data without ECC or EDC.
 	// Last 4 bytes are reserved for quality control, but the CDi spec doesn't
 	// mandare what goes in it exactly, only that it is recommended that the same
 	// EDC algorithm should be used here as is used for the Form 1 sectors. If this
 	// algorithm is not used, then the reserved bytes are set to 0.
-	ResultXaSector validateMode2Form2() const;
+	XaSectorStatus validateMode2Form2() const;
 
 	// Return the MinuteSecondFrame structure in the sector's header.
 	MinuteSecondFrame getMinuteSecondFrame() const;
@@ -85,15 +158,90 @@ struct XaSector
 	// Return the raw sector as a byte slice.
 	const uint8_t* getRawSectorInBytes() const;
 
-//private:
-	// The raw array of 2352 bytes contained in the sector.
+	// Use the sector's own buffer and return it so that it can be filled
+	uint8_t* getBuffer();
+
+	// Use the SECTOR_SIZE bytes at 'data' instead of copying them, they must
+	// stay valid as long as the sector is used
+	void setView(const uint8_t* data);
+
+	// The EDC of a sector synthesized from ISO user data is only computed
+	// for the guests reading the whole sector
+	void setEdcPending() { m_edcPending = true; }
+	void completeEdc();
+
+private:
+	// Contents of the sector: m_raw or a view into a mapped disc image.
+	const uint8_t* m_data;
+
+	// Bytes 2072-2075 of m_raw don't hold the EDC yet
+	bool m_edcPending;
+
+	// The raw array of 2352 bytes used when the image can't be mapped.
 	uint8_t m_raw[SECTOR_SIZE];
 };
 
+// Fixed set of sector buffers handed out as PooledSector. Reading a sector
+// never allocates memory. Buffers can be acquired and released from any
+// thread.
+struct SectorPool
+{
+	SectorPool();
+
+	SectorPool(const SectorPool&) = delete;
+	SectorPool& operator=(const SectorPool&) = delete;
+
+	// Take a free buffer, the returned owner is empty if they're all in use
+	PooledSector acquire();
+
+private:
+	friend struct PooledSector;
+
+	void release(XaSector* sector);
+
+	XaSector m_sectors[SECTOR_POOL_SIZE];
+
+	// Stack of the indices of the free buffers
+	uint8_t m_free[SECTOR_POOL_SIZE];
+	uint8_t m_freeCount;
+
+	std::mutex m_mutex;
+};
+
+// Run of consecutive sectors of a track stored the same way. Sector
+// indices count from 00:02:00, the start of track 1.
+struct DiscExtent
+{
+	uint32_t m_firstSector;
+	uint32_t m_sectorCount;
+	// Image holding the sectors, nullptr for a pregap which isn't stored
+	// ( the sectors read as silence )
+	DiscImage* m_image;
+	// Position of the first sector in the image
+	uint64_t m_imageOffset;
+	// SECTOR_SIZE, or ISO_SECTOR_SIZE when the sectors are synthesized
+	// around the stored user data
+	uint32_t m_sectorSize;
+	uint8_t m_track;
+	TrackType m_type;
+};
+
+// Entry of the table of contents
+struct DiscTrack
+{
+	uint8_t m_number;
+	TrackType m_type;
+	// Sector of INDEX 01
+	uint32_t m_startSector;
+};
+
 // Playstation disc
 struct Disc
 {
-	Disc(std::ifstream&& file, Region region);
+	// Disc made of a single image, a BIN or an ISO file holding one
+	// data track
+	Disc(std::unique_ptr<DiscImage> image, Region region);
+	~Disc();
 
 	enum DiscStatus
 	{
@@ -113,8 +261,10 @@ struct Disc
 		DiscStatus m_status;
 	};
 
-	// Reify a disc from file at "path" and attempt to identify it.
-	static ResultDisc initializeFromPath(const std::string& path);
+	// Reify a disc from file at "path" and attempt to identify it. The
+	// file is a single track image or a CUE sheet. With 'prescan' all the
+	// data sectors are validated in the background.
+	static ResultDisc initializeFromPath(const std::string& path, bool prescan = false);
 
 	Region getRegion() const;
 
@@ -133,9 +283,82 @@ struct Disc
 	// the sector is valid.
 	XaSector::ResultXaSector readSector(const MinuteSecondFrame& minuteSecondFrame);
 
+	// Read the sector the way the drive does: audio sectors raw, data
+	// sectors validated
+	XaSector::ResultXaSector readDriveSector(const MinuteSecondFrame& minuteSecondFrame);
+
+	// The drive is going to read from 'minuteSecondFrame', let the image
+	// prefetch the following sectors
+	void prefetch(const MinuteSecondFrame& minuteSecondFrame);
+
+	// Number of sectors on the disc, the first one is 00:02:00
+	uint32_t getSectorCount() const { return m_sectorCount; }
+
+	// Table of contents, sorted by track number
+	const std::vector<DiscTrack>& getTracks() const { return m_tracks; }
+
+	// Return the track number of the sector at 'minuteSecondFrame', 0 in
+	// the lead-out
+	uint8_t getTrackAt(const MinuteSecondFrame& minuteSecondFrame) const;
+
+	bool isAudioSector(const MinuteSecondFrame& minuteSecondFrame) const;
+
+	// Start of the lead-out area, after the last track
+	MinuteSecondFrame getLeadOut() const;
+
+	// Validate every data sector of the image on a background thread, the
+	// reads of sectors it went through skip the validation. Only done for
+	// mapped images, a streamed one would compete with the drive reads.
+	void startPrescan();
+	void stopPrescan();
+
 private:
-	// BIN file
-	std::ifstream m_file;
+	Disc(Region region);
+
+	// Build the track table of the CUE sheet at 'path'
+	static ResultDisc initializeFromCue(const std::string& path);
+
+	// Size the validation bitmap once the extents are known
+	void finalizeLayout();
+
+	void prescanLoop();
+
+	// Return ISO_SECTOR_SIZE for images which don't start with a sync
+	// pattern and hold whole 2048 byte sectors, SECTOR_SIZE otherwise
+	static uint32_t detectImageSectorSize(DiscImage& image);
+
+	// Return the extent holding 'sectorIndex', nullptr past the last
+	// track. Binary search, the extents are sorted.
+	const DiscExtent* findExtent(uint32_t sectorIndex) const;
+
+	// Read sector 'sectorIndex' of 'extent' in a pooled buffer
+	XaSector::ResultXaSector readExtentSector(const DiscExtent& extent, uint32_t sectorIndex);
+
+	// Build a Mode 2 Form 1 sector around the 2048 bytes of 'sectorIndex'
+	// read from an ISO image
+	bool synthesizeSector(const DiscExtent& extent, uint32_t sectorIndex, uint8_t* buffer);
+
+	// Sectors known to hold a valid data sector, one bit per sector
+	bool isValidated(uint32_t sectorIndex) const;
+	void setValidated(uint32_t sectorIndex);
+
+	// BIN, ISO or compressed files holding the tracks
+	std::vector<std::unique_ptr<DiscImage>> m_images;
+	// Disc layout, sorted by first sector without holes
+	std::vector<DiscExtent> m_extents;
+	std::vector<DiscTrack> m_tracks;
+	uint32_t m_sectorCount;
+	// Validated sectors bitmap. The image is read only so a sector
+	// validated once stays valid.
+	std::unique_ptr<std::atomic<uint64_t>[]> m_validated;
+	std::thread m_prescan;
+	std::atomic<bool> m_prescanStop;
+	// Sector after the last one read, to detect seeks
+	uint32_t m_nextSectorIndex;
+	// Sector index where the last prefetch window ends
+	uint32_t m_prefetchEnd;
+	// Buffers returned by readSector
+	SectorPool m_sectorPool;
 	// Disc region
 	Region m_region;
 };
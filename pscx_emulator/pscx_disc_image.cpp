@@ -0,0 +1,434 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#include "pscx_disc_image.h"
+#include "pscx_common.h"
+#include "pscx_crc.h"
+#include "pscx_disc.h"
+#include "pscx_lz.h"
+
+// ********************** DiscImage implementation **********************
+static std::unique_ptr<DiscImage> openFile(const std::string& path)
+{
+	std::unique_ptr<MappedDiscImage> mapped = MappedDiscImage::map(path);
+	if (mapped)
+		return mapped;
+
+	// Mapping fails for files larger than the address space of 32 bit
+	// builds and on some file systems, streaming always works
+	std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!file.good())
+		return nullptr;
+
+	uint64_t size = (uint64_t)file.tellg();
+	LOG("Disc image " << path << " can't be mapped, using streamed reads");
+
+	return std::unique_ptr<DiscImage>(new StreamDiscImage(std::move(file), size));
+}
+
+std::unique_ptr<DiscImage> DiscImage::open(const std::string& path)
+{
+	std::unique_ptr<DiscImage> image = openFile(path);
+	if (image && CompressedDiscImage::isCompressed(*image))
+		return CompressedDiscImage::open(std::move(image));
+
+	return image;
+}
+
+// ********************** StreamDiscImage implementation **********************
+StreamDiscImage::StreamDiscImage(std::ifstream&& file, uint64_t size) :
+	m_file(std::move(file)),
+	m_size(size),
+	m_position(~0ULL)
+{
+}
+
+bool StreamDiscImage::read(uint64_t offset, uint8_t* dst, size_t size)
+{
+	if (offset != m_position)
+	{
+		m_file.clear();
+		m_file.seekg(offset, std::ios_base::beg);
+	}
+
+	if (!m_file.read((char*)dst, size))
+	{
+		m_position = ~0ULL;
+		return false;
+	}
+
+	m_position = offset + size;
+	return true;
+}
+
+// ********************** MappedDiscImage implementation **********************
+MappedDiscImage::MappedDiscImage() :
+	m_data(nullptr),
+	m_size(0x0)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr)
+#endif
+{
+}
+
+MappedDiscImage::~MappedDiscImage()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle((HANDLE)m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle((HANDLE)m_file);
+#else
+	if (m_data)
+		munmap((void*)m_data, m_size);
+#endif
+}
+
+std::unique_ptr<MappedDiscImage> MappedDiscImage::map(const std::string& path)
+{
+	std::unique_ptr<MappedDiscImage> image(new MappedDiscImage());
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+	image->m_file = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || (uint64_t)size.QuadPart > SIZE_MAX)
+		return nullptr;
+	image->m_size = (uint64_t)size.QuadPart;
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+		return nullptr;
+	image->m_mapping = mapping;
+
+	image->m_data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (image->m_data == nullptr)
+		return nullptr;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0 || (uint64_t)info.st_size > SIZE_MAX)
+	{
+		::close(fd);
+		return nullptr;
+	}
+
+	void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	// The mapping holds its own reference to the file
+	::close(fd);
+
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	image->m_data = (const uint8_t*)data;
+	image->m_size = (uint64_t)info.st_size;
+
+	// The drive mostly reads forward, let the kernel read ahead aggressively
+	// and drop the pages behind the read position first
+	madvise(data, image->m_size, MADV_SEQUENTIAL);
+#endif
+
+	return image;
+}
+
+const uint8_t* MappedDiscImage::view(uint64_t offset, size_t size)
+{
+	if (offset > m_size || size > m_size - offset)
+		return nullptr;
+
+	return m_data + offset;
+}
+
+bool MappedDiscImage::read(uint64_t offset, uint8_t* dst, size_t size)
+{
+	const uint8_t* src = view(offset, size);
+	if (src == nullptr)
+		return false;
+
+	memcpy(dst, src, size);
+	return true;
+}
+
+void MappedDiscImage::prefetch(uint64_t offset, size_t size)
+{
+	if (offset >= m_size)
+		return;
+
+	size = (size_t)std::min<uint64_t>(size, m_size - offset);
+
+#ifdef _WIN32
+	// FILE_FLAG_SEQUENTIAL_SCAN already drives the read ahead of the
+	// system cache, the view is backed by the same pages
+	(void)size;
+#else
+	// madvise needs a page aligned address
+	uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+	uint64_t start = offset & ~(pageSize - 1);
+
+	madvise((void*)(m_data + start), (size_t)(offset + size - start), MADV_WILLNEED);
+#endif
+}
+
+// ********************** CompressedDiscImage implementation **********************
+CompressedDiscImage::CompressedDiscImage(std::unique_ptr<DiscImage> container) :
+	m_container(std::move(container)),
+	m_useCounter(0x0)
+{
+	memset(&m_header, 0x0, sizeof(m_header));
+}
+
+bool CompressedDiscImage::isCompressed(DiscImage& image)
+{
+	char magic[sizeof(COMPRESSED_IMAGE_MAGIC)];
+	if (image.getSize() < sizeof(CompressedImageHeader) || !image.read(0, (uint8_t*)magic, sizeof(magic)))
+		return false;
+
+	return memcmp(magic, COMPRESSED_IMAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+std::unique_ptr<CompressedDiscImage> CompressedDiscImage::open(std::unique_ptr<DiscImage> container)
+{
+	std::unique_ptr<CompressedDiscImage> image(new CompressedDiscImage(std::move(container)));
+	DiscImage& file = *image->m_container;
+	CompressedImageHeader& header = image->m_header;
+
+	if (!file.read(0, (uint8_t*)&header, sizeof(header)) ||
+		memcmp(header.m_magic, COMPRESSED_IMAGE_MAGIC, sizeof(header.m_magic)) != 0)
+		return nullptr;
+
+	if (header.m_version != COMPRESSED_IMAGE_VERSION)
+	{
+		WARN("Unsupported compressed image version " << header.m_version);
+		return nullptr;
+	}
+
+	if (header.m_blockSize == 0x0 ||
+		header.m_blockCount != (header.m_imageSize + header.m_blockSize - 1) / header.m_blockSize)
+	{
+		WARN("Invalid compressed image header");
+		return nullptr;
+	}
+
+	uint64_t indexSize = (uint64_t)header.m_blockCount * sizeof(CompressedBlockEntry);
+	if (indexSize > file.getSize() - sizeof(header))
+	{
+		WARN("Truncated compressed image index");
+		return nullptr;
+	}
+
+	image->m_index.resize(header.m_blockCount);
+	if (!file.read(sizeof(header), (uint8_t*)image->m_index.data(), (size_t)indexSize))
+		return nullptr;
+
+	// Checking the whole index once lets the reads trust it
+	for (uint32_t i = 0; i < header.m_blockCount; ++i)
+	{
+		const CompressedBlockEntry& entry = image->m_index[i];
+		if (entry.m_size > image->getBlockSize(i) || entry.m_offset > file.getSize() ||
+			entry.m_size > file.getSize() - entry.m_offset)
+		{
+			WARN("Invalid entry for block " << i << " in the compressed image index");
+			return nullptr;
+		}
+	}
+
+	for (CacheEntry& entry : image->m_cache)
+	{
+		entry.m_data.resize(header.m_blockSize);
+	}
+
+	return image;
+}
+
+uint32_t CompressedDiscImage::getBlockSize(uint32_t block) const
+{
+	uint64_t start = (uint64_t)block * m_header.m_blockSize;
+	return (uint32_t)std::min<uint64_t>(m_header.m_blockSize, m_header.m_imageSize - start);
+}
+
+const uint8_t* CompressedDiscImage::getBlock(uint32_t block)
+{
+	m_useCounter += 1;
+
+	CacheEntry* victim = &m_cache[0];
+	for (CacheEntry& entry : m_cache)
+	{
+		if (entry.m_block == block)
+		{
+			entry.m_lastUse = m_useCounter;
+			return entry.m_data.data();
+		}
+
+		if (entry.m_lastUse < victim->m_lastUse)
+			victim = &entry;
+	}
+
+	const CompressedBlockEntry& entry = m_index[block];
+	uint32_t blockSize = getBlockSize(block);
+
+	const uint8_t* packed = m_container->view(entry.m_offset, entry.m_size);
+	if (packed == nullptr)
+	{
+		m_packed.resize(entry.m_size);
+		if (!m_container->read(entry.m_offset, m_packed.data(), entry.m_size))
+			return nullptr;
+		packed = m_packed.data();
+	}
+
+	// The entry is reused, forget the block it held until it's refilled
+	victim->m_block = ~0u;
+	victim->m_lastUse = 0x0;
+
+	uint8_t* data = victim->m_data.data();
+	if (entry.m_size == blockSize)
+	{
+		memcpy(data, packed, blockSize);
+	}
+	else if (!lzDecompress(packed, entry.m_size, data, blockSize))
+	{
+		WARN("Corrupted block " << block << " in the compressed image");
+		return nullptr;
+	}
+
+	if (crc32(data, blockSize) != entry.m_crc)
+	{
+		WARN("CRC mismatch on block " << block << " in the compressed image");
+		return nullptr;
+	}
+
+	victim->m_block = block;
+	victim->m_lastUse = m_useCounter;
+
+	return data;
+}
+
+bool CompressedDiscImage::read(uint64_t offset, uint8_t* dst, size_t size)
+{
+	if (offset > m_header.m_imageSize || size > m_header.m_imageSize - offset)
+		return false;
+
+	while (size > 0)
+	{
+		uint32_t block = (uint32_t)(offset / m_header.m_blockSize);
+		uint32_t blockOffset = (uint32_t)(offset % m_header.m_blockSize);
+		size_t count = std::min<size_t>(size, getBlockSize(block) - blockOffset);
+
+		const uint8_t* data = getBlock(block);
+		if (data == nullptr)
+			return false;
+
+		memcpy(dst, data + blockOffset, count);
+
+		dst += count;
+		offset += count;
+		size -= count;
+	}
+
+	return true;
+}
+
+void CompressedDiscImage::prefetch(uint64_t offset, size_t size)
+{
+	if (offset >= m_header.m_imageSize || size == 0)
+		return;
+
+	uint64_t last = std::min<uint64_t>(offset + size, m_header.m_imageSize) - 1;
+	const CompressedBlockEntry& first = m_index[(size_t)(offset / m_header.m_blockSize)];
+	const CompressedBlockEntry& end = m_index[(size_t)(last / m_header.m_blockSize)];
+
+	// Blocks are stored in order, the compressed range is contiguous
+	m_container->prefetch(first.m_offset, (size_t)(end.m_offset + end.m_size - first.m_offset));
+}
+
+bool CompressedDiscImage::convert(const std::string& sourcePath, const std::string& outputPath)
+{
+	std::unique_ptr<DiscImage> source = DiscImage::open(sourcePath);
+	if (!source)
+	{
+		WARN("Can't open the disc image " << sourcePath);
+		return false;
+	}
+
+	std::ofstream output(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!output.good())
+	{
+		WARN("Can't create " << outputPath);
+		return false;
+	}
+
+	CompressedImageHeader header;
+	memcpy(header.m_magic, COMPRESSED_IMAGE_MAGIC, sizeof(header.m_magic));
+	header.m_version = COMPRESSED_IMAGE_VERSION;
+	header.m_blockSize = COMPRESSED_BLOCK_SECTORS * SECTOR_SIZE;
+	header.m_imageSize = source->getSize();
+	header.m_blockCount = (uint32_t)((header.m_imageSize + header.m_blockSize - 1) / header.m_blockSize);
+
+	// The index is written again once the block positions are known
+	std::vector<CompressedBlockEntry> index(header.m_blockCount);
+	output.write((const char*)&header, sizeof(header));
+	output.write((const char*)index.data(), index.size() * sizeof(CompressedBlockEntry));
+
+	std::vector<uint8_t> block(header.m_blockSize);
+	std::vector<uint8_t> packed(header.m_blockSize);
+	uint64_t offset = sizeof(header) + index.size() * sizeof(CompressedBlockEntry);
+
+	for (uint32_t i = 0; i < header.m_blockCount; ++i)
+	{
+		uint32_t blockSize = (uint32_t)std::min<uint64_t>(header.m_blockSize, header.m_imageSize - (uint64_t)i * header.m_blockSize);
+		if (!source->read((uint64_t)i * header.m_blockSize, block.data(), blockSize))
+		{
+			WARN("Can't read block " << i << " of " << sourcePath);
+			return false;
+		}
+
+		// A compressed block must be smaller than the original, otherwise
+		// it's stored as is
+		const uint8_t* data = packed.data();
+		uint32_t size = (uint32_t)lzCompress(block.data(), blockSize, packed.data(), blockSize - 1);
+		if (size == 0x0)
+		{
+			data = block.data();
+			size = blockSize;
+		}
+
+		index[i].m_offset = offset;
+		index[i].m_size = size;
+		index[i].m_crc = crc32(block.data(), blockSize);
+
+		output.write((const char*)data, size);
+		offset += size;
+	}
+
+	output.seekp(sizeof(header), std::ios_base::beg);
+	output.write((const char*)index.data(), index.size() * sizeof(CompressedBlockEntry));
+
+	if (!output.good())
+	{
+		WARN("Can't write " << outputPath);
+		return false;
+	}
+
+	return true;
+}
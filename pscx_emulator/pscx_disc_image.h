@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Backing storage of a disc image: the raw bytes of a BIN file
+struct DiscImage
+{
+	virtual ~DiscImage() {}
+
+	// Open 'path', memory mapped if possible, streamed otherwise. Return
+	// nullptr if the file can't be opened.
+	static std::unique_ptr<DiscImage> open(const std::string& path);
+
+	// Size of the image in bytes
+	virtual uint64_t getSize() const = 0;
+
+	// Return a pointer to 'size' bytes at 'offset' which stays valid as
+	// long as the image exists, or nullptr if the image can't provide one
+	// (streamed images, out of range reads). Callers fall back to read().
+	virtual const uint8_t* view(uint64_t /*offset*/, size_t /*size*/) { return nullptr; }
+
+	// Copy 'size' bytes at 'offset' to 'dst'
+	virtual bool read(uint64_t offset, uint8_t* dst, size_t size) = 0;
+
+	// The drive is about to read sequentially from 'offset'. Sources which
+	// can prefetch use this to start loading the data.
+	virtual void prefetch(uint64_t /*offset*/, size_t /*size*/) {}
+};
+
+// Image read with std::ifstream, used when the file can't be mapped
+struct StreamDiscImage : public DiscImage
+{
+	StreamDiscImage(std::ifstream&& file, uint64_t size);
+
+	uint64_t getSize() const override { return m_size; }
+	bool read(uint64_t offset, uint8_t* dst, size_t size) override;
+
+private:
+	std::ifstream m_file;
+	uint64_t m_size;
+
+	// Position of the file pointer, sequential reads skip the seek
+	uint64_t m_position;
+};
+
+// Image mapped in the address space. Sectors are used in place and the
+// pages are shared with every process mapping the same file.
+struct MappedDiscImage : public DiscImage
+{
+	~MappedDiscImage();
+
+	// Map 'path' read only, return nullptr on failure
+	static std::unique_ptr<MappedDiscImage> map(const std::string& path);
+
+	uint64_t getSize() const override { return m_size; }
+	const uint8_t* view(uint64_t offset, size_t size) override;
+	bool read(uint64_t offset, uint8_t* dst, size_t size) override;
+	void prefetch(uint64_t offset, size_t size) override;
+
+private:
+	MappedDiscImage();
+
+	const uint8_t* m_data;
+	uint64_t m_size;
+
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#endif
+};
+
+// Compressed images start with these 4 bytes
+const char COMPRESSED_IMAGE_MAGIC[4] = { 'P', 'S', 'X', 'Z' };
+const uint32_t COMPRESSED_IMAGE_VERSION = 1;
+
+// Sectors compressed together. Blocks are independent so any sector can be
+// read by expanding a single block, 16 sectors keep the cost of a random
+// read low while sequential reads expand one block every 16 sectors.
+const uint32_t COMPRESSED_BLOCK_SECTORS = 16;
+
+// Number of expanded blocks kept in memory
+const uint32_t COMPRESSED_CACHE_BLOCKS = 4;
+
+// Header of a compressed image, little endian. It's followed by the index,
+// one CompressedBlockEntry per block, then by the blocks.
+struct CompressedImageHeader
+{
+	char m_magic[4];
+	uint32_t m_version;
+	// Uncompressed size of a block, the last one can be shorter
+	uint32_t m_blockSize;
+	uint32_t m_blockCount;
+	// Size of the original image
+	uint64_t m_imageSize;
+};
+
+struct CompressedBlockEntry
+{
+	// Position of the block in the file
+	uint64_t m_offset;
+	// Stored size, equal to the uncompressed size for blocks which
+	// didn't compress and are stored as is
+	uint32_t m_size;
+	// crc32 of the uncompressed data
+	uint32_t m_crc;
+};
+
+static_assert(sizeof(CompressedImageHeader) == 24, "Compressed image header layout");
+static_assert(sizeof(CompressedBlockEntry) == 16, "Compressed image index layout");
+
+// Image stored as independently compressed blocks of sectors ( see
+// pscx_lz.h ) with an index giving the position of each block. The blocks
+// read last are kept expanded, the sectors are copied out of them.
+// Like StreamDiscImage it must only be used from one thread at a time.
+struct CompressedDiscImage : public DiscImage
+{
+	// True if 'image' starts with the compressed image magic
+	static bool isCompressed(DiscImage& image);
+
+	// Read the header and the index of the compressed image stored in
+	// 'container', return nullptr if they're invalid
+	static std::unique_ptr<CompressedDiscImage> open(std::unique_ptr<DiscImage> container);
+
+	// Compress the image at 'sourcePath' to 'outputPath'
+	static bool convert(const std::string& sourcePath, const std::string& outputPath);
+
+	uint64_t getSize() const override { return m_header.m_imageSize; }
+	bool read(uint64_t offset, uint8_t* dst, size_t size) override;
+	void prefetch(uint64_t offset, size_t size) override;
+
+private:
+	CompressedDiscImage(std::unique_ptr<DiscImage> container);
+
+	uint32_t getBlockSize(uint32_t block) const;
+
+	// Return the expanded contents of 'block', nullptr if it's corrupted
+	const uint8_t* getBlock(uint32_t block);
+
+	struct CacheEntry
+	{
+		CacheEntry() :
+			m_block(~0u),
+			m_lastUse(0x0)
+		{}
+
+		uint32_t m_block;
+		uint32_t m_lastUse;
+		std::vector<uint8_t> m_data;
+	};
+
+	std::unique_ptr<DiscImage> m_container;
+
+	CompressedImageHeader m_header;
+	std::vector<CompressedBlockEntry> m_index;
+
+	CacheEntry m_cache[COMPRESSED_CACHE_BLOCKS];
+	uint32_t m_useCounter;
+
+	// Compressed data of containers which can't be viewed in place
+	std::vector<uint8_t> m_packed;
+};
@@ -0,0 +1,280 @@
+#include "pscx_display.h"
+#include "pscx_common.h"
+#include "pscx_simd.h"
+
+#include <algorithm>
+
+#if PSCX_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Size of a VRAM line in bytes, 24 bit pixels wrap around after that
+const uint32_t VRAM_LINE_BYTES = VRAM_WIDTH * 2;
+
+#if PSCX_AVX2
+static bool hasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+
+	// The OS must save the AVX registers (OSXSAVE, AVX and XCR0 bits 1-2)
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+	if ((_xgetbv(0) & 0x6) != 0x6) return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	// Compiled with AVX2 enabled
+	return true;
+#endif
+}
+
+static const bool s_hasAvx2 = hasAvx2();
+#endif
+
+// Expand a 5 bit component to 8 bits
+static inline uint32_t expand5(uint32_t c)
+{
+	return (c << 3) | (c >> 2);
+}
+
+static inline uint32_t convertPixel15(uint16_t pixel)
+{
+	uint32_t r = expand5(pixel & 0x1f);
+	uint32_t g = expand5((pixel >> 5) & 0x1f);
+	uint32_t b = expand5((pixel >> 10) & 0x1f);
+
+	return r | (g << 8) | (b << 16) | DISPLAY_BLACK;
+}
+
+#if PSCX_SSE2
+static inline __m128i expand5(__m128i c)
+{
+	return _mm_or_si128(_mm_slli_epi16(c, 3), _mm_srli_epi16(c, 2));
+}
+#endif
+
+#if PSCX_AVX2
+static inline __m256i expand5(__m256i c)
+{
+	return _mm256_or_si256(_mm256_slli_epi16(c, 3), _mm256_srli_epi16(c, 2));
+}
+
+static size_t convertLine15Avx2(const uint16_t* src, uint32_t* dst, size_t count)
+{
+	const __m256i mask = _mm256_set1_epi16(0x1f);
+	const __m256i alpha = _mm256_set1_epi16((short)0xff00);
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)(src + i));
+
+		__m256i r = expand5(_mm256_and_si256(pixels, mask));
+		__m256i g = expand5(_mm256_and_si256(_mm256_srli_epi16(pixels, 5), mask));
+		__m256i b = expand5(_mm256_and_si256(_mm256_srli_epi16(pixels, 10), mask));
+
+		// 16 bit lanes holding R | G << 8 and B | A << 8
+		__m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+		__m256i ba = _mm256_or_si256(b, alpha);
+
+		// The unpacks work within each 128 bit half: low gives pixels 0-3
+		// and 8-11, high gives 4-7 and 12-15
+		__m256i low = _mm256_unpacklo_epi16(rg, ba);
+		__m256i high = _mm256_unpackhi_epi16(rg, ba);
+
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute2x128_si256(low, high, 0x20));
+		_mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_permute2x128_si256(low, high, 0x31));
+	}
+	return i;
+}
+
+static size_t convertLine24Avx2(const uint8_t* bytes, uint32_t offset, uint32_t* dst, size_t count)
+{
+	// Move the 24 source bytes so that each 128 bit half holds 12 of them
+	const __m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+
+	// Then expand each 3 byte pixel to 4 bytes, 0x80 clears the byte
+	const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128,
+											 0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+	const __m256i alpha = _mm256_set1_epi32((int)DISPLAY_BLACK);
+
+	size_t i = 0;
+	for (; i + 8 <= count && offset + 32 <= VRAM_LINE_BYTES; i += 8, offset += 24)
+	{
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)(bytes + offset));
+		pixels = _mm256_permutevar8x32_epi32(pixels, spread);
+		pixels = _mm256_shuffle_epi8(pixels, shuffle);
+
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(pixels, alpha));
+	}
+	return i;
+}
+#endif
+
+// ***************** DisplayOut implementation ******************
+DisplayOut::DisplayOut() :
+	m_repeatCount(0x0)
+{
+}
+
+void DisplayOut::convertLine15(const uint16_t* src, uint32_t* dst, size_t count)
+{
+	size_t i = 0;
+
+#if PSCX_AVX2
+	if (s_hasAvx2)
+	{
+		i = convertLine15Avx2(src, dst, count);
+	}
+#endif
+
+#if PSCX_SSE2
+	const __m128i mask = _mm_set1_epi16(0x1f);
+	const __m128i alpha = _mm_set1_epi16((short)0xff00);
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(src + i));
+
+		__m128i r = expand5(_mm_and_si128(pixels, mask));
+		__m128i g = expand5(_mm_and_si128(_mm_srli_epi16(pixels, 5), mask));
+		__m128i b = expand5(_mm_and_si128(_mm_srli_epi16(pixels, 10), mask));
+
+		// 16 bit lanes holding R | G << 8 and B | A << 8
+		__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+		__m128i ba = _mm_or_si128(b, alpha);
+
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(rg, ba));
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		dst[i] = convertPixel15(src[i]);
+	}
+}
+
+void DisplayOut::convertLine24(const uint16_t* line, uint32_t offset, uint32_t* dst, size_t count)
+{
+	// Pixels are stored as R, G, B bytes regardless of the 16 bit VRAM layout
+	const uint8_t* bytes = (const uint8_t*)line;
+	offset %= VRAM_LINE_BYTES;
+
+	size_t i = 0;
+
+#if PSCX_AVX2
+	if (s_hasAvx2)
+	{
+		i = convertLine24Avx2(bytes, offset, dst, count);
+		offset += (uint32_t)i * 3;
+	}
+#endif
+
+#if PSCX_SSE2
+	const __m128i alpha = _mm_set1_epi32((int)DISPLAY_BLACK);
+
+	// Without SSSE3 byte shuffles, build each 32 bit lane from a copy of the
+	// source shifted by 3 bytes per pixel. The top byte is then replaced by
+	// the alpha.
+	for (; i + 4 <= count && offset + 16 <= VRAM_LINE_BYTES; i += 4, offset += 12)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(bytes + offset));
+
+		__m128i p01 = _mm_unpacklo_epi32(pixels, _mm_srli_si128(pixels, 3));
+		__m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(pixels, 6), _mm_srli_si128(pixels, 9));
+		__m128i rgb = _mm_unpacklo_epi64(p01, p23);
+
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(rgb, alpha));
+	}
+#endif
+
+	for (; i < count; ++i, offset += 3)
+	{
+		uint32_t r = bytes[offset % VRAM_LINE_BYTES];
+		uint32_t g = bytes[(offset + 1) % VRAM_LINE_BYTES];
+		uint32_t b = bytes[(offset + 2) % VRAM_LINE_BYTES];
+
+		dst[i] = r | (g << 8) | (b << 16) | DISPLAY_BLACK;
+	}
+}
+
+void DisplayOut::convert(const uint16_t* vram, const DisplayArea& area)
+{
+	if (area.m_width != m_frame.m_width || area.m_height != m_frame.m_height)
+	{
+		m_frame.m_width = area.m_width;
+		m_frame.m_height = area.m_height;
+		m_frame.m_pixels.assign((size_t)area.m_width * area.m_height, DISPLAY_BLACK);
+	}
+
+	m_frame.m_number += 1;
+	m_frame.m_fieldRate = area.m_fieldRate;
+
+	if (area.m_disabled)
+	{
+		std::fill(m_frame.m_pixels.begin(), m_frame.m_pixels.end(), DISPLAY_BLACK);
+		return;
+	}
+
+	for (uint16_t line = 0; line < area.m_height; ++line)
+	{
+		// Weave: the lines of the other field stay from the previous call
+		if (area.m_interlaced && (line & 1) != area.m_field) continue;
+
+		const uint16_t* src = vram + (size_t)((area.m_y + line) & (VRAM_HEIGHT - 1)) * VRAM_WIDTH;
+		uint32_t* dst = &m_frame.m_pixels[(size_t)line * area.m_width];
+
+		if (area.m_24Bit)
+		{
+			convertLine24(src, (uint32_t)area.m_x * 2, dst, area.m_width);
+		}
+		else
+		{
+			// The line wraps around the right edge of the VRAM
+			uint16_t x = area.m_x & (VRAM_WIDTH - 1);
+			size_t first = std::min((size_t)area.m_width, (size_t)(VRAM_WIDTH - x));
+
+			convertLine15(src + x, dst, first);
+			if (first < area.m_width)
+			{
+				convertLine15(src, dst + first, area.m_width - first);
+			}
+		}
+	}
+}
+
+void DisplayOut::pushFrame()
+{
+	for (FrameSink* sink : m_sinks)
+	{
+		sink->pushFrame(m_frame);
+	}
+}
+
+void DisplayOut::repeatFrame()
+{
+	m_repeatCount += 1;
+
+	for (FrameSink* sink : m_sinks)
+	{
+		sink->repeatFrame(m_frame);
+	}
+}
+
+void DisplayOut::addSink(FrameSink* sink)
+{
+	m_sinks.push_back(sink);
+}
+
+void DisplayOut::removeSink(FrameSink* sink)
+{
+	m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink), m_sinks.end());
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "pscx_vram.h"
+
+// Largest picture the video output can produce (640 pixels, 576 PAL lines)
+const uint16_t DISPLAY_MAX_WIDTH = 640;
+const uint16_t DISPLAY_MAX_HEIGHT = 576;
+
+// Opaque black in RGBA8
+const uint32_t DISPLAY_BLACK = 0xff000000;
+
+// Part of the VRAM sent to the video output
+struct DisplayArea
+{
+	DisplayArea() :
+		m_x(0x0),
+		m_y(0x0),
+		m_width(0x0),
+		m_height(0x0),
+		m_24Bit(false),
+		m_interlaced(false),
+		m_field(0x0),
+		m_disabled(true),
+		m_fieldRate(0.0)
+	{}
+
+	// Top left corner in VRAM, in 16 bit pixels
+	uint16_t m_x, m_y;
+
+	// Size of the output picture in display pixels
+	uint16_t m_width, m_height;
+
+	// Packed 24 bit RGB instead of 15 bit BGR555
+	bool m_24Bit;
+
+	// 480 line interlaced output, one field per vertical blanking
+	bool m_interlaced;
+
+	// Parity of the lines of the current field when interlaced
+	uint8_t m_field;
+
+	// Display disabled by GP1(0x03), the output is black
+	bool m_disabled;
+
+	// Fields per second of the video mode
+	double m_fieldRate;
+};
+
+// Picture converted from the display area, RGBA8 with red in the low byte
+struct DisplayFrame
+{
+	DisplayFrame() :
+		m_width(0x0),
+		m_height(0x0),
+		m_number(0x0),
+		m_fieldRate(0.0)
+	{}
+
+	uint16_t m_width, m_height;
+
+	// Frame counter, incremented for each converted frame
+	uint32_t m_number;
+
+	// Rate at which the frames are produced, one per field
+	double m_fieldRate;
+
+	// m_width * m_height pixels, one line after the other
+	std::vector<uint32_t> m_pixels;
+};
+
+// Consumer of the converted frames (capture, headless frontends...)
+struct FrameSink
+{
+	virtual ~FrameSink() {}
+
+	// Called for each frame, 'frame' is only valid for the duration of the call
+	virtual void pushFrame(const DisplayFrame& frame) = 0;
+
+	// Called instead of pushFrame() when the picture is identical to the
+	// previous one. Sinks which need a constant frame rate can repeat it.
+	virtual void repeatFrame(const DisplayFrame& /*frame*/) {}
+};
+
+// Video output stage: converts the displayed VRAM area to RGBA8 using SSE2
+// or AVX2 kernels when available and forwards the result to the sinks
+struct DisplayOut
+{
+	DisplayOut();
+
+	// Convert 'area' from 'vram' (VRAM_WIDTH x VRAM_HEIGHT pixels). With
+	// interlaced output only the lines of the current field are converted,
+	// the other ones are kept from the previous field.
+	void convert(const uint16_t* vram, const DisplayArea& area);
+
+	// Send the last converted frame to the sinks
+	void pushFrame();
+
+	// Tell the sinks the last converted frame is shown again
+	void repeatFrame();
+
+	void addSink(FrameSink* sink);
+	void removeSink(FrameSink* sink);
+
+	bool hasSinks() const { return !m_sinks.empty(); }
+
+	const DisplayFrame& getFrame() const { return m_frame; }
+
+	// Number of frames which didn't need to be converted again
+	uint32_t getRepeatCount() const { return m_repeatCount; }
+
+	// Convert 'count' BGR555 pixels
+	static void convertLine15(const uint16_t* src, uint32_t* dst, size_t count);
+
+	// Convert 'count' packed 24 bit pixels starting at byte 'offset' of 'line'.
+	// The VRAM line wraps around after VRAM_WIDTH * 2 bytes.
+	static void convertLine24(const uint16_t* line, uint32_t offset, uint32_t* dst, size_t count);
+
+private:
+	DisplayFrame m_frame;
+
+	uint32_t m_repeatCount;
+
+	std::vector<FrameSink*> m_sinks;
+};
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <algorithm>
 
 #include "pscx_gpu.h"
 #include "pscx_cpu.h"
@@ -15,6 +16,14 @@ std::pair<uint16_t, uint16_t> Gpu::getVModeTimings() const
 	return std::make_pair(3404, 314); // VMode::Pal
 }
 
+double Gpu::getFieldRate() const
+{
+	std::pair<uint16_t, uint16_t> vModeTimings = getVModeTimings();
+
+	double gpuClock = (m_hardwareType == HardwareType::HARDWARE_TYPE_NTSC) ? 53'690'000.0 : 53'200'000.0;
+	return gpuClock / ((double)vModeTimings.first * (double)vModeTimings.second);
+}
+
 FracCycles Gpu::gpuToCpuClockRatio() const
 {
 	// First we convert the delta into GPU clock periods.
@@ -120,8 +129,13 @@ void Gpu::sync(TimeKeeper& timeKeeper, InterruptState& irqState)
 	if (m_vblankInterrupt && !vblankInterrupt)
 	{
 		// End of vertical blanking, probably as a good place as
-		// any to update the display
-		m_renderer.display();
+		// any to update the display. The pacer waits for the host
+		// clock and tells whether this field is shown.
+		m_pacer.setFieldRate(getFieldRate());
+		bool present = m_pacer.endField();
+
+		m_renderer.display(getDisplayArea(), present);
+		m_renderer.setDrawingEnabled(m_pacer.shouldRenderNextField());
 	}
 
 	m_vblankInterrupt = vblankInterrupt;
@@ -323,10 +337,25 @@ uint32_t Gpu::getStatusRegister() const
 	return statusRegister;
 }
 
-uint32_t Gpu::getReadRegister() const
+uint32_t Gpu::getReadRegister()
 {
 	LOG("GPUREAD");
-	// framebuffer read is not supported for now
+
+	if (m_imageStore.isActive())
+	{
+		// Each read returns two 16 bit pixels. This only blocks if the
+		// readback started by GP0(0xc0) hasn't completed yet.
+		uint32_t word = 0x0;
+		for (uint32_t i = 0; i < 2 && m_imageStore.isActive(); ++i)
+		{
+			uint16_t x = m_imageStore.m_x + (uint16_t)(m_imageStore.m_index % m_imageStore.m_width);
+			uint16_t y = m_imageStore.m_y + (uint16_t)(m_imageStore.m_index / m_imageStore.m_width);
+
+			word |= (uint32_t)m_renderer.getVramPixel(x, y) << (16 * i);
+			m_imageStore.m_index += 1;
+		}
+		m_readWord = word;
+	}
 	return m_readWord;
 }
 
@@ -469,6 +498,12 @@ void Gpu::gp0(uint32_t value)
 			commandParameters.gp0CommandMethod = &Gpu::gp0RectTextureBlendOpaque16x16;
 			break;
 		}
+		case 0x80:
+		{
+			commandParameters.gp0WordsRemaining = 4;
+			commandParameters.gp0CommandMethod = &Gpu::gp0CopyRect;
+			break;
+		}
 		case 0xa0:
 		{
 			commandParameters.gp0WordsRemaining = 3;
@@ -542,9 +577,18 @@ void Gpu::gp0(uint32_t value)
 		}
 		break;
 	case Gp0Mode::GP0_MODE_IMAGE_LOAD:
+		// Each word contains two 16 bit pixels, the last one is
+		// just padding if the image has an odd number of pixels
+		for (uint32_t i = 0; i < 2 && m_imageLoad.isActive(); ++i)
+		{
+			m_imageLoadBuffer[m_imageLoad.m_index] = (uint16_t)(value >> (16 * i));
+			m_imageLoad.m_index += 1;
+		}
+
 		if (m_gp0WordsRemaining == 0)
 		{
-			// Load done, switch back to command mode
+			// Load done, copy the image to the VRAM and switch back to command mode
+			m_renderer.uploadVram(m_imageLoad.m_x, m_imageLoad.m_y, m_imageLoad.m_width, m_imageLoad.m_height, m_imageLoadBuffer.data());
 			m_gp0Mode = Gp0Mode::GP0_MODE_COMMAND;
 		}
 	}
@@ -627,18 +671,16 @@ void Gpu::gp0ClearCache()
 
 void Gpu::gp0FillRect()
 {
-	Position topLeft = Position::fromPacked(m_gp0Command[1]);
-	Position size = Position::fromPacked(m_gp0Command[2]);
 	Color color = Color::fromPacked(m_gp0Command[0]);
 
-	Vertex vertices[] = {
-		Vertex(topLeft, color),
-		Vertex(Position(topLeft.getX() + size.getX(), topLeft.getY()), color),
-		Vertex(Position(topLeft.getX(), topLeft.getY() + size.getY()), color),
-		Vertex(Position(topLeft.getX() + size.getX(), topLeft.getY() + size.getY()), color)
-	};
+	// The fill ignores the drawing area and the drawing offset. The
+	// horizontal position and size are in 16 pixel units.
+	uint16_t x = m_gp0Command[1] & 0x3f0;
+	uint16_t y = (m_gp0Command[1] >> 16) & 0x1ff;
+	uint16_t width = ((m_gp0Command[2] & 0x3ff) + 0xf) & ~0xf;
+	uint16_t height = (m_gp0Command[2] >> 16) & 0x1ff;
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.fillRect(x, y, width, height, color);
 }
 
 void Gpu::gp0TriangleMonoOpaque()
@@ -672,11 +714,13 @@ void Gpu::gp0QuadMonoSemiTransparent()
 {
 	Color color = Color::fromPacked(m_gp0Command[0]);
 
+	BlendMode blendMode = (BlendMode)m_semiTransparency;
+
 	Vertex vertices[] = {
-		Vertex(Position::fromPacked(m_gp0Command[1]), color, 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[2]), color, 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[3]), color, 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[4]), color, 0.5f)
+		Vertex(Position::fromPacked(m_gp0Command[1]), color, blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[2]), color, blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[3]), color, blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[4]), color, blendMode)
 	};
 
 	m_renderer.pushQuad(vertices);
@@ -686,57 +730,72 @@ void Gpu::gp0QuadTextureBlendOpaque()
 {
 	Color color = Color::fromPacked(m_gp0Command[0]);
 
+	setPolygonTexturePage(m_gp0Command[4]);
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+
 	Vertex vertices[] = {
-		Vertex(Position::fromPacked(m_gp0Command[1]), color),
-		Vertex(Position::fromPacked(m_gp0Command[3]), color),
-		Vertex(Position::fromPacked(m_gp0Command[5]), color),
-		Vertex(Position::fromPacked(m_gp0Command[7]), color)
+		Vertex(Position::fromPacked(m_gp0Command[1]), color, TexCoord::fromPacked(m_gp0Command[2])),
+		Vertex(Position::fromPacked(m_gp0Command[3]), color, TexCoord::fromPacked(m_gp0Command[4])),
+		Vertex(Position::fromPacked(m_gp0Command[5]), color, TexCoord::fromPacked(m_gp0Command[6])),
+		Vertex(Position::fromPacked(m_gp0Command[7]), color, TexCoord::fromPacked(m_gp0Command[8]))
 	};
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.pushTexturedQuad(vertices, key, TextureMode::TEXTURE_MODE_BLEND);
 }
 
 void Gpu::gp0QuadTextureRawOpaque()
 {
 	Color color = Color::fromPacked(m_gp0Command[0]);
 
+	setPolygonTexturePage(m_gp0Command[4]);
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+
 	Vertex vertices[] = {
-		Vertex(Position::fromPacked(m_gp0Command[1]), color),
-		Vertex(Position::fromPacked(m_gp0Command[3]), color),
-		Vertex(Position::fromPacked(m_gp0Command[5]), color),
-		Vertex(Position::fromPacked(m_gp0Command[7]), color)
+		Vertex(Position::fromPacked(m_gp0Command[1]), color, TexCoord::fromPacked(m_gp0Command[2])),
+		Vertex(Position::fromPacked(m_gp0Command[3]), color, TexCoord::fromPacked(m_gp0Command[4])),
+		Vertex(Position::fromPacked(m_gp0Command[5]), color, TexCoord::fromPacked(m_gp0Command[6])),
+		Vertex(Position::fromPacked(m_gp0Command[7]), color, TexCoord::fromPacked(m_gp0Command[8]))
 	};
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.pushTexturedQuad(vertices, key, TextureMode::TEXTURE_MODE_RAW);
 }
 
 void Gpu::gp0QuadTextureBlendSemiTransparent()
 {
 	Color color = Color::fromPacked(m_gp0Command[0]);
 
+	setPolygonTexturePage(m_gp0Command[4]);
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+
+	BlendMode blendMode = (BlendMode)m_semiTransparency;
+
 	Vertex vertices[] = {
-		Vertex(Position::fromPacked(m_gp0Command[1]), color, 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[3]), color, 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[5]), color, 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[7]), color, 0.5f)
+		Vertex(Position::fromPacked(m_gp0Command[1]), color, TexCoord::fromPacked(m_gp0Command[2]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[3]), color, TexCoord::fromPacked(m_gp0Command[4]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[5]), color, TexCoord::fromPacked(m_gp0Command[6]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[7]), color, TexCoord::fromPacked(m_gp0Command[8]), blendMode)
 	};
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.pushTexturedQuad(vertices, key, TextureMode::TEXTURE_MODE_BLEND);
 }
 
 void Gpu::gp0QuadTextureRawSemiTransparent()
 {
-	// Using solid red color instead of textures
 	Color color = Color::fromPacked(m_gp0Command[0]);
 
+	setPolygonTexturePage(m_gp0Command[4]);
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+
+	BlendMode blendMode = (BlendMode)m_semiTransparency;
+
 	Vertex vertices[] = {
-		Vertex(Position::fromPacked(m_gp0Command[1]), color, 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[3]), color, 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[5]), color, 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[7]), color, 0.5f)
+		Vertex(Position::fromPacked(m_gp0Command[1]), color, TexCoord::fromPacked(m_gp0Command[2]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[3]), color, TexCoord::fromPacked(m_gp0Command[4]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[5]), color, TexCoord::fromPacked(m_gp0Command[6]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[7]), color, TexCoord::fromPacked(m_gp0Command[8]), blendMode)
 	};
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.pushTexturedQuad(vertices, key, TextureMode::TEXTURE_MODE_RAW);
 }
 
 void Gpu::gp0TriangleShadedOpaque()
@@ -752,24 +811,32 @@ void Gpu::gp0TriangleShadedOpaque()
 
 void Gpu::gp0TriangleTextureBlendOpaque()
 {
+	setPolygonTexturePage(m_gp0Command[5]);
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+
 	Vertex vertices[] = {
-		Vertex(Position::fromPacked(m_gp0Command[1]), Color::fromPacked(m_gp0Command[0])),
-		Vertex(Position::fromPacked(m_gp0Command[4]), Color::fromPacked(m_gp0Command[3])),
-		Vertex(Position::fromPacked(m_gp0Command[7]), Color::fromPacked(m_gp0Command[6]))
+		Vertex(Position::fromPacked(m_gp0Command[1]), Color::fromPacked(m_gp0Command[0]), TexCoord::fromPacked(m_gp0Command[2])),
+		Vertex(Position::fromPacked(m_gp0Command[4]), Color::fromPacked(m_gp0Command[3]), TexCoord::fromPacked(m_gp0Command[5])),
+		Vertex(Position::fromPacked(m_gp0Command[7]), Color::fromPacked(m_gp0Command[6]), TexCoord::fromPacked(m_gp0Command[8]))
 	};
 
-	m_renderer.pushTriangle(vertices);
+	m_renderer.pushTexturedTriangle(vertices, key, TextureMode::TEXTURE_MODE_BLEND);
 }
 
 void Gpu::gp0TriangleTextureBlendSemiTransparent()
 {
+	setPolygonTexturePage(m_gp0Command[5]);
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+
+	BlendMode blendMode = (BlendMode)m_semiTransparency;
+
 	Vertex vertices[] = {
-		Vertex(Position::fromPacked(m_gp0Command[1]), Color::fromPacked(m_gp0Command[0]), 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[4]), Color::fromPacked(m_gp0Command[3]), 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[7]), Color::fromPacked(m_gp0Command[6]), 0.5f)
+		Vertex(Position::fromPacked(m_gp0Command[1]), Color::fromPacked(m_gp0Command[0]), TexCoord::fromPacked(m_gp0Command[2]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[4]), Color::fromPacked(m_gp0Command[3]), TexCoord::fromPacked(m_gp0Command[5]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[7]), Color::fromPacked(m_gp0Command[6]), TexCoord::fromPacked(m_gp0Command[8]), blendMode)
 	};
 
-	m_renderer.pushTriangle(vertices);
+	m_renderer.pushTexturedTriangle(vertices, key, TextureMode::TEXTURE_MODE_BLEND);
 }
 
 void Gpu::gp0QuadShadedOpaque()
@@ -786,26 +853,34 @@ void Gpu::gp0QuadShadedOpaque()
 
 void Gpu::gp0QuadShadedTextureBlendOpaque()
 {
+	setPolygonTexturePage(m_gp0Command[5]);
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+
 	Vertex vertices[] = {
-		Vertex(Position::fromPacked(m_gp0Command[1]), Color::fromPacked(m_gp0Command[0])),
-		Vertex(Position::fromPacked(m_gp0Command[4]), Color::fromPacked(m_gp0Command[3])),
-		Vertex(Position::fromPacked(m_gp0Command[7]), Color::fromPacked(m_gp0Command[6])),
-		Vertex(Position::fromPacked(m_gp0Command[10]), Color::fromPacked(m_gp0Command[9]))
+		Vertex(Position::fromPacked(m_gp0Command[1]), Color::fromPacked(m_gp0Command[0]), TexCoord::fromPacked(m_gp0Command[2])),
+		Vertex(Position::fromPacked(m_gp0Command[4]), Color::fromPacked(m_gp0Command[3]), TexCoord::fromPacked(m_gp0Command[5])),
+		Vertex(Position::fromPacked(m_gp0Command[7]), Color::fromPacked(m_gp0Command[6]), TexCoord::fromPacked(m_gp0Command[8])),
+		Vertex(Position::fromPacked(m_gp0Command[10]), Color::fromPacked(m_gp0Command[9]), TexCoord::fromPacked(m_gp0Command[11]))
 	};
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.pushTexturedQuad(vertices, key, TextureMode::TEXTURE_MODE_BLEND);
 }
 
 void Gpu::gp0QuadShadedTextureBlendTransparent()
 {
+	setPolygonTexturePage(m_gp0Command[5]);
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+
+	BlendMode blendMode = (BlendMode)m_semiTransparency;
+
 	Vertex vertices[] = {
-		Vertex(Position::fromPacked(m_gp0Command[1]), Color::fromPacked(m_gp0Command[0]), 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[4]), Color::fromPacked(m_gp0Command[3]), 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[7]), Color::fromPacked(m_gp0Command[6]), 0.5f),
-		Vertex(Position::fromPacked(m_gp0Command[10]), Color::fromPacked(m_gp0Command[9]), 0.5f)
+		Vertex(Position::fromPacked(m_gp0Command[1]), Color::fromPacked(m_gp0Command[0]), TexCoord::fromPacked(m_gp0Command[2]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[4]), Color::fromPacked(m_gp0Command[3]), TexCoord::fromPacked(m_gp0Command[5]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[7]), Color::fromPacked(m_gp0Command[6]), TexCoord::fromPacked(m_gp0Command[8]), blendMode),
+		Vertex(Position::fromPacked(m_gp0Command[10]), Color::fromPacked(m_gp0Command[9]), TexCoord::fromPacked(m_gp0Command[11]), blendMode)
 	};
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.pushTexturedQuad(vertices, key, TextureMode::TEXTURE_MODE_BLEND);
 }
 
 void Gpu::gp0RectOpaque()
@@ -830,14 +905,23 @@ void Gpu::gp0RectTextureBlendOpaque()
 	Position size = Position::fromPacked(m_gp0Command[3]);
 	Color color = Color::fromPacked(m_gp0Command[0]);
 
+	// Rectangles use the texture page set by GP0(0xe1)
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+	TexCoord texCoord = TexCoord::fromPacked(m_gp0Command[2]);
+
+	GLshort right = topLeft.getX() + size.getX();
+	GLshort bottom = topLeft.getY() + size.getY();
+	GLshort u = texCoord.getU() + size.getX();
+	GLshort v = texCoord.getV() + size.getY();
+
 	Vertex vertices[] = {
-		Vertex(topLeft, color),
-		Vertex(Position(topLeft.getX() + size.getX(), topLeft.getY()), color),
-		Vertex(Position(topLeft.getX(), topLeft.getY() + size.getY()), color),
-		Vertex(Position(topLeft.getX() + size.getX(), topLeft.getY() + size.getY()), color)
+		Vertex(topLeft, color, texCoord),
+		Vertex(Position(right, topLeft.getY()), color, TexCoord(u, texCoord.getV())),
+		Vertex(Position(topLeft.getX(), bottom), color, TexCoord(texCoord.getU(), v)),
+		Vertex(Position(right, bottom), color, TexCoord(u, v))
 	};
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.pushTexturedQuad(vertices, key, TextureMode::TEXTURE_MODE_BLEND);
 }
 
 void Gpu::gp0RectTextureRawOpaque()
@@ -846,41 +930,68 @@ void Gpu::gp0RectTextureRawOpaque()
 	Position size = Position::fromPacked(m_gp0Command[3]);
 	Color color = Color::fromPacked(m_gp0Command[0]);
 
+	// Rectangles use the texture page set by GP0(0xe1)
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+	TexCoord texCoord = TexCoord::fromPacked(m_gp0Command[2]);
+
+	GLshort right = topLeft.getX() + size.getX();
+	GLshort bottom = topLeft.getY() + size.getY();
+	GLshort u = texCoord.getU() + size.getX();
+	GLshort v = texCoord.getV() + size.getY();
+
 	Vertex vertices[] = {
-		Vertex(topLeft, color),
-		Vertex(Position(topLeft.getX() + size.getX(), topLeft.getY()), color),
-		Vertex(Position(topLeft.getX(), topLeft.getY() + size.getY()), color),
-		Vertex(Position(topLeft.getX() + size.getX(), topLeft.getY() + size.getY()), color)
+		Vertex(topLeft, color, texCoord),
+		Vertex(Position(right, topLeft.getY()), color, TexCoord(u, texCoord.getV())),
+		Vertex(Position(topLeft.getX(), bottom), color, TexCoord(texCoord.getU(), v)),
+		Vertex(Position(right, bottom), color, TexCoord(u, v))
 	};
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.pushTexturedQuad(vertices, key, TextureMode::TEXTURE_MODE_RAW);
 }
 
 void Gpu::gp0RectTextureBlendOpaque16x16()
 {
 	Position topLeft = Position::fromPacked(m_gp0Command[1]);
+	Position size(16, 16);
 	Color color = Color::fromPacked(m_gp0Command[0]);
 
+	// Rectangles use the texture page set by GP0(0xe1)
+	TextureKey key = getTextureKey(m_gp0Command[2]);
+	TexCoord texCoord = TexCoord::fromPacked(m_gp0Command[2]);
+
+	GLshort right = topLeft.getX() + size.getX();
+	GLshort bottom = topLeft.getY() + size.getY();
+	GLshort u = texCoord.getU() + size.getX();
+	GLshort v = texCoord.getV() + size.getY();
+
 	Vertex vertices[] = {
-		Vertex(topLeft, color),
-		Vertex(Position(topLeft.getX() + 16, topLeft.getY()), color),
-		Vertex(Position(topLeft.getX(), topLeft.getY() + 16), color),
-		Vertex(Position(topLeft.getX() + 16, topLeft.getY() + 16), color)
+		Vertex(topLeft, color, texCoord),
+		Vertex(Position(right, topLeft.getY()), color, TexCoord(u, texCoord.getV())),
+		Vertex(Position(topLeft.getX(), bottom), color, TexCoord(texCoord.getU(), v)),
+		Vertex(Position(right, bottom), color, TexCoord(u, v))
 	};
 
-	m_renderer.pushQuad(vertices);
+	m_renderer.pushTexturedQuad(vertices, key, TextureMode::TEXTURE_MODE_BLEND);
 }
 
-void Gpu::gp0ImageLoad()
+void Gpu::gp0CopyRect()
 {
-	// Parameter 2 contains the image resolution
-	uint32_t imageResolution = m_gp0Command[2];
+	// Parameter 1 is the source, parameter 2 the destination and
+	// parameter 3 the size of the rectangle
+	ImageTransfer source = ImageTransfer::fromCommand(m_gp0Command[1], m_gp0Command[3]);
+	ImageTransfer destination = ImageTransfer::fromCommand(m_gp0Command[2], m_gp0Command[3]);
+
+	m_renderer.copyRect(source.m_x, source.m_y, destination.m_x, destination.m_y, source.m_width, source.m_height);
+}
 
-	uint32_t width = imageResolution & 0xffff;
-	uint32_t height = imageResolution >> 16;
+void Gpu::gp0ImageLoad()
+{
+	// Parameter 1 contains the destination, parameter 2 the image resolution
+	m_imageLoad = ImageTransfer::fromCommand(m_gp0Command[1], m_gp0Command[2]);
 
 	// Size of the image in 16 bit pixels
-	uint32_t imageSize = width * height;
+	uint32_t imageSize = m_imageLoad.getPixelCount();
+	m_imageLoadBuffer.resize(imageSize);
 
 	// If we have an odd number of pixels we must round up
 	// since we transfer 32 bits at a time. There will be 16 bits
@@ -896,13 +1007,12 @@ void Gpu::gp0ImageLoad()
 
 void Gpu::gp0ImageStore()
 {
-	// Parameter 2 contains the image resolution
-	uint32_t imageResolution = m_gp0Command[2];
-
-	uint32_t width = imageResolution & 0xffff;
-	uint32_t height = imageResolution >> 16;
+	// Parameter 1 contains the source, parameter 2 the image resolution
+	m_imageStore = ImageTransfer::fromCommand(m_gp0Command[1], m_gp0Command[2]);
 
-	LOG("Unhandled image store 0x" << width << " 0x" << height);
+	// Start copying the pixels right away, the CPU only has to wait
+	// for them when it actually reads GPUREAD
+	m_renderer.readbackVram(m_imageStore.m_x, m_imageStore.m_y, m_imageStore.m_width, m_imageStore.m_height);
 }
 
 void Gpu::gp0DrawMode()
@@ -965,6 +1075,54 @@ void Gpu::gp0DrawingAreaBottomRight()
 	updateDrawingArea();
 }
 
+DisplayArea Gpu::getDisplayArea() const
+{
+	DisplayArea area;
+	area.m_x = m_displayVramXStart;
+	area.m_y = m_displayVramYStart;
+	area.m_width = m_hres.getWidth();
+	area.m_24Bit = m_displayDepth == DisplayDepth::DISPLAY_DEPTH_24_BITS;
+	area.m_disabled = m_displayDisabled;
+
+	// Number of lines from the vertical display range, clamped to
+	// what the video mode can show
+	uint16_t maxLines = (m_vmode == VMode::VMODE_PAL) ? 288 : 240;
+	uint16_t lines = (m_displayLineEnd > m_displayLineStart) ? m_displayLineEnd - m_displayLineStart : maxLines;
+	lines = std::min(lines, maxLines);
+
+	// In 480 line mode each field only contains every other line
+	area.m_interlaced = m_interlaced && m_vres == VerticalRes::VERTICAL_RES_480_LINES;
+	area.m_height = area.m_interlaced ? lines * 2 : lines;
+	area.m_field = (uint8_t)m_field;
+	area.m_fieldRate = getFieldRate();
+
+	return area;
+}
+
+TextureKey Gpu::getTextureKey(uint32_t clutAttribute) const
+{
+	// The CLUT x position is in 16 pixel steps
+	uint16_t clutX = ((clutAttribute >> 16) & 0x3f) * 16;
+	uint16_t clutY = (clutAttribute >> 22) & 0x1ff;
+
+	return TextureKey(m_pageBaseX, m_pageBaseY, (uint8_t)m_textureDepth, clutX, clutY);
+}
+
+void Gpu::setPolygonTexturePage(uint32_t pageAttribute)
+{
+	uint32_t value = pageAttribute >> 16;
+
+	m_pageBaseX = value & 0xf;
+	m_pageBaseY = (value >> 4) & 1;
+	m_semiTransparency = (value >> 5) & 3;
+
+	// The reserved depth value 3 behaves like 15 bits
+	uint32_t textureDepthValue = (value >> 7) & 3;
+	m_textureDepth = (textureDepthValue == 0) ? TextureDepth::TEXTURE_DEPTH_4_BIT :
+					 (textureDepthValue == 1) ? TextureDepth::TEXTURE_DEPTH_8_BIT :
+												TextureDepth::TEXTURE_DEPTH_15_BIT;
+}
+
 void Gpu::updateDrawingArea()
 {
 	m_renderer.setDrawingArea(m_drawingAreaLeft,
@@ -996,6 +1154,9 @@ void Gpu::gp0TextureWindow()
 	m_textureWindowYMask = (value >> 5) & 0x1f;
 	m_textureWindowXOffset = (value >> 10) & 0x1f;
 	m_textureWindowYOffset = (value >> 15) & 0x1f;
+
+	m_renderer.setTextureWindow(m_textureWindowXMask, m_textureWindowYMask,
+								m_textureWindowXOffset, m_textureWindowYOffset);
 }
 
 void Gpu::gp0MaskBitSetting()
@@ -1017,6 +1178,7 @@ void Gpu::gp1Reset(TimeKeeper& timeKeeper, InterruptState& irqState)
 	m_textureWindowYMask = 0x0;
 	m_textureWindowXOffset = 0x0;
 	m_textureWindowYOffset = 0x0;
+	m_renderer.setTextureWindow(0x0, 0x0, 0x0, 0x0);
 	m_dithering = false;
 	m_drawToDisplay = false;
 	m_textureDisable = false;
@@ -1050,6 +1212,9 @@ void Gpu::gp1Reset(TimeKeeper& timeKeeper, InterruptState& irqState)
 
 	m_renderer.setDrawOffset(0, 0);
 
+	// Abort any pending VRAM to CPU transfer
+	m_imageStore = ImageTransfer();
+
 	gp1ResetCommandBuffer();
 	gp1AcknowledgeIrq();
 
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <vector>
+
 #include "pscx_common.h"
 #include "pscx_memory.h"
 #include "pscx_renderer.h"
 #include "pscx_timekeeper.h"
 #include "pscx_interrupts.h"
 #include "pscx_timers.h"
+#include "pscx_pacer.h"
 
 //const Cycles CLOCK_RATIO_FRAC = 0x10000;
 
@@ -49,6 +52,18 @@ struct HorizontalRes
 		return ((uint32_t)m_horizontalRes) << 16;
 	}
 
+	// Return the approximate number of pixels per line
+	uint16_t getWidth() const
+	{
+		if (m_horizontalRes & 1)
+		{
+			return 368;
+		}
+
+		const uint16_t widths[] = { 256, 320, 512, 640 };
+		return widths[(m_horizontalRes >> 1) & 0x3];
+	}
+
 	// Return the divider used to generate the dotclock from the GPU clock.
 	uint8_t dotclockDivider() const
 	{
@@ -179,6 +194,48 @@ private:
 	uint8_t m_len;
 };
 
+// VRAM rectangle transferred by an image load or an image store
+struct ImageTransfer
+{
+	ImageTransfer() :
+		m_x(0x0),
+		m_y(0x0),
+		m_width(0x0),
+		m_height(0x0),
+		m_index(0x0)
+	{}
+
+	// Parse the position and resolution parameters of GP0(0xa0) and GP0(0xc0)
+	static ImageTransfer fromCommand(uint32_t position, uint32_t resolution)
+	{
+		ImageTransfer transfer;
+		transfer.m_x = position & 0x3ff;
+		transfer.m_y = (position >> 16) & 0x1ff;
+
+		// A size of 0 means the full VRAM width or height
+		transfer.m_width = (((resolution & 0xffff) - 1) & 0x3ff) + 1;
+		transfer.m_height = (((resolution >> 16) - 1) & 0x1ff) + 1;
+		return transfer;
+	}
+
+	// Number of 16 bit pixels in the transfer
+	uint32_t getPixelCount() const
+	{
+		return (uint32_t)m_width * (uint32_t)m_height;
+	}
+
+	// True while there are pixels left to transfer
+	bool isActive() const
+	{
+		return m_index < getPixelCount();
+	}
+
+	uint16_t m_x, m_y, m_width, m_height;
+
+	// Index of the next pixel to transfer
+	uint32_t m_index;
+};
+
 // Possible states for the GP0 command register
 enum Gp0Mode
 {
@@ -238,13 +295,22 @@ struct Gpu
 		m_displayLineTick(0x0),
 		m_hardwareType(hardwareType),
 		m_readWord(0x0)
-	{}
+	{
+		m_pacer.setHostRefreshRate(m_renderer.getHostRefreshRate());
+	}
 
 	// Return the number of GPU clock cycles in a line and number of
 	// lines in a frame (or field for interlaced output) depending on
 	// the configured video mode
 	std::pair<uint16_t, uint16_t> getVModeTimings() const;
 
+	// Return the number of fields per second for the current video mode
+	double getFieldRate() const;
+
+	FramePacer& getFramePacer() { return m_pacer; }
+
+	DisplayOut& getDisplayOut() { return m_renderer.getDisplayOut(); }
+
 	// Return the GPU to CPU clock ratio. The value is multiplied by
 	// CLOCK_RATIO_FRAC to get a precise fixed point value
 	FracCycles gpuToCpuClockRatio() const;
@@ -283,8 +349,9 @@ struct Gpu
 	// Retrieve value of the status register
 	uint32_t getStatusRegister() const;
 
-	// Retrieve value of the read register
-	uint32_t getReadRegister() const;
+	// Retrieve value of the read register. Pops the next two pixels
+	// when an image store is in progress.
+	uint32_t getReadRegister();
 
 	// Handle writes to the GP0 command register
 	void gp0(uint32_t value);
@@ -352,6 +419,9 @@ struct Gpu
 	// GP0(0x7c): Textured-blended opaque 16x16 rectangle
 	void gp0RectTextureBlendOpaque16x16();
 
+	// GP0(0x80): Copy rectangle (VRAM to VRAM)
+	void gp0CopyRect();
+
 	// GP0(0xa0): Image load
 	void gp0ImageLoad();
 
@@ -373,6 +443,17 @@ struct Gpu
 	// Called when the drawing area changes to notify the renderer
 	void updateDrawingArea();
 
+	// Return the part of the VRAM currently sent to the video output
+	DisplayArea getDisplayArea() const;
+
+	// Texture page, depth and CLUT of a textured primitive. 'clutAttribute'
+	// is the GP0 parameter holding the CLUT in its high 16 bits.
+	TextureKey getTextureKey(uint32_t clutAttribute) const;
+
+	// Textured polygons carry their own texture page attribute in the high
+	// 16 bits of 'pageAttribute', it replaces the one set by GP0(0xe1)
+	void setPolygonTexturePage(uint32_t pageAttribute);
+
 	// GP0(0xe5): Set drawing offset
 	void gp0DrawingOffset();
 
@@ -534,6 +615,9 @@ private:
 	// OpenGL renderer
 	Renderer m_renderer;
 
+	// Paces the emulation against the host clock
+	FramePacer m_pacer;
+
 	// True when the GP0 interrupt has been requested
 	bool m_gp0Interrupt;
 
@@ -559,4 +643,13 @@ private:
 
 	// Next word returned by the GPUREAD command
 	uint32_t m_readWord;
+
+	// Destination of the current image load
+	ImageTransfer m_imageLoad;
+
+	// Pixels received for the current image load
+	std::vector<uint16_t> m_imageLoadBuffer;
+
+	// Source of the current image store
+	ImageTransfer m_imageStore;
 };
@@ -18,6 +18,8 @@ Interconnect::Interconnect(Bios bios, HardwareType hardwareType, const Disc* dis
 	m_ramSize(0x0)
 {
 	memset(m_memControl, 0x0, sizeof(m_memControl));
+
+	m_spu->setCdInput(&m_cdRom->getAudioOutput());
 }
 
 template<typename T>
@@ -51,7 +53,7 @@ Instruction Interconnect::load(TimeKeeper& timeKeeper, uint32_t addr)
 
 	if (SPU.contains(targetPeripheralAddress, offset))
 	{
-		return Instruction(m_spu->load<T>(offset));
+		return Instruction(m_spu->load<T>(timeKeeper, *m_irqState, offset));
 	}
 
 	if (RAM_SIZE.contains(targetPeripheralAddress, offset))
@@ -213,7 +215,7 @@ void Interconnect::store(TimeKeeper& timeKeeper, uint32_t addr, T value)
 
 	if (DMA.contains(targetPeripheralAddress, offset))
 	{
-		setDmaRegister<T>(offset, value);
+		setDmaRegister<T>(timeKeeper, offset, value);
 		return;
 	}
 
@@ -243,7 +245,7 @@ void Interconnect::store(TimeKeeper& timeKeeper, uint32_t addr, T value)
 
 	if (SPU.contains(targetPeripheralAddress, offset))
 	{
-		m_spu->store<T>(offset, value);
+		m_spu->store<T>(timeKeeper, *m_irqState, offset, value);
 		return;
 	}
 
@@ -311,7 +313,7 @@ T Interconnect::getDmaRegister(uint32_t offset) const
 }
 
 template<typename T>
-void Interconnect::setDmaRegister(uint32_t offset, T value)
+void Interconnect::setDmaRegister(TimeKeeper& timeKeeper, uint32_t offset, T value)
 {
 	assert(("Unhandled DMA store", (std::is_same<uint32_t, T>::value)));
 
@@ -365,13 +367,13 @@ void Interconnect::setDmaRegister(uint32_t offset, T value)
 
 	if (activePort != (Port)-1)
 	{
-		doDma(activePort);
+		doDma(timeKeeper, activePort);
 	}
 
 	LOG("Unhandled DMA write 0x" << std::hex << offset << " 0x" << value);
 }
 
-void Interconnect::doDma(Port port)
+void Interconnect::doDma(TimeKeeper& timeKeeper, Port port)
 {
 	// DMA transfer has been started, for now let's process everything in one pass
 	// ( i.e. no chopping or priority handling )
@@ -382,12 +384,12 @@ void Interconnect::doDma(Port port)
 	}
 	else
 	{
-		doDmaBlock(port);
+		doDmaBlock(timeKeeper, port);
 	}
 	m_dma->done(port, *m_irqState);
 }
 
-void Interconnect::doDmaBlock(Port port)
+void Interconnect::doDmaBlock(TimeKeeper& timeKeeper, Port port)
 {
 	Channel& channel = m_dma->getDmaChannelRegisterMutable(port);
 
@@ -408,6 +410,38 @@ void Interconnect::doDmaBlock(Port port)
 	assert(("Couldn't figure out DMA block transfer size", channel.getSync() != Sync::SYNC_LINKED_LIST));
 
 	uint32_t transferSize = channel.getTransferSize();
+
+	// CD-ROM sectors are copied to RAM at once when the destination is
+	// contiguous
+	if (port == Port::PORT_CD_ROM && channel.getDirection() == Direction::DIRECTION_TO_RAM &&
+		channel.getStep() == Step::STEP_INCREMENT)
+	{
+		uint32_t start = addr & 0x1ffffc;
+		if ((uint64_t)start + (uint64_t)transferSize * 4 <= MAIN_RAM_SIZE)
+		{
+			m_cdRom->dmaRead(m_ram->m_data.data() + start, transferSize * 4);
+			return;
+		}
+	}
+
+	// Same for SPU RAM uploads and downloads
+	if (port == Port::PORT_SPU && channel.getStep() == Step::STEP_INCREMENT)
+	{
+		uint32_t start = addr & 0x1ffffc;
+		if ((uint64_t)start + (uint64_t)transferSize * 4 <= MAIN_RAM_SIZE)
+		{
+			if (channel.getDirection() == Direction::DIRECTION_FROM_RAM)
+			{
+				m_spu->dmaWrite(timeKeeper, *m_irqState, m_ram->m_data.data() + start, transferSize * 2);
+			}
+			else
+			{
+				m_spu->dmaRead(timeKeeper, *m_irqState, m_ram->m_data.data() + start, transferSize * 2);
+			}
+			return;
+		}
+	}
+
 	while (transferSize > 0)
 	{
 		// The two LSBs are ignored
@@ -430,8 +464,8 @@ void Interconnect::doDmaBlock(Port port)
 			}
 			else if (port == Port::PORT_SPU)
 			{
-				// Ignore transfers to the SPU for now
-				LOG("SPU port");
+				uint8_t bytes[4] = { (uint8_t)srcWord, (uint8_t)(srcWord >> 8), (uint8_t)(srcWord >> 16), (uint8_t)(srcWord >> 24) };
+				m_spu->dmaWrite(timeKeeper, *m_irqState, bytes, 2);
 			}
 			else
 			{
@@ -456,13 +490,19 @@ void Interconnect::doDmaBlock(Port port)
 			}
 			else if (port == Port::PORT_GPU)
 			{
-				LOG("DMA GPU READ");
-				srcWord = 0;
+				// VRAM to CPU transfer started by GP0(0xc0)
+				srcWord = m_gpu->getReadRegister();
 			}
 			else if (port == Port::PORT_CD_ROM)
 			{
 				srcWord = m_cdRom->dmaReadWord();
 			}
+			else if (port == Port::PORT_SPU)
+			{
+				uint8_t bytes[4];
+				m_spu->dmaRead(timeKeeper, *m_irqState, bytes, 2);
+				srcWord = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+			}
 			else
 			{
 				assert(("Unhandled DMA source port", false));
@@ -528,6 +568,10 @@ void Interconnect::sync(TimeKeeper& timeKeeper)
 	{
 		m_cdRom->sync(timeKeeper, *m_irqState);
 	}
+	if (timeKeeper.needsSync(Peripheral::PERIPHERAL_SPU))
+	{
+		m_spu->sync(timeKeeper, *m_irqState);
+	}
 }
 
 CacheControl Interconnect::getCacheControl() const
@@ -566,3 +610,23 @@ std::vector<Profile*> Interconnect::getPadProfiles()
 {
 	return m_padMemCard->getPadProfiles();
 }
+
+FramePacer& Interconnect::getFramePacer()
+{
+	return m_gpu->getFramePacer();
+}
+
+DisplayOut& Interconnect::getDisplayOut()
+{
+	return m_gpu->getDisplayOut();
+}
+
+CdRom& Interconnect::getCdRom()
+{
+	return *m_cdRom;
+}
+
+Spu& Interconnect::getSpu()
+{
+	return *m_spu;
+}
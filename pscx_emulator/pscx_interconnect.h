@@ -35,10 +35,10 @@ struct Interconnect
 	T getDmaRegister(uint32_t offset) const; // DMA register read
 
 	template<typename T>
-	void setDmaRegister(uint32_t offset, T value); // DMA register write
+	void setDmaRegister(TimeKeeper& timeKeeper, uint32_t offset, T value); // DMA register write
 
-	void doDma(Port port); // Execute DMA transfer for a port
-	void doDmaBlock(Port port);
+	void doDma(TimeKeeper& timeKeeper, Port port); // Execute DMA transfer for a port
+	void doDmaBlock(TimeKeeper& timeKeeper, Port port);
 	void doDmaLinkedList(Port port); // Emulate DMA transfer for linked list synchronization mode
 
 	void sync(TimeKeeper& timeKeeper);
@@ -52,6 +52,13 @@ struct Interconnect
 
 	std::vector<Profile*> getPadProfiles();
 
+	FramePacer& getFramePacer();
+
+	DisplayOut& getDisplayOut();
+
+	CdRom& getCdRom();
+	Spu& getSpu();
+
 private:
 	
 	InterruptState* m_irqState;
@@ -24,7 +24,10 @@ enum Interrupt
 	INTERRUPT_TIMER2 = 6,
 
 	// Gamepad and Memory Card controller interrupt
-	INTERRUPT_PAD_MEMCARD = 7
+	INTERRUPT_PAD_MEMCARD = 7,
+
+	// SPU reached the IRQ address
+	INTERRUPT_SPU = 9
 };
 
 struct InterruptState
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "pscx_lz.h"
+
+const size_t LZ_MIN_MATCH = 4;
+const uint32_t LZ_HASH_BITS = 14;
+
+static uint32_t read32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32_t hashSequence(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Write the extra bytes of a length which didn't fit in its nibble
+static bool writeLength(size_t length, uint8_t* dst, size_t& out, size_t capacity)
+{
+	for (; length >= 255; length -= 255)
+	{
+		if (out >= capacity) return false;
+		dst[out++] = 255;
+	}
+
+	if (out >= capacity) return false;
+	dst[out++] = (uint8_t)length;
+	return true;
+}
+
+// Emit the literals [literals, literals + literalCount) followed by a match,
+// or by nothing if 'matchLength' is 0
+static bool writeSequence(const uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength,
+						  uint8_t* dst, size_t& out, size_t capacity)
+{
+	if (out >= capacity) return false;
+	size_t tokenIndex = out++;
+
+	uint8_t token = (uint8_t)(std::min<size_t>(literalCount, 15) << 4);
+	if (literalCount >= 15 && !writeLength(literalCount - 15, dst, out, capacity))
+		return false;
+
+	if (literalCount > capacity - out) return false;
+	memcpy(dst + out, literals, literalCount);
+	out += literalCount;
+
+	if (matchLength > 0)
+	{
+		if (capacity - out < 2) return false;
+		dst[out++] = (uint8_t)offset;
+		dst[out++] = (uint8_t)(offset >> 8);
+
+		size_t length = matchLength - LZ_MIN_MATCH;
+		token |= (uint8_t)std::min<size_t>(length, 15);
+		if (length >= 15 && !writeLength(length - 15, dst, out, capacity))
+			return false;
+	}
+
+	dst[tokenIndex] = token;
+	return true;
+}
+
+size_t lzCompress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity)
+{
+	// Last position where each hashed sequence was seen, plus one so that
+	// 0 means empty
+	std::vector<uint32_t> table((size_t)1 << LZ_HASH_BITS, 0x0);
+
+	size_t out = 0;
+	size_t anchor = 0;
+	size_t pos = 0;
+
+	while (pos + LZ_MIN_MATCH <= size)
+	{
+		uint32_t sequence = read32(src + pos);
+		uint32_t& slot = table[hashSequence(sequence)];
+		size_t candidate = slot;
+		slot = (uint32_t)pos + 1;
+
+		if (candidate == 0 || pos - (candidate - 1) > LZ_MAX_OFFSET || read32(src + candidate - 1) != sequence)
+		{
+			pos += 1;
+			continue;
+		}
+		candidate -= 1;
+
+		size_t length = LZ_MIN_MATCH;
+		while (pos + length < size && src[candidate + length] == src[pos + length])
+			length += 1;
+
+		if (!writeSequence(src + anchor, pos - anchor, pos - candidate, length, dst, out, capacity))
+			return 0;
+
+		// Index the end of the match, the next sequence often starts there
+		size_t end = pos + length;
+		if (end >= 2 && end - 2 + LZ_MIN_MATCH <= size)
+			table[hashSequence(read32(src + end - 2))] = (uint32_t)(end - 2) + 1;
+
+		pos = end;
+		anchor = pos;
+	}
+
+	if (!writeSequence(src + anchor, size - anchor, 0, 0, dst, out, capacity))
+		return 0;
+
+	return out;
+}
+
+// Read the extra bytes of a length, false if the stream ends first
+static bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& length)
+{
+	uint8_t value;
+	do
+	{
+		if (ip >= end) return false;
+		value = *ip++;
+		length += value;
+	} while (value == 255);
+
+	return true;
+}
+
+bool lzDecompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize)
+{
+	const uint8_t* ip = src;
+	const uint8_t* end = src + size;
+	size_t out = 0;
+
+	while (ip < end)
+	{
+		uint8_t token = *ip++;
+
+		size_t literalCount = token >> 4;
+		if (literalCount == 15 && !readLength(ip, end, literalCount))
+			return false;
+
+		if (literalCount > (size_t)(end - ip) || literalCount > dstSize - out)
+			return false;
+
+		memcpy(dst + out, ip, literalCount);
+		ip += literalCount;
+		out += literalCount;
+
+		// The last sequence has no match
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return false;
+
+		size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+
+		size_t length = token & 0xf;
+		if (length == 15 && !readLength(ip, end, length))
+			return false;
+		length += LZ_MIN_MATCH;
+
+		if (offset == 0 || offset > out || length > dstSize - out)
+			return false;
+
+		uint8_t* op = dst + out;
+		const uint8_t* match = op - offset;
+		if (offset >= length)
+		{
+			memcpy(op, match, length);
+		}
+		else
+		{
+			// Overlapping match, e.g. a run of a repeated byte
+			for (size_t i = 0; i < length; ++i)
+				op[i] = match[i];
+		}
+		out += length;
+	}
+
+	return out == dstSize;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Byte oriented LZ77 codec used by the compressed disc images. The stream is
+// a list of sequences: a token ( literal count in the high nibble, match
+// length - 4 in the low one, 15 meaning more length bytes follow ), the
+// literals, then a 16 bit little endian match offset. The last sequence
+// only has literals. Decoding is a few branches and copies per sequence, so
+// a block is expanded much faster than the drive reads it.
+
+// Longest distance a match can refer to
+const size_t LZ_MAX_OFFSET = 0xffff;
+
+// Compress 'size' bytes at 'src' to 'dst'. Return the compressed size, or
+// 0 if it doesn't fit in 'capacity' bytes.
+size_t lzCompress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity);
+
+// Decompress 'size' bytes at 'src' to exactly 'dstSize' bytes at 'dst'.
+// Return false if the stream is corrupted, nothing is written out of bounds.
+bool lzDecompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize);
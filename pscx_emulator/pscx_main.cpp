@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -5,9 +7,12 @@
 
 #include "SDL.h"
 #include "SDL_events.h"
+#include "pscx_audio_sink.h"
 #include "pscx_bios.h"
+#include "pscx_capture.h"
 #include "pscx_cpu.h"
 #include "pscx_interconnect.h"
+#include "pscx_shared_ring.h"
 
 struct ArgSetParser
 {
@@ -28,11 +33,28 @@ static void printUsageAndExit(const char* argv0)
 {
 	std::cerr
 	<< "Usage  : " << argv0 << " <Path to BIOS BIN> [CDROM-bin-file] [options]\n"
+	<< "         " << argv0 << " --compress-disc <Path to disc BIN> <Output path>\n"
 	<< "App options:\n"
 	<< "  -h    | --help                        Print this usage message\n"
-	<< "  -disc | --disc-bin-path               Path to disc location\n"
+	<< "  -disc | --disc-bin-path               Path to the disc image: BIN, ISO, CUE sheet or compressed\n"
 	<< "  -dump | --dump-instructions-registers Dump instructions and registers to the file\n"
+	<< "  -pre  | --prescan-disc                Validate the disc sectors in the background\n"
+	<< "  -cds  | --cd-speed                    Multiply the CD-ROM data read speed by the given factor\n"
+	<< "  -csd  | --cd-seek-divider             Divide the CD-ROM seek times by the given value, 0 for instant seeks\n"
+	<< "  -cda  | --cd-deliver-on-ack           Deliver the next CD-ROM data sector once the previous one is acknowledged\n"
+	<< "  -sbs  | --spu-block-size              Number of SPU samples produced per sync, 32 to 256\n"
 	<< "  -rt   | --run-testing                 Compare output results with the golden file\n"
+	<< "  -ff   | --fast-forward                Run unthrottled, present at most once per host refresh\n"
+	<< "  -fs   | --frame-skip                  Skip presenting frames when the emulation falls behind\n"
+	<< "  -nrs  | --no-render-skipped           Don't render the frames which are not presented,\n"
+	<< "                                        breaks games which don't redraw every frame\n"
+	<< "  -cap  | --capture                     Record the video output to a .y4m or raw RGBA file\n"
+	<< "  -shm  | --shared-memory               Publish the frames in the named shared memory ring\n"
+	<< "  -shma | --shared-memory-audio         Publish the audio output in the shared memory ring too\n"
+	<< "  -na   | --no-audio                    Don't open the audio device\n"
+	<< "  -wav  | --wav-output                  Record the audio output to a WAV file\n"
+	<< "Keys:\n"
+	<< "  Tab                                   Toggle fast forward\n"
 	<< std::endl;
 
 	exit(1);
@@ -103,7 +125,8 @@ enum Action
 {
 	ACTION_NONE,
 	ACTION_QUIT,
-	ACTION_DEBUG
+	ACTION_DEBUG,
+	ACTION_TOGGLE_FAST_FORWARD
 };
 
 static SDL_GameController* initializeSDL2Controllers()
@@ -280,6 +303,8 @@ static Action handleEvents(SDL_Event& event, Cpu& cpu)
 				return Action::ACTION_QUIT;
 			case SDLK_PAUSE:
 				return Action::ACTION_DEBUG;
+			case SDLK_TAB:
+				return Action::ACTION_TOGGLE_FAST_FORWARD;
 			}
 			handleKeyboard(cpu.getPadProfiles()[0], keyCode, ButtonState::BUTTON_STATE_PRESSED);
 		}
@@ -317,14 +342,38 @@ int main(int argc, char** argv)
 	if (args.size() < 2)
 		printUsageAndExit(args[0].c_str());
 
+	// Convert a BIN image to the compressed format and exit
+	if (args[1] == "--compress-disc")
+	{
+		if (args.size() < 4)
+			printUsageAndExit(args[0].c_str());
+
+		if (!CompressedDiscImage::convert(args[2], args[3]))
+			return EXIT_FAILURE;
+
+		std::cout << "Compressed " << args[2] << " to " << args[3] << std::endl;
+		return EXIT_SUCCESS;
+	}
+
 	// Path to the BIOS
 	std::string biosPath = args[1];
 
 	bool discIsPresent                 = false;
 	bool dumpInstructionsAndRegsToFile = false;
 	bool runTesting                    = false;
+	bool prescanDisc                   = false;
+	bool renderSkippedFrames           = true;
+	bool audioEnabled                  = true;
+	bool sharedMemoryAudio             = false;
+
+	PacingMode pacingMode = PacingMode::PACING_MODE_REALTIME;
+	CdRomSpeedUp cdRomSpeedUp;
+	uint32_t spuBlockSize = SPU_DEFAULT_BLOCK_FRAMES;
 
 	std::string discPath;
+	std::string capturePath;
+	std::string sharedMemoryName;
+	std::string wavPath;
 
 	// Parse command line arguments
 	for (size_t i = 2; i < args.size(); ++i)
@@ -343,6 +392,45 @@ int main(int argc, char** argv)
 
 		if (args[i] == "-rt" || args[i] == "--run-testing")
 			runTesting = true;
+
+		if (args[i] == "-pre" || args[i] == "--prescan-disc")
+			prescanDisc = true;
+
+		if ((args[i] == "-cds" || args[i] == "--cd-speed") && i + 1 < args.size())
+			cdRomSpeedUp.m_readSpeedFactor = (uint32_t)std::max(1, std::atoi(args[i + 1].c_str()));
+
+		if ((args[i] == "-csd" || args[i] == "--cd-seek-divider") && i + 1 < args.size())
+			cdRomSpeedUp.m_seekDivider = (uint32_t)std::max(0, std::atoi(args[i + 1].c_str()));
+
+		if (args[i] == "-cda" || args[i] == "--cd-deliver-on-ack")
+			cdRomSpeedUp.m_deliverOnAck = true;
+
+		if ((args[i] == "-sbs" || args[i] == "--spu-block-size") && i + 1 < args.size())
+			spuBlockSize = (uint32_t)std::max(0, std::atoi(args[i + 1].c_str()));
+
+		if (args[i] == "-ff" || args[i] == "--fast-forward")
+			pacingMode = PacingMode::PACING_MODE_FAST_FORWARD;
+
+		if (args[i] == "-fs" || args[i] == "--frame-skip")
+			pacingMode = PacingMode::PACING_MODE_FRAME_SKIP;
+
+		if (args[i] == "-nrs" || args[i] == "--no-render-skipped")
+			renderSkippedFrames = false;
+
+		if ((args[i] == "-cap" || args[i] == "--capture") && i + 1 < args.size())
+			capturePath = args[i + 1];
+
+		if ((args[i] == "-shm" || args[i] == "--shared-memory") && i + 1 < args.size())
+			sharedMemoryName = args[i + 1];
+
+		if (args[i] == "-shma" || args[i] == "--shared-memory-audio")
+			sharedMemoryAudio = true;
+
+		if (args[i] == "-na" || args[i] == "--no-audio")
+			audioEnabled = false;
+
+		if ((args[i] == "-wav" || args[i] == "--wav-output") && i + 1 < args.size())
+			wavPath = args[i + 1];
 	}
 
 	Bios bios;
@@ -363,7 +451,7 @@ int main(int argc, char** argv)
 	HardwareType videoStandard(HardwareType::HARDWARE_TYPE_NTSC);
 	if (discIsPresent)
 	{
-		resultDisc = Disc::initializeFromPath(discPath);
+		resultDisc = Disc::initializeFromPath(discPath, prescanDisc);
 		if (resultDisc.m_status == Disc::DiscStatus::DISC_STATUS_OK)
 		{
 			Region region = resultDisc.m_disc->getRegion();
@@ -385,6 +473,37 @@ int main(int argc, char** argv)
 	Interconnect interconnect(bios, videoStandard, resultDisc.m_disc);
 	Cpu cpu(interconnect);
 
+	cpu.getCdRom().setSpeedUp(cdRomSpeedUp);
+	cpu.getSpu().setBlockSize(spuBlockSize);
+
+	FramePacer& pacer = cpu.getFramePacer();
+	pacer.setMode(pacingMode);
+	pacer.setRenderSkippedFields(renderSkippedFrames);
+
+	FrameCapture capture;
+	if (!capturePath.empty() && capture.start(capturePath, FrameCapture::formatFromPath(capturePath)))
+		cpu.getDisplayOut().addSink(&capture);
+
+	SharedFrameRing sharedRing;
+	if (!sharedMemoryName.empty() && sharedRing.open(sharedMemoryName, sharedMemoryAudio))
+		cpu.getDisplayOut().addSink(&sharedRing);
+
+	// Without a device the SPU output still goes somewhere, the null sink
+	AudioOut& audioOut = cpu.getSpu().getAudioOut();
+	SdlAudioSink audioSink;
+	NullAudioSink nullAudioSink;
+	if (audioEnabled && audioSink.open())
+		audioOut.addSink(&audioSink);
+	else
+		audioOut.addSink(&nullAudioSink);
+
+	WavFileSink wavSink;
+	if (!wavPath.empty() && wavSink.open(wavPath))
+		audioOut.addSink(&wavSink);
+
+	if (sharedRing.isOpen() && sharedMemoryAudio)
+		audioOut.addSink(&sharedRing);
+
 	SDL_GameController* gameController = initializeSDL2Controllers();
 
 	bool done = false;
@@ -399,11 +518,59 @@ int main(int argc, char** argv)
 		{
 		case Action::ACTION_QUIT:
 			done = true;
+			break;
+		case Action::ACTION_TOGGLE_FAST_FORWARD:
+			// Go back to the mode selected on the command line
+			if (pacer.getMode() == PacingMode::PACING_MODE_FAST_FORWARD)
+				pacer.setMode(pacingMode == PacingMode::PACING_MODE_FAST_FORWARD ? PacingMode::PACING_MODE_REALTIME : pacingMode);
+			else
+				pacer.setMode(PacingMode::PACING_MODE_FAST_FORWARD);
+			break;
 		}
 	}
 
 	//SDL_Quit();
 
+	if (sharedRing.isOpen())
+	{
+		cpu.getDisplayOut().removeSink(&sharedRing);
+		audioOut.removeSink(&sharedRing);
+		sharedRing.close();
+	}
+
+	if (wavSink.isOpen())
+	{
+		audioOut.removeSink(&wavSink);
+		wavSink.close();
+		std::cout << "Recorded " << wavSink.getWrittenCount() << " audio frames to " << wavPath << std::endl;
+	}
+
+	if (audioSink.isOpen())
+	{
+		audioOut.removeSink(&audioSink);
+		audioSink.close();
+		if (audioSink.getUnderrunCount() || audioSink.getDroppedCount())
+		{
+			std::cout << "Audio underruns " << audioSink.getUnderrunCount() << " frames, dropped "
+					  << audioSink.getDroppedCount() << " frames" << std::endl;
+		}
+	}
+
+	const SectorReadAhead& readAhead = cpu.getCdRom().getReadAhead();
+	if (readAhead.getHitCount() || readAhead.getMissCount())
+	{
+		std::cout << "CD-ROM read-ahead served " << readAhead.getHitCount() << " sectors, "
+				  << readAhead.getMissCount() << " read synchronously" << std::endl;
+	}
+
+	if (capture.isActive())
+	{
+		cpu.getDisplayOut().removeSink(&capture);
+		capture.stop();
+		std::cout << "Captured " << capture.getWrittenCount() << " frames to " << capturePath
+				  << ", " << capture.getDroppedCount() << " dropped" << std::endl;
+	}
+
 	if (dumpInstructionsAndRegsToFile)
 		generateDumpOutputFn(cpu);
 	if (runTesting)
@@ -62,6 +62,18 @@ MinuteSecondFrame MinuteSecondFrame::fromBCD(uint8_t minute, uint8_t second, uin
 	//return MinuteSecondFrame(fromBCD(minute), fromBCD(second), fromBCD(frame));
 }
 
+MinuteSecondFrame MinuteSecondFrame::fromSectorIndex(uint32_t sectorIndex)
+{
+	auto toBCD = [](uint32_t value) -> uint8_t { return (uint8_t)(((value / 10) << 4) | (value % 10)); };
+
+	uint32_t minute = sectorIndex / (60 * 75);
+	uint32_t second = (sectorIndex / 75) % 60;
+	uint32_t frame = sectorIndex % 75;
+
+	assert(("MSF overflow", minute < 100));
+	return MinuteSecondFrame(toBCD(minute), toBCD(second), toBCD(frame));
+}
+
 uint32_t MinuteSecondFrame::getSectorIndex() const
 {
 	auto fromBCD = [](uint8_t bcd) -> uint8_t { return (bcd >> 4) * 10 + (bcd & 0xf); };
@@ -17,6 +17,8 @@ struct MinuteSecondFrame
 	// Create a 00:00:00 MSF timestamp
 	static MinuteSecondFrame createZeroTimestamp();
 	static MinuteSecondFrame fromBCD(uint8_t minute, uint8_t second, uint8_t frame);
+	// Inverse of getSectorIndex
+	static MinuteSecondFrame fromSectorIndex(uint32_t sectorIndex);
 
 	// Convert an MSF coordinate into a sector index. In this convention
 	// sector 0 is 00:00:00 ( i.e. before track 01's pregap ).
@@ -0,0 +1,169 @@
+#include <thread>
+
+#include "pscx_pacer.h"
+
+// Never skip more than this many fields in a row in frame skip mode
+const uint32_t PACER_MAX_CONSECUTIVE_SKIPS = 4;
+
+// When the emulator is this late, give up on catching up and restart
+// pacing from the current time
+const std::chrono::milliseconds PACER_MAX_LAG(250);
+
+// Below this, sleeping is too imprecise and the pacer yields instead
+const std::chrono::milliseconds PACER_SPIN_THRESHOLD(2);
+
+static std::chrono::steady_clock::duration periodFromRate(double hz)
+{
+	std::chrono::duration<double> seconds(1.0 / hz);
+	return std::chrono::duration_cast<std::chrono::steady_clock::duration>(seconds);
+}
+
+FramePacer::FramePacer() :
+	m_mode(PacingMode::PACING_MODE_REALTIME),
+	m_fieldPeriod(periodFromRate(59.94)),
+	m_hostRefreshPeriod(periodFromRate(60.0)),
+	m_averageFieldDuration(0x0),
+	m_started(false),
+	m_renderSkippedFields(true),
+	m_renderNextField(true),
+	m_consecutiveSkips(0x0),
+	m_presentedCount(0x0),
+	m_skippedCount(0x0)
+{
+}
+
+void FramePacer::setMode(PacingMode mode)
+{
+	m_mode = mode;
+
+	// Restart pacing from now, the emulator shouldn't rush to catch up
+	// the time spent in another mode
+	m_started = false;
+	m_renderNextField = true;
+}
+
+void FramePacer::setFieldRate(double hz)
+{
+	if (hz > 0.0)
+	{
+		m_fieldPeriod = periodFromRate(hz);
+	}
+}
+
+void FramePacer::setHostRefreshRate(double hz)
+{
+	if (hz > 0.0)
+	{
+		m_hostRefreshPeriod = periodFromRate(hz);
+	}
+}
+
+bool FramePacer::isBehind(Clock::time_point now) const
+{
+	return now > m_fieldDeadline + m_fieldPeriod;
+}
+
+bool FramePacer::endField()
+{
+	Clock::time_point now = Clock::now();
+
+	// The field which just ended was drawn only if it was predicted to be
+	// presented
+	bool fieldRendered = m_renderNextField;
+
+	if (!m_started)
+	{
+		m_fieldDeadline = now;
+		m_lastPresent = now - m_hostRefreshPeriod;
+		m_lastFieldEnd = now;
+		m_started = true;
+	}
+
+	// Smooth the field duration over ~8 fields
+	m_averageFieldDuration += ((now - m_lastFieldEnd) - m_averageFieldDuration) / 8;
+	m_lastFieldEnd = now;
+
+	m_fieldDeadline += m_fieldPeriod;
+
+	bool present = true;
+	switch (m_mode)
+	{
+	case PacingMode::PACING_MODE_REALTIME:
+	case PacingMode::PACING_MODE_FRAME_SKIP:
+	{
+		if (now < m_fieldDeadline)
+		{
+			waitUntil(m_fieldDeadline);
+			now = Clock::now();
+		}
+		else if (now > m_fieldDeadline + PACER_MAX_LAG)
+		{
+			m_fieldDeadline = now;
+		}
+		else if (m_mode == PacingMode::PACING_MODE_FRAME_SKIP && isBehind(now))
+		{
+			present = m_consecutiveSkips >= PACER_MAX_CONSECUTIVE_SKIPS;
+		}
+		break;
+	}
+	case PacingMode::PACING_MODE_FAST_FORWARD:
+	{
+		// Keep the deadline on the wall clock so that going back to real
+		// time doesn't try to catch up
+		m_fieldDeadline = now;
+		present = (now - m_lastPresent) >= m_hostRefreshPeriod;
+		break;
+	}
+	}
+
+	// A field drawn without its primitives is incomplete, never show it
+	if (!fieldRendered)
+	{
+		present = false;
+	}
+
+	if (present)
+	{
+		m_lastPresent = now;
+		m_consecutiveSkips = 0x0;
+		m_presentedCount += 1;
+	}
+	else
+	{
+		m_consecutiveSkips += 1;
+		m_skippedCount += 1;
+	}
+
+	// Predict whether the next field will be presented
+	m_renderNextField = true;
+	if (!m_renderSkippedFields)
+	{
+		switch (m_mode)
+		{
+		case PacingMode::PACING_MODE_FAST_FORWARD:
+			m_renderNextField = (now + m_averageFieldDuration - m_lastPresent) >= m_hostRefreshPeriod;
+			break;
+		case PacingMode::PACING_MODE_FRAME_SKIP:
+			m_renderNextField = !isBehind(Clock::now()) || m_consecutiveSkips + 1 >= PACER_MAX_CONSECUTIVE_SKIPS;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return present;
+}
+
+void FramePacer::waitUntil(Clock::time_point deadline)
+{
+	Clock::time_point now = Clock::now();
+	if (deadline - now > PACER_SPIN_THRESHOLD)
+	{
+		std::this_thread::sleep_for(deadline - now - PACER_SPIN_THRESHOLD);
+	}
+
+	while (Clock::now() < deadline)
+	{
+		std::this_thread::yield();
+	}
+}
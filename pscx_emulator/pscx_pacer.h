@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// How the emulated fields are paced against the host clock
+enum PacingMode
+{
+	// Locked to the NTSC or PAL field rate
+	PACING_MODE_REALTIME,
+
+	// Run as fast as possible, presenting at most once per host refresh
+	PACING_MODE_FAST_FORWARD,
+
+	// Real time, but stop presenting fields while the emulator is behind
+	PACING_MODE_FRAME_SKIP
+};
+
+// Decides, at the end of each emulated field, whether to wait for the host
+// clock and whether the field must be presented
+struct FramePacer
+{
+	FramePacer();
+
+	void setMode(PacingMode mode);
+	PacingMode getMode() const { return m_mode; }
+
+	// Emulated field rate in Hz, depends on the video mode
+	void setFieldRate(double hz);
+
+	// Refresh rate of the host display, fast forward doesn't present faster
+	void setHostRefreshRate(double hz);
+
+	// When false, the primitives of the fields which won't be presented
+	// are dropped in fast forward and frame skip modes. VRAM then misses
+	// whatever these fields drew: games which don't redraw everything
+	// every frame, or read VRAM back, break.
+	void setRenderSkippedFields(bool render) { m_renderSkippedFields = render; }
+
+	// Called at the end of each emulated field. Sleeps if the emulator is
+	// ahead of real time and returns true if the field must be presented.
+	// Fields drawn with the primitives dropped are never presented.
+	bool endField();
+
+	// Return false if the next field can be skipped entirely, it's not
+	// going to be presented
+	bool shouldRenderNextField() const { return m_renderNextField; }
+
+	uint32_t getPresentedCount() const { return m_presentedCount; }
+	uint32_t getSkippedCount() const { return m_skippedCount; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	// Sleep until 'deadline', spinning for the last couple of milliseconds
+	// since the host sleep granularity can be coarse
+	void waitUntil(Clock::time_point deadline);
+
+	// True if the emulator is more than a field behind real time
+	bool isBehind(Clock::time_point now) const;
+
+	PacingMode m_mode;
+
+	Clock::duration m_fieldPeriod;
+	Clock::duration m_hostRefreshPeriod;
+
+	// Real time at which the current emulated field should end
+	Clock::time_point m_fieldDeadline;
+
+	// Time of the last presented field and of the end of the previous field
+	Clock::time_point m_lastPresent;
+	Clock::time_point m_lastFieldEnd;
+
+	// Smoothed host time taken to emulate a field
+	Clock::duration m_averageFieldDuration;
+
+	bool m_started;
+	bool m_renderSkippedFields;
+	bool m_renderNextField;
+
+	// Fields skipped in a row, bounded so that the display still updates
+	uint32_t m_consecutiveSkips;
+
+	uint32_t m_presentedCount;
+	uint32_t m_skippedCount;
+};
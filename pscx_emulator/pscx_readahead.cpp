@@ -0,0 +1,145 @@
+#include "pscx_readahead.h"
+
+// ********************** SectorReadAhead implementation **********************
+SectorReadAhead::SectorReadAhead() :
+	m_disc(nullptr),
+	m_stopping(false),
+	m_active(false),
+	m_ringHead(0x0),
+	m_ringCount(0x0),
+	m_fillPosition(MinuteSecondFrame::createZeroTimestamp()),
+	m_generation(0x0),
+	m_hitCount(0x0),
+	m_missCount(0x0)
+{
+}
+
+SectorReadAhead::~SectorReadAhead()
+{
+	stop();
+}
+
+void SectorReadAhead::start(Disc* disc)
+{
+	stop();
+
+	m_disc = disc;
+	m_stopping = false;
+	m_active = false;
+	m_worker = std::thread(&SectorReadAhead::workerLoop, this);
+}
+
+void SectorReadAhead::stop()
+{
+	if (!m_worker.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wake.notify_one();
+	m_worker.join();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	restart(MinuteSecondFrame::createZeroTimestamp());
+	m_active = false;
+}
+
+void SectorReadAhead::restart(const MinuteSecondFrame& position)
+{
+	// Give the buffers back to the pool
+	for (uint8_t i = 0; i < m_ringCount; ++i)
+	{
+		m_ring[(m_ringHead + i) % READ_AHEAD_SECTORS].m_sector.reset();
+	}
+	m_ringHead = 0x0;
+	m_ringCount = 0x0;
+
+	m_fillPosition = position;
+	m_generation += 1;
+	m_active = true;
+}
+
+void SectorReadAhead::seek(const MinuteSecondFrame& position)
+{
+	if (!m_worker.joinable()) return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// The ring might already start there, e.g. ReadN right after SeekL
+		if (m_active && m_ringCount > 0 &&
+			m_ring[m_ringHead].m_sectorIndex == position.getSectorIndex())
+			return;
+
+		restart(position);
+	}
+	m_wake.notify_one();
+}
+
+XaSector::ResultXaSector SectorReadAhead::take(const MinuteSecondFrame& position)
+{
+	if (!m_worker.joinable())
+		return m_disc->readDriveSector(position);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_ringCount > 0 && m_ring[m_ringHead].m_sectorIndex == position.getSectorIndex())
+		{
+			Entry& entry = m_ring[m_ringHead];
+			m_ringHead = (m_ringHead + 1) % READ_AHEAD_SECTORS;
+			m_ringCount -= 1;
+			m_hitCount += 1;
+
+			XaSector::ResultXaSector result(std::move(entry.m_sector), entry.m_status);
+			m_wake.notify_one();
+			return result;
+		}
+
+		// Not there yet, or the drive went somewhere else: the worker
+		// continues after the sector we're about to read
+		m_missCount += 1;
+		restart(position.getNextSector());
+	}
+	m_wake.notify_one();
+
+	// Waits at most for the sector the worker is reading
+	std::lock_guard<std::mutex> discLock(m_discMutex);
+	return m_disc->readDriveSector(position);
+}
+
+void SectorReadAhead::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		m_wake.wait(lock, [this] { return m_stopping || (m_active && m_ringCount < READ_AHEAD_SECTORS); });
+
+		if (m_stopping) break;
+
+		MinuteSecondFrame position = m_fillPosition;
+		uint32_t generation = m_generation;
+
+		lock.unlock();
+
+		XaSector::ResultXaSector result(XaSector::XaSectorStatus::XA_SECTOR_STATUS_INVALID_INPUT);
+		{
+			std::lock_guard<std::mutex> discLock(m_discMutex);
+			result = m_disc->readDriveSector(position);
+		}
+
+		lock.lock();
+
+		// The drive moved while we were reading, the sector is dropped
+		// when 'result' goes out of scope
+		if (generation != m_generation) continue;
+
+		Entry& entry = m_ring[(m_ringHead + m_ringCount) % READ_AHEAD_SECTORS];
+		entry.m_sectorIndex = position.getSectorIndex();
+		entry.m_status = result.getSectorStatus();
+		entry.m_sector = result.takeSector();
+		m_ringCount += 1;
+
+		m_fillPosition = position.getNextSector();
+	}
+}
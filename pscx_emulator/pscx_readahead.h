@@ -0,0 +1,86 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "pscx_disc.h"
+
+// Number of sectors read in advance. Two sector buffers are left in the
+// pool: the one in the controller's RX buffer and the one being read.
+const uint8_t READ_AHEAD_SECTORS = SECTOR_POOL_SIZE - 2;
+
+// Worker thread reading and validating the sectors following the drive's
+// read position, so that the emulation thread doesn't block on the disc
+// image I/O when a sector is ready
+struct SectorReadAhead
+{
+	SectorReadAhead();
+	~SectorReadAhead();
+
+	// Start the worker thread on 'disc'
+	void start(Disc* disc);
+	void stop();
+
+	// The drive moved to 'position', drop the sectors read so far and
+	// start reading from there
+	void seek(const MinuteSecondFrame& position);
+
+	// Return the sector at 'position', read like Disc::readDriveSector.
+	// Read synchronously if the worker didn't get to it yet or if it isn't
+	// the next one in the ring.
+	XaSector::ResultXaSector take(const MinuteSecondFrame& position);
+
+	// Sectors served from the ring
+	uint32_t getHitCount() const { return m_hitCount; }
+
+	// Sectors which had to be read synchronously
+	uint32_t getMissCount() const { return m_missCount; }
+
+private:
+	void workerLoop();
+
+	// Drop the ring contents and restart the worker from 'position'.
+	// m_mutex must be held.
+	void restart(const MinuteSecondFrame& position);
+
+	struct Entry
+	{
+		Entry() :
+			m_sectorIndex(0x0),
+			m_status(XaSector::XaSectorStatus::XA_SECTOR_STATUS_INVALID_INPUT)
+		{}
+
+		uint32_t m_sectorIndex;
+		XaSector::XaSectorStatus m_status;
+		PooledSector m_sector;
+	};
+
+	Disc* m_disc;
+
+	// Serializes the accesses to m_disc, the worker holds it while reading
+	std::mutex m_discMutex;
+
+	// Protects everything below
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::thread m_worker;
+	bool m_stopping;
+
+	// False until the first seek, there's nothing to read before
+	bool m_active;
+
+	// Ring of sectors ready to be taken, in disc order
+	Entry m_ring[READ_AHEAD_SECTORS];
+	uint8_t m_ringHead;
+	uint8_t m_ringCount;
+
+	// Next sector the worker will read
+	MinuteSecondFrame m_fillPosition;
+
+	// Incremented on each restart, a read started before is thrown away
+	uint32_t m_generation;
+
+	uint32_t m_hitCount;
+	uint32_t m_missCount;
+};
@@ -1,8 +1,10 @@
 #include "pscx_renderer.h"
 #include "pscx_common.h"
+#include "pscx_simd.h"
 
 #include <string>
 #include <fstream>
+#include <algorithm>
 
 static char* loadShaderSource(const std::string& filename)
 {
@@ -42,6 +44,9 @@ Renderer::Renderer()
 	gladLoadGL();
 
 	SDL_GL_MakeCurrent(m_window, m_glContext);
+
+	// The frame pacer takes care of the timing, swaps must not block
+	SDL_GL_SetSwapInterval(0);
 	
 	//glViewport(0, 0, 320, 240);
 
@@ -49,6 +54,67 @@ Renderer::Renderer()
 	glClearColor(0, 0, 0, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	// The VRAM is stored in a texture using the native 1555 pixel format,
+	// this way it can be uploaded and read back without any conversion.
+	// Line 0 of the VRAM is stored at the bottom of the texture.
+	glGenTextures(1, &m_vramTexture);
+	glBindTexture(GL_TEXTURE_2D, m_vramTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB5_A1, VRAM_WIDTH, VRAM_HEIGHT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	// All the primitives are rendered into the VRAM texture
+	glGenFramebuffers(1, &m_framebufferObject);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebufferObject);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_vramTexture, 0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		WARN("Incomplete VRAM framebuffer");
+	}
+
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glGenTextures(1, &m_copyTexture);
+	glBindTexture(GL_TEXTURE_2D, m_copyTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB5_A1, VRAM_WIDTH, VRAM_HEIGHT);
+
+	// The blending source is refreshed from the VRAM on first use
+	glGenTextures(1, &m_blendTexture);
+	glBindTexture(GL_TEXTURE_2D, m_blendTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB5_A1, VRAM_WIDTH, VRAM_HEIGHT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	m_blendSourceDirty.markAll();
+
+	glGenTextures(1, &m_displayTexture);
+	glBindTexture(GL_TEXTURE_2D, m_displayTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, DISPLAY_MAX_WIDTH, DISPLAY_MAX_HEIGHT);
+
+	glGenFramebuffers(1, &m_displayFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_displayFramebuffer);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_displayTexture, 0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebufferObject);
+
+	// The shadow VRAM matches the cleared texture
+	m_vramShadow.resize(VRAM_WIDTH * VRAM_HEIGHT, 0x0);
+
+	// Readback buffer, large enough to hold the whole VRAM
+	glGenBuffers(1, &m_readbackBuffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readbackBuffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, VRAM_WIDTH * VRAM_HEIGHT * sizeof(uint16_t), nullptr, GL_STREAM_READ);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	m_readbackRectCount = 0x0;
+	m_readbackFence = nullptr;
+
+	// Texture lines are tightly packed 16 bit pixels
+	glPixelStorei(GL_PACK_ALIGNMENT, 2);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+
 	glEnable(GL_SCISSOR_TEST);
 	glScissor(0x0, 0x0, (GLint)m_framebufferXResolution, (GLint)m_framebufferYResolution);
 
@@ -66,8 +132,9 @@ Renderer::Renderer()
 	// Link program
 	m_program = linkProgram(shaders);
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	// Semi-transparency is implemented in the fragment shader, the four
+	// PlayStation modes can't be expressed with a single blend equation
+	glDisable(GL_BLEND);
 
 	glUseProgram(m_program);
 
@@ -91,18 +158,70 @@ Renderer::Renderer()
 		glVertexAttribPointer(index, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, m_color));
 	}
 
-	// Setup "alpha" attribute
+	// Setup "blend_mode" attribute
+	{
+		GLuint index = glGetAttribLocation(m_program, "vertex_blend_mode");
+		glEnableVertexAttribArray(index);
+		glVertexAttribIPointer(index, 1, GL_UNSIGNED_BYTE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, m_blendMode));
+	}
+
+	// Setup the "texcoord" attribute
+	{
+		GLuint index = glGetAttribLocation(m_program, "vertex_texcoord");
+		glEnableVertexAttribArray(index);
+		glVertexAttribPointer(index, 2, GL_SHORT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, m_texCoord));
+	}
+
+	// Setup the "texture_layer" attribute
+	{
+		GLuint index = glGetAttribLocation(m_program, "vertex_texture_layer");
+		glEnableVertexAttribArray(index);
+		glVertexAttribIPointer(index, 1, GL_SHORT, sizeof(Vertex), (GLvoid*)offsetof(Vertex, m_textureLayer));
+	}
+
+	// Setup the "texture_mode" attribute
 	{
-		GLuint index = glGetAttribLocation(m_program, "alpha");
+		GLuint index = glGetAttribLocation(m_program, "vertex_texture_mode");
 		glEnableVertexAttribArray(index);
-		glVertexAttribPointer(index, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, m_alpha));
+		glVertexAttribIPointer(index, 1, GL_UNSIGNED_BYTE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, m_textureMode));
 	}
 
 	// Retrieve and initialize the draw offset
 	m_uniformOffset = glGetUniformLocation(m_program, "offset");
 	glUniform2i(m_uniformOffset, 0, 0);
 
+	// Decoded texture pages are sampled from texture unit 0
+	m_textureCache.OnCreate();
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_textureCache.getTexture());
+	glUniform1i(glGetUniformLocation(m_program, "textures"), 0);
+
+	// The blending source is sampled from texture unit 1
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, m_blendTexture);
+	glUniform1i(glGetUniformLocation(m_program, "blend_source"), 1);
+	glActiveTexture(GL_TEXTURE0);
+
+	// No texture window: AND mask 0xff, OR value 0
+	m_uniformTextureWindow = glGetUniformLocation(m_program, "texture_window");
+	glUniform4i(m_uniformTextureWindow, 0xff, 0xff, 0x0, 0x0);
+	m_textureWindow = 0x0;
+
+	m_drawOffsetX = 0x0;
+	m_drawOffsetY = 0x0;
+	m_drawingArea = VramRect(0x0, 0x0, VRAM_WIDTH, VRAM_HEIGHT);
+	m_drawingEnabled = true;
+
+	m_displayDirty.markAll();
+	m_staticFields = 0x0;
+	m_displayStarted = false;
+	m_displayPending = false;
+	m_presentedFrame = 0x0;
+	m_windowStale = true;
+
 	m_numOfVertices = 0x0;
+	m_firstVertex = 0x0;
+	m_batch = 0x1;
 }
 
 Renderer::~Renderer()
@@ -173,6 +292,18 @@ GLuint Renderer::linkProgram(GLuint shaders[])
 
 void Renderer::drop()
 {
+	if (m_readbackFence)
+	{
+		glDeleteSync(m_readbackFence);
+	}
+	glDeleteBuffers(1, &m_readbackBuffer);
+	glDeleteFramebuffers(1, &m_displayFramebuffer);
+	glDeleteTextures(1, &m_displayTexture);
+	glDeleteFramebuffers(1, &m_framebufferObject);
+	m_textureCache.drop();
+	glDeleteTextures(1, &m_blendTexture);
+	glDeleteTextures(1, &m_copyTexture);
+	glDeleteTextures(1, &m_vramTexture);
 	glDeleteVertexArrays(1, &m_vertexArrayObject);
 	glDeleteShader(m_vertexShader);
 	glDeleteShader(m_fragmentShader);
@@ -181,24 +312,246 @@ void Renderer::drop()
 
 void Renderer::pushTriangle(Vertex vertices[])
 {
-	// Make sure we have enough room left to queue the vertex
-	if (m_numOfVertices + 3 > VERTEX_BUFFER_LEN)
+	pushPrimitive(vertices, 3);
+}
+
+void Renderer::pushQuad(Vertex vertices[])
+{
+	pushPrimitive(vertices, 4);
+}
+
+VramRect Renderer::cullTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2)
+{
+	int32_t left, top, right, bottom;
+
+#if PSCX_SSE2
+	// x and y of the three vertices interleaved, the first vertex is
+	// repeated in the last lane
+	__m128i positions = _mm_setr_epi16(v0.m_position.getX(), v0.m_position.getY(),
+									   v1.m_position.getX(), v1.m_position.getY(),
+									   v2.m_position.getX(), v2.m_position.getY(),
+									   v0.m_position.getX(), v0.m_position.getY());
+
+	// Reduce the 32 bit (x, y) lanes, the result ends up in every lane
+	__m128i minimum = _mm_min_epi16(positions, _mm_shuffle_epi32(positions, _MM_SHUFFLE(1, 0, 3, 2)));
+	minimum = _mm_min_epi16(minimum, _mm_shuffle_epi32(minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+	__m128i maximum = _mm_max_epi16(positions, _mm_shuffle_epi32(positions, _MM_SHUFFLE(1, 0, 3, 2)));
+	maximum = _mm_max_epi16(maximum, _mm_shuffle_epi32(maximum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	// Low 16 bits are x, high 16 bits are y
+	int32_t minimumXY = _mm_cvtsi128_si32(minimum);
+	int32_t maximumXY = _mm_cvtsi128_si32(maximum);
+
+	left = (int16_t)minimumXY;
+	top = (int16_t)(minimumXY >> 16);
+	right = (int16_t)maximumXY;
+	bottom = (int16_t)(maximumXY >> 16);
+#else
+	left = std::min({ v0.m_position.getX(), v1.m_position.getX(), v2.m_position.getX() });
+	top = std::min({ v0.m_position.getY(), v1.m_position.getY(), v2.m_position.getY() });
+	right = std::max({ v0.m_position.getX(), v1.m_position.getX(), v2.m_position.getX() });
+	bottom = std::max({ v0.m_position.getY(), v1.m_position.getY(), v2.m_position.getY() });
+#endif
+
+	// The GPU skips the triangles with a horizontal distance between two
+	// vertices above 1023 or a vertical one above 511
+	if (right - left > 1023 || bottom - top > 511)
+	{
+		m_cullStats.m_oversize += 1;
+		return VramRect();
+	}
+
+	// Apply the drawing offset and clip to the drawing area. Bounds become exclusive.
+	left = std::max(left + m_drawOffsetX, (int32_t)m_drawingArea.m_left);
+	top = std::max(top + m_drawOffsetY, (int32_t)m_drawingArea.m_top);
+	right = std::min(right + m_drawOffsetX + 1, (int32_t)m_drawingArea.m_right);
+	bottom = std::min(bottom + m_drawOffsetY + 1, (int32_t)m_drawingArea.m_bottom);
+
+	if (left >= right || top >= bottom)
+	{
+		m_cullStats.m_outside += 1;
+		return VramRect();
+	}
+
+	m_cullStats.m_drawn += 1;
+	return VramRect((uint16_t)left, (uint16_t)top, (uint16_t)right, (uint16_t)bottom);
+}
+
+void Renderer::pushPrimitive(const Vertex vertices[], size_t count)
+{
+	if (!m_drawingEnabled) return;
+
+	// Quads are drawn as two triangles sharing the v1-v2 edge, the GPU
+	// culls each of them separately
+	VramRect rects[2];
+	rects[0] = cullTriangle(vertices[0], vertices[1], vertices[2]);
+	if (count == 4)
+	{
+		rects[1] = cullTriangle(vertices[1], vertices[2], vertices[3]);
+	}
+
+	if (rects[0].isEmpty() && rects[1].isEmpty()) return;
+
+	// Make sure we have enough room left to queue the vertices
+	if (m_numOfVertices + 6 > VERTEX_BUFFER_LEN)
 		draw();
-	
-	for (size_t i = 0; i < 3; ++i)
+
+	// Area covered by the whole primitive
+	VramRect rect = rects[0].isEmpty() ? rects[1] : rects[0];
+	if (!rects[1].isEmpty())
 	{
-		m_vertices.set(m_numOfVertices, vertices[i]);
-		m_numOfVertices += 1;
+		rect.m_left = std::min(rect.m_left, rects[1].m_left);
+		rect.m_top = std::min(rect.m_top, rects[1].m_top);
+		rect.m_right = std::max(rect.m_right, rects[1].m_right);
+		rect.m_bottom = std::max(rect.m_bottom, rects[1].m_bottom);
 	}
+
+	// A semi-transparent primitive reads the pixels it covers. If some of
+	// them have been written since the blending source was updated, the
+	// buffered primitives are submitted and the source refreshed. Mode
+	// changes alone never split the batch.
+	if (vertices[0].m_blendMode != BlendMode::BLEND_MODE_OPAQUE && m_blendSourceDirty.any(rect))
+	{
+		submitVertices();
+		refreshBlendSource(rect);
+	}
+
+	for (size_t i = 0; i < 2; ++i)
+	{
+		if (rects[i].isEmpty()) continue;
+
+		for (size_t j = 0; j < 3; ++j)
+		{
+			m_vertices.set(m_numOfVertices, vertices[i + j]);
+			m_numOfVertices += 1;
+		}
+	}
+
+	markVramWritten(rect);
 }
 
-void Renderer::pushQuad(Vertex vertices[])
+void Renderer::markVramWritten(const VramRect& rect)
 {
-	// Push first triangle
+	m_shadowStale.mark(rect);
+	m_blendSourceDirty.mark(rect);
+	m_displayDirty.mark(rect);
+	m_textureCache.invalidate(rect);
+}
+
+void Renderer::refreshBlendSource(const VramRect& rect)
+{
+	// Copy whole tiles so that they can be flagged clean
+	uint16_t left = rect.m_left & ~(VRAM_TILE_SIZE - 1);
+	uint16_t top = rect.m_top & ~(VRAM_TILE_SIZE - 1);
+	uint16_t right = (rect.m_right + VRAM_TILE_SIZE - 1) & ~(VRAM_TILE_SIZE - 1);
+	uint16_t bottom = (rect.m_bottom + VRAM_TILE_SIZE - 1) & ~(VRAM_TILE_SIZE - 1);
+
+	glCopyImageSubData(m_vramTexture, GL_TEXTURE_2D, 0, left, top, 0,
+					   m_blendTexture, GL_TEXTURE_2D, 0, left, top, 0,
+					   right - left, bottom - top, 1);
+
+	m_blendSourceDirty.clearCovered(VramRect(left, top, right, bottom));
+}
+
+void Renderer::pushTexturedTriangle(Vertex vertices[], const TextureKey& key, TextureMode mode)
+{
+	if (!m_drawingEnabled) return;
+
+	GLshort layer = getTextureLayer(key);
+
+	for (size_t i = 0; i < 3; ++i)
+	{
+		vertices[i].m_textureLayer = layer;
+		vertices[i].m_textureMode = mode;
+	}
+
 	pushTriangle(vertices);
+}
+
+void Renderer::pushTexturedQuad(Vertex vertices[], const TextureKey& key, TextureMode mode)
+{
+	if (!m_drawingEnabled) return;
+
+	GLshort layer = getTextureLayer(key);
+
+	for (size_t i = 0; i < 4; ++i)
+	{
+		vertices[i].m_textureLayer = layer;
+		vertices[i].m_textureMode = mode;
+	}
+
+	pushQuad(vertices);
+}
 
-	// Push second triangle
-	pushTriangle(vertices + 1);
+GLshort Renderer::getTextureLayer(const TextureKey& key)
+{
+	GLint layer = m_textureCache.find(key, m_batch);
+	if (layer >= 0) return (GLshort)layer;
+
+	// Cache miss, the page is decoded from the shadow VRAM which must
+	// contain whatever has been rendered there
+	VramRect rects[4];
+	uint8_t count = key.getPageRects(rects);
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		syncShadow(rects[i]);
+	}
+	syncShadow(key.getClutRect());
+
+	bool pendingBatch = false;
+	layer = m_textureCache.allocate(m_batch, pendingBatch);
+	if (pendingBatch)
+	{
+		// The evicted page is still sampled by buffered primitives. Once
+		// they're submitted GL orders the texture update after them.
+		submitVertices();
+	}
+
+	m_textureCache.decode(layer, key, m_vramShadow.data(), m_batch);
+	return (GLshort)layer;
+}
+
+void Renderer::syncShadow(const VramRect& rect)
+{
+	// The tiles of a readback in flight are already flagged up to date
+	for (uint8_t i = 0; i < m_readbackRectCount; ++i)
+	{
+		if (m_readbackRects[i].overlaps(rect))
+		{
+			completeReadback();
+			break;
+		}
+	}
+
+	if (!m_shadowStale.any(rect)) return;
+
+	// Read back whole tiles so that they can be flagged up to date
+	uint16_t left = rect.m_left & ~(VRAM_TILE_SIZE - 1);
+	uint16_t top = rect.m_top & ~(VRAM_TILE_SIZE - 1);
+	uint16_t right = (rect.m_right + VRAM_TILE_SIZE - 1) & ~(VRAM_TILE_SIZE - 1);
+	uint16_t bottom = (rect.m_bottom + VRAM_TILE_SIZE - 1) & ~(VRAM_TILE_SIZE - 1);
+
+	readbackVram(left, top, right - left, bottom - top);
+	if (m_readbackFence)
+	{
+		completeReadback();
+	}
+}
+
+void Renderer::setTextureWindow(uint8_t maskX, uint8_t maskY, uint8_t offsetX, uint8_t offsetY)
+{
+	uint32_t textureWindow = maskX | (maskY << 8) | (offsetX << 16) | (offsetY << 24);
+	if (textureWindow == m_textureWindow) return;
+
+	// Force draw for the primitives with the current window
+	draw();
+
+	// Texel coordinates become (coord & ~(mask * 8)) | ((offset & mask) * 8)
+	glUniform4i(m_uniformTextureWindow,
+				~(maskX * 8) & 0xff, ~(maskY * 8) & 0xff,
+				(offsetX & maskX) * 8, (offsetY & maskY) * 8);
+
+	m_textureWindow = textureWindow;
 }
 
 void Renderer::setDrawOffset(int16_t x, int16_t y)
@@ -207,7 +560,10 @@ void Renderer::setDrawOffset(int16_t x, int16_t y)
 	draw();
 
 	// Update the uniform value
-	glUniform2i(m_program, x, y);
+	glUniform2i(m_uniformOffset, x, y);
+
+	m_drawOffsetX = x;
+	m_drawOffsetY = y;
 }
 
 void Renderer::setDrawingArea(uint16_t left, uint16_t top, uint16_t right, uint16_t bottom)
@@ -227,9 +583,8 @@ void Renderer::setDrawingArea(uint16_t left, uint16_t top, uint16_t right, uint1
 	GLint width = rightCoordinate - leftCoordinate + 1;
 	GLint height = bottomCoordinate - topCoordinate + 1;
 
-	// OpenGL has (0, 0) at the bottom left, the PSX at the top left
-	bottomCoordinate = (GLint)m_framebufferYResolution - bottomCoordinate - 1;
-
+	// The VRAM texture stores line 0 at the bottom so the PlayStation
+	// coordinates can be used directly
 	if (width < 0x0 || height < 0x0)
 	{
 		LOG("Unsupported drawing area " << width << "x" << height << " ["
@@ -238,18 +593,43 @@ void Renderer::setDrawingArea(uint16_t left, uint16_t top, uint16_t right, uint1
 
 		// Don't draw anything
 		glScissor(0x0, 0x0, 0x0, 0x0);
+		m_drawingArea = VramRect();
+	}
+	else
+	{
+		glScissor(leftCoordinate, topCoordinate, width, height);
+		m_drawingArea = VramRect(left, top, right + 1, bottom + 1);
+	}
+}
+
+void Renderer::applyDrawingAreaScissor()
+{
+	if (m_drawingArea.isEmpty())
+	{
+		glScissor(0x0, 0x0, 0x0, 0x0);
 	}
 	else
 	{
-		glScissor(leftCoordinate, bottomCoordinate, width, height);
+		glScissor(m_drawingArea.m_left, m_drawingArea.m_top, m_drawingArea.getWidth(), m_drawingArea.getHeight());
 	}
 }
 
+void Renderer::submitVertices()
+{
+	if (m_numOfVertices == m_firstVertex) return;
+
+	// The vertex buffer is not coherent, make the CPU writes visible
+	glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	glDrawArrays(GL_TRIANGLES, m_firstVertex, m_numOfVertices - m_firstVertex);
+
+	m_firstVertex = m_numOfVertices;
+	m_batch += 1;
+}
+
 void Renderer::draw()
 {
 	{
-		glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
-		glDrawArrays(GL_TRIANGLES, 0, m_numOfVertices);
+		submitVertices();
 
 		// Wait for GPU to complete
 		GLsync sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
@@ -263,11 +643,498 @@ void Renderer::draw()
 
 		// Reset the buffers
 		m_numOfVertices = 0x0;
+		m_firstVertex = 0x0;
 	}
 }
 
-void Renderer::display()
+void Renderer::display(const DisplayArea& area, bool present)
 {
 	draw();
+
+	// Nothing to do for skipped fields unless someone consumes the frames
+	if (!present && !m_displayOut.hasSinks()) return;
+
+	// The frame read back during an earlier field is converted once the
+	// GPU is done with it, the emulation never waits for the copy
+	bool converted = false;
+	if (m_displayPending && (!m_readbackFence || isReadbackDone()))
+	{
+		convertPendingDisplay();
+		converted = true;
+	}
+
+	// Only one frame is read back at a time, the changes made meanwhile
+	// are picked up once it's converted
+	bool changed = !m_displayPending && hasDisplayChanged(area);
+	if (changed)
+	{
+		m_windowStale = true;
+	}
+
+	if (present)
+	{
+		if (!area.m_24Bit)
+		{
+			// 15 bit areas are scaled straight from the VRAM texture. The
+			// window may also still show a frame converted earlier.
+			if (m_windowStale || m_presentedFrame != 0x0)
+			{
+				presentVram(area);
+			}
+		}
+		else if (!m_displayPending && m_presentedFrame != m_displayOut.getFrame().m_number)
+		{
+			// 24 bit pixels can't be blitted as they are, the window
+			// shows the converted frame
+			presentFrame();
+		}
+	}
+
+	// The sinks and the 24 bit areas need the picture in RGBA8
+	if (changed && (m_displayOut.hasSinks() || area.m_24Bit))
+	{
+		readbackDisplay(area);
+
+		// Nothing had to be copied back, e.g. for frames uploaded by the CPU
+		if (!converted && !m_readbackFence)
+		{
+			convertPendingDisplay();
+			converted = true;
+		}
+	}
+
+	if (converted)
+	{
+		m_displayOut.pushFrame();
+	}
+	else
+	{
+		m_displayOut.repeatFrame();
+	}
+}
+
+void Renderer::readbackDisplay(const DisplayArea& area)
+{
+	if (!area.m_disabled)
+	{
+		// 24 bit pixels use 1.5 VRAM pixels each. Whole tiles are read
+		// back so that they can be flagged up to date.
+		uint16_t width = area.m_24Bit ? (uint16_t)((area.m_width * 3 + 1) / 2) : area.m_width;
+
+		uint16_t left = area.m_x & ~(VRAM_TILE_SIZE - 1);
+		uint16_t top = area.m_y & ~(VRAM_TILE_SIZE - 1);
+		uint16_t right = (area.m_x + width + VRAM_TILE_SIZE - 1) & ~(VRAM_TILE_SIZE - 1);
+		uint16_t bottom = (area.m_y + area.m_height + VRAM_TILE_SIZE - 1) & ~(VRAM_TILE_SIZE - 1);
+
+		readbackVram(left, top, std::min<uint16_t>(right - left, VRAM_WIDTH), std::min<uint16_t>(bottom - top, VRAM_HEIGHT));
+	}
+
+	m_pendingArea = area;
+	m_displayPending = true;
+}
+
+void Renderer::convertPendingDisplay()
+{
+	if (m_readbackFence)
+	{
+		completeReadback();
+	}
+
+	m_displayOut.convert(m_vramShadow.data(), m_pendingArea);
+	m_displayPending = false;
+}
+
+bool Renderer::hasDisplayChanged(const DisplayArea& area)
+{
+	const DisplayArea& last = m_convertedArea;
+	// The field parity is expected to change, it's handled below
+	bool sameArea = area.m_x == last.m_x && area.m_y == last.m_y &&
+					area.m_width == last.m_width && area.m_height == last.m_height &&
+					area.m_24Bit == last.m_24Bit && area.m_interlaced == last.m_interlaced &&
+					area.m_disabled == last.m_disabled;
+
+	bool dirty = false;
+	if (!area.m_disabled)
+	{
+		uint16_t width = area.m_24Bit ? (uint16_t)((area.m_width * 3 + 1) / 2) : area.m_width;
+
+		VramRect rects[4];
+		uint8_t count = VramRect::splitWrapped(area.m_x, area.m_y, width, area.m_height, rects);
+		for (uint8_t i = 0; i < count && !dirty; ++i)
+		{
+			dirty = m_displayDirty.any(rects[i]);
+		}
+	}
+
+	m_displayDirty.clearAll();
+
+	if (!sameArea || dirty || !m_displayStarted)
+	{
+		m_displayStarted = true;
+		m_convertedArea = area;
+		m_staticFields = 0x0;
+		return true;
+	}
+
+	if (m_staticFields < 2)
+	{
+		m_staticFields += 1;
+	}
+
+	// An interlaced frame mixes the lines of the current field with the
+	// ones of the previous field, the picture only settles once both
+	// fields have been converted from the same VRAM content
+	return area.m_interlaced && !area.m_disabled && m_staticFields < 2;
+}
+
+void Renderer::presentFrame()
+{
+	const DisplayFrame& frame = m_displayOut.getFrame();
+
+	glBindTexture(GL_TEXTURE_2D, m_displayTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame.m_width, frame.m_height, GL_RGBA, GL_UNSIGNED_BYTE, frame.m_pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+
+	// Scale the frame to the window, flipping it since the first
+	// line is at the bottom of the texture
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_displayFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, frame.m_width, frame.m_height,
+					  0, m_framebufferYResolution, m_framebufferXResolution, 0,
+					  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
 	SDL_GL_SwapWindow(m_window);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_framebufferObject);
+	glEnable(GL_SCISSOR_TEST);
+
+	m_presentedFrame = frame.m_number;
+}
+
+void Renderer::presentVram(const DisplayArea& area)
+{
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+	if (area.m_disabled || area.m_width == 0x0 || area.m_height == 0x0)
+	{
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	else
+	{
+		// Scale each part of the area to its place in the window, flipping
+		// it since the first VRAM line is at the bottom of the texture
+		VramRect rects[4];
+		uint8_t count = VramRect::splitWrapped(area.m_x, area.m_y, area.m_width, area.m_height, rects);
+		for (uint8_t i = 0; i < count; ++i)
+		{
+			const VramRect& rect = rects[i];
+
+			// Position of the part in the displayed area
+			int32_t offsetX = (rect.m_left - area.m_x) & (VRAM_WIDTH - 1);
+			int32_t offsetY = (rect.m_top - area.m_y) & (VRAM_HEIGHT - 1);
+
+			GLint left = (GLint)(offsetX * m_framebufferXResolution / area.m_width);
+			GLint right = (GLint)((offsetX + rect.getWidth()) * m_framebufferXResolution / area.m_width);
+			GLint top = (GLint)(m_framebufferYResolution - offsetY * m_framebufferYResolution / area.m_height);
+			GLint bottom = (GLint)(m_framebufferYResolution - (offsetY + rect.getHeight()) * m_framebufferYResolution / area.m_height);
+
+			glBlitFramebuffer(rect.m_left, rect.m_top, rect.m_right, rect.m_bottom,
+							  left, top, right, bottom,
+							  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		}
+	}
+
+	SDL_GL_SwapWindow(m_window);
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebufferObject);
+	glEnable(GL_SCISSOR_TEST);
+
+	m_presentedFrame = 0x0;
+	m_windowStale = false;
+}
+
+double Renderer::getHostRefreshRate() const
+{
+	SDL_DisplayMode mode;
+	if (SDL_GetWindowDisplayMode(m_window, &mode) != 0 || mode.refresh_rate <= 0)
+	{
+		return 60.0;
+	}
+	return (double)mode.refresh_rate;
+}
+
+void Renderer::uploadVram(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint16_t* pixels)
+{
+	// A pending readback would overwrite the uploaded pixels in the shadow
+	if (m_readbackFence)
+	{
+		completeReadback();
+	}
+
+	// Primitives queued before the transfer must be drawn first
+	draw();
+
+	VramRect rects[4];
+	uint8_t count = VramRect::splitWrapped(x, y, width, height, rects);
+
+	// Update the shadow VRAM, it's used as the source of the texture upload
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		const VramRect& rect = rects[i];
+
+		// Position of the rectangle in the source image
+		uint16_t imageX = (rect.m_left - x) & (VRAM_WIDTH - 1);
+		uint16_t imageY = (rect.m_top - y) & (VRAM_HEIGHT - 1);
+
+		for (uint16_t line = 0; line < rect.getHeight(); ++line)
+		{
+			const uint16_t* src = pixels + (size_t)(imageY + line) * width + imageX;
+			uint16_t* dst = &m_vramShadow[(size_t)(rect.m_top + line) * VRAM_WIDTH + rect.m_left];
+			memcpy(dst, src, rect.getWidth() * sizeof(uint16_t));
+		}
+
+		m_shadowStale.clearCovered(rect);
+		m_blendSourceDirty.mark(rect);
+		m_displayDirty.mark(rect);
+		m_textureCache.invalidate(rect);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, m_vramTexture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, VRAM_WIDTH);
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		const VramRect& rect = rects[i];
+		const uint16_t* src = &m_vramShadow[(size_t)rect.m_top * VRAM_WIDTH + rect.m_left];
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, rect.m_left, rect.m_top, rect.getWidth(), rect.getHeight(),
+						GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, src);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+void Renderer::readbackVram(uint16_t x, uint16_t y, uint16_t width, uint16_t height)
+{
+	// Only one readback is in flight at a time
+	if (m_readbackFence)
+	{
+		completeReadback();
+	}
+
+	VramRect rects[4];
+	uint8_t count = VramRect::splitWrapped(x, y, width, height, rects);
+
+	m_readbackRectCount = 0x0;
+
+	GLintptr offset = 0x0;
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		const VramRect& rect = rects[i];
+
+		// Fast path: nothing has been drawn there since the last time
+		// the shadow VRAM was updated, the shadow copy is current.
+		if (!m_shadowStale.any(rect))
+		{
+			continue;
+		}
+
+		if (m_readbackRectCount == 0x0)
+		{
+			// Make sure the pending primitives end up in the readback
+			draw();
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readbackBuffer);
+		}
+
+		glReadPixels(rect.m_left, rect.m_top, rect.getWidth(), rect.getHeight(),
+					 GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, (GLvoid*)offset);
+
+		m_readbackRects[m_readbackRectCount] = rect;
+		m_readbackRectCount += 1;
+
+		// Cleared now rather than on completion so that the tiles drawn
+		// while the copy is in flight stay stale
+		m_shadowStale.clearCovered(rect);
+
+		offset += (GLintptr)rect.getWidth() * rect.getHeight() * sizeof(uint16_t);
+	}
+
+	if (m_readbackRectCount > 0x0)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		// Kick the copy now, we'll only wait for it when the data is needed
+		m_readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+	}
+}
+
+uint16_t Renderer::getVramPixel(uint16_t x, uint16_t y)
+{
+	if (m_readbackFence)
+	{
+		completeReadback();
+	}
+	return m_vramShadow[(size_t)(y & (VRAM_HEIGHT - 1)) * VRAM_WIDTH + (x & (VRAM_WIDTH - 1))];
+}
+
+bool Renderer::isReadbackDone()
+{
+	GLenum status = glClientWaitSync(m_readbackFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+void Renderer::completeReadback()
+{
+	while (true)
+	{
+		GLenum status = glClientWaitSync(m_readbackFence, GL_SYNC_FLUSH_COMMANDS_BIT, 10000000);
+		if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+			break; // Readback done
+	}
+
+	glDeleteSync(m_readbackFence);
+	m_readbackFence = nullptr;
+
+	GLsizeiptr size = 0x0;
+	for (uint8_t i = 0; i < m_readbackRectCount; ++i)
+	{
+		size += (GLsizeiptr)m_readbackRects[i].getWidth() * m_readbackRects[i].getHeight() * sizeof(uint16_t);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, m_readbackBuffer);
+	const uint16_t* src = (const uint16_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+
+	for (uint8_t i = 0; i < m_readbackRectCount; ++i)
+	{
+		const VramRect& rect = m_readbackRects[i];
+		for (uint16_t line = 0; line < rect.getHeight(); ++line)
+		{
+			uint16_t* dst = &m_vramShadow[(size_t)(rect.m_top + line) * VRAM_WIDTH + rect.m_left];
+			memcpy(dst, src, rect.getWidth() * sizeof(uint16_t));
+			src += rect.getWidth();
+		}
+	}
+
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	m_readbackRectCount = 0x0;
+}
+
+void Renderer::fillRect(uint16_t x, uint16_t y, uint16_t width, uint16_t height, Color color)
+{
+	// Primitives queued before the fill must be drawn first
+	draw();
+
+	// Convert to the 15 bit color stored in VRAM, the mask bit is cleared
+	glClearColor((GLfloat)(color.getR() >> 3) / 31.0f,
+				 (GLfloat)(color.getG() >> 3) / 31.0f,
+				 (GLfloat)(color.getB() >> 3) / 31.0f,
+				 0.0f);
+
+	// Clear each rectangle using the scissor box, no geometry involved
+	VramRect rects[4];
+	uint8_t count = VramRect::splitWrapped(x, y, width, height, rects);
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		const VramRect& rect = rects[i];
+
+		glScissor(rect.m_left, rect.m_top, rect.getWidth(), rect.getHeight());
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		markVramWritten(rect);
+	}
+
+	applyDrawingAreaScissor();
+}
+
+void Renderer::copyRect(uint16_t srcX, uint16_t srcY, uint16_t dstX, uint16_t dstY, uint16_t width, uint16_t height)
+{
+	// Primitives queued before the copy must be drawn first
+	draw();
+
+	// Both the source and the destination can wrap around the VRAM edges,
+	// split the source first then each part on the destination side
+	VramRect sources[4];
+	uint8_t sourceCount = VramRect::splitWrapped(srcX, srcY, width, height, sources);
+	for (uint8_t i = 0; i < sourceCount; ++i)
+	{
+		const VramRect& source = sources[i];
+
+		// Offset of this part in the copied rectangle
+		uint16_t offsetX = (source.m_left - srcX) & (VRAM_WIDTH - 1);
+		uint16_t offsetY = (source.m_top - srcY) & (VRAM_HEIGHT - 1);
+
+		VramRect destinations[4];
+		uint8_t destinationCount = VramRect::splitWrapped(dstX + offsetX, dstY + offsetY,
+														  source.getWidth(), source.getHeight(), destinations);
+		for (uint8_t j = 0; j < destinationCount; ++j)
+		{
+			const VramRect& destination = destinations[j];
+
+			// Matching part of the source
+			uint16_t left = source.m_left + ((destination.m_left - dstX - offsetX) & (VRAM_WIDTH - 1));
+			uint16_t top = source.m_top + ((destination.m_top - dstY - offsetY) & (VRAM_HEIGHT - 1));
+
+			VramRect part(left, top, left + destination.getWidth(), top + destination.getHeight());
+			copyVramRect(part, destination.m_left, destination.m_top);
+		}
+	}
+}
+
+void Renderer::copyVramRect(const VramRect& source, uint16_t dstX, uint16_t dstY)
+{
+	// Same for the copied pixels
+	if (m_readbackFence)
+	{
+		completeReadback();
+	}
+
+	VramRect destination(dstX, dstY, dstX + source.getWidth(), dstY + source.getHeight());
+
+	if (source.overlaps(destination))
+	{
+		// Copies within the same texture must not overlap, go through
+		// the scratch texture
+		glCopyImageSubData(m_vramTexture, GL_TEXTURE_2D, 0, source.m_left, source.m_top, 0,
+						   m_copyTexture, GL_TEXTURE_2D, 0, source.m_left, source.m_top, 0,
+						   source.getWidth(), source.getHeight(), 1);
+		glCopyImageSubData(m_copyTexture, GL_TEXTURE_2D, 0, source.m_left, source.m_top, 0,
+						   m_vramTexture, GL_TEXTURE_2D, 0, dstX, dstY, 0,
+						   source.getWidth(), source.getHeight(), 1);
+	}
+	else
+	{
+		glCopyImageSubData(m_vramTexture, GL_TEXTURE_2D, 0, source.m_left, source.m_top, 0,
+						   m_vramTexture, GL_TEXTURE_2D, 0, dstX, dstY, 0,
+						   source.getWidth(), source.getHeight(), 1);
+	}
+
+	m_blendSourceDirty.mark(destination);
+	m_displayDirty.mark(destination);
+	m_textureCache.invalidate(destination);
+
+	if (m_shadowStale.any(source))
+	{
+		// The shadow doesn't have the source pixels, it will be updated
+		// by the next readback
+		m_shadowStale.mark(destination);
+	}
+	else
+	{
+		// Mirror the copy in the shadow VRAM. memmove takes care of the
+		// overlap within a line, the line order of the overlap between lines.
+		uint16_t height = source.getHeight();
+		for (uint16_t i = 0; i < height; ++i)
+		{
+			uint16_t line = (dstY > source.m_top) ? (height - 1 - i) : i;
+
+			const uint16_t* src = &m_vramShadow[(size_t)(source.m_top + line) * VRAM_WIDTH + source.m_left];
+			uint16_t* dst = &m_vramShadow[(size_t)(dstY + line) * VRAM_WIDTH + dstX];
+			memmove(dst, src, source.getWidth() * sizeof(uint16_t));
+		}
+	}
 }
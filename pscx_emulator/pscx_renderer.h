@@ -1,8 +1,14 @@
 #pragma once
 
+#include <vector>
+
 #include "SDL.h"
 #include "glad.h"
 
+#include "pscx_vram.h"
+#include "pscx_texture_cache.h"
+#include "pscx_display.h"
+
 // Position on VRAM
 struct Position
 {
@@ -39,16 +45,85 @@ struct Color
 		return Color(r, g, b);
 	}
 
+	GLubyte getR() const { return m_r; }
+	GLubyte getG() const { return m_g; }
+	GLubyte getB() const { return m_b; }
+
 private:
 	GLubyte m_r, m_g, m_b;
 };
 
+// Texel coordinates within a texture page
+struct TexCoord
+{
+	TexCoord(GLshort u, GLshort v) : m_u(u), m_v(v) {}
+
+	// Parse texture coordinates from a GP0 parameter
+	static TexCoord fromPacked(uint32_t value)
+	{
+		uint8_t u = value;
+		uint8_t v = value >> 8;
+
+		return TexCoord(u, v);
+	}
+
+	GLshort getU() const { return m_u; }
+	GLshort getV() const { return m_v; }
+
+private:
+	GLshort m_u, m_v;
+};
+
+// How the texel is combined with the vertex color
+enum TextureMode
+{
+	// No texture, use the vertex color
+	TEXTURE_MODE_NONE,
+
+	// Texel modulated by the vertex color
+	TEXTURE_MODE_BLEND,
+
+	// Texel used as is
+	TEXTURE_MODE_RAW
+};
+
+// Semi-transparency mode, B is the VRAM pixel and F the primitive color
+enum BlendMode
+{
+	// B / 2 + F / 2
+	BLEND_MODE_AVERAGE,
+
+	// B + F
+	BLEND_MODE_ADD,
+
+	// B - F
+	BLEND_MODE_SUBTRACT,
+
+	// B + F / 4
+	BLEND_MODE_ADD_QUARTER,
+
+	// No blending, F replaces B
+	BLEND_MODE_OPAQUE
+};
+
 struct Vertex
 {
-	Vertex(Position position, Color color, float alpha = 1.0f) :
+	Vertex(Position position, Color color, BlendMode blendMode = BlendMode::BLEND_MODE_OPAQUE) :
+		m_position(position),
+		m_color(color),
+		m_blendMode(blendMode),
+		m_texCoord(0x0, 0x0),
+		m_textureLayer(0x0),
+		m_textureMode(TextureMode::TEXTURE_MODE_NONE)
+	{}
+
+	Vertex(Position position, Color color, TexCoord texCoord, BlendMode blendMode = BlendMode::BLEND_MODE_OPAQUE) :
 		m_position(position),
 		m_color(color),
-		m_alpha(alpha)
+		m_blendMode(blendMode),
+		m_texCoord(texCoord),
+		m_textureLayer(0x0),
+		m_textureMode(TextureMode::TEXTURE_MODE_NONE)
 	{}
 
 	const Position& getPosition() const { return m_position; }
@@ -59,8 +134,15 @@ struct Vertex
 	Position m_position;
 	// RGB color, 8 bits per component
 	Color m_color;
-	// Vertex alpha value, used for blending
-	float m_alpha;
+	// BlendMode of the primitive. For textured primitives only the texels
+	// with the semi-transparency bit set are blended.
+	GLubyte m_blendMode;
+	// Texel coordinates within the texture page
+	TexCoord m_texCoord;
+	// Layer of the texture cache holding the decoded page
+	GLshort m_textureLayer;
+	// TextureMode of the primitive
+	GLubyte m_textureMode;
 };
 
 // Maximum number of vertex that can be stored in an attribute buffers
@@ -121,6 +203,25 @@ private:
 	T* m_map;
 };
 
+// Primitives dropped before reaching the vertex buffer
+struct CullStats
+{
+	CullStats() :
+		m_outside(0x0),
+		m_oversize(0x0),
+		m_drawn(0x0)
+	{}
+
+	// Triangles entirely outside of the drawing area
+	uint32_t m_outside;
+
+	// Triangles larger than 1023x511, the GPU doesn't draw those
+	uint32_t m_oversize;
+
+	// Triangles pushed to the vertex buffer
+	uint32_t m_drawn;
+};
+
 struct Renderer
 {
 	Renderer();
@@ -137,6 +238,15 @@ struct Renderer
 	// Add a quad to the draw buffer
 	void pushQuad(Vertex vertices[]);
 
+	// Add a triangle sampling the texture page described by 'key'
+	void pushTexturedTriangle(Vertex vertices[], const TextureKey& key, TextureMode mode);
+
+	// Add a quad sampling the texture page described by 'key'
+	void pushTexturedQuad(Vertex vertices[], const TextureKey& key, TextureMode mode);
+
+	// Set the texture window, all values are in 8 texel steps
+	void setTextureWindow(uint8_t maskX, uint8_t maskY, uint8_t offsetX, uint8_t offsetY);
+
 	// Set the value of the uniform draw offset
 	void setDrawOffset(int16_t x, int16_t y);
 
@@ -146,10 +256,96 @@ struct Renderer
 	// Draw the buffered commands and reset the buffers
 	void draw();
 
-	// Draw the buffered commands and display them
-	void display();
+	// Draw the buffered commands and read back 'area' for the frame sinks,
+	// if any. The frame is converted and pushed to them on a later field,
+	// once the copy is done. It's shown in the window if 'present' is set.
+	void display(const DisplayArea& area, bool present);
+
+	// When disabled, the primitives are dropped instead of rendered. VRAM
+	// transfers, fills and copies are still executed.
+	void setDrawingEnabled(bool enabled) { m_drawingEnabled = enabled; }
+
+	// Refresh rate of the display showing the window, 60Hz if unknown
+	double getHostRefreshRate() const;
+
+	// Copy a 'width'x'height' image into the VRAM at 'x', 'y'. 'pixels' are
+	// in the native 16 bit PlayStation format, one line after the other.
+	void uploadVram(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint16_t* pixels);
+
+	// Start copying a VRAM rectangle back into the shadow VRAM. The transfer is
+	// asynchronous, we only wait for its completion when a pixel is fetched.
+	void readbackVram(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
+	// Return the 16 bit pixel at 'x', 'y'. Blocks if a readback is still in flight.
+	uint16_t getVramPixel(uint16_t x, uint16_t y);
+
+	// Fill a VRAM rectangle with 'color'. The drawing area and offset are ignored.
+	void fillRect(uint16_t x, uint16_t y, uint16_t width, uint16_t height, Color color);
+
+	// Copy a 'width'x'height' VRAM rectangle from 'srcX', 'srcY' to 'dstX', 'dstY'
+	void copyRect(uint16_t srcX, uint16_t srcY, uint16_t dstX, uint16_t dstY, uint16_t width, uint16_t height);
+
+	const TextureCache& getTextureCache() const { return m_textureCache; }
+
+	const CullStats& getCullStats() const { return m_cullStats; }
+
+	// Video output stage, frame sinks are registered there
+	DisplayOut& getDisplayOut() { return m_displayOut; }
 
 private:
+	// Add a triangle (3 vertices) or a quad (4 vertices) to the draw buffer
+	void pushPrimitive(const Vertex vertices[], size_t count);
+
+	// Return true if 'area' would give a picture different from the last
+	// frame converted or shown in the window. Updates the change tracking
+	// state.
+	bool hasDisplayChanged(const DisplayArea& area);
+
+	// Upload the last converted frame, scale it to the window and swap
+	void presentFrame();
+
+	// Scale 'area' straight from the VRAM texture to the window and swap.
+	// Only valid for 15 bit areas.
+	void presentVram(const DisplayArea& area);
+
+	// Start reading back 'area', it's converted by convertPendingDisplay()
+	void readbackDisplay(const DisplayArea& area);
+
+	// Convert the area passed to readbackDisplay(), waiting for the copy
+	// if it's still in flight
+	void convertPendingDisplay();
+
+	// Return the VRAM area drawn by the triangle 'v0', 'v1', 'v2' or an
+	// empty rectangle if the triangle is culled
+	VramRect cullTriangle(const Vertex& v0, const Vertex& v1, const Vertex& v2);
+
+	// Issue a draw call for the vertices buffered since the last one
+	void submitVertices();
+
+	// Update the blending source texture for 'rect'
+	void refreshBlendSource(const VramRect& rect);
+
+	// Return the texture cache layer holding 'key', decoding it if needed
+	GLshort getTextureLayer(const TextureKey& key);
+
+	// Make sure the shadow VRAM is up to date for 'rect'
+	void syncShadow(const VramRect& rect);
+
+	// Copy a rectangle which doesn't cross the VRAM edges
+	void copyVramRect(const VramRect& source, uint16_t dstX, uint16_t dstY);
+
+	// Restore the scissor box to the current drawing area
+	void applyDrawingAreaScissor();
+
+	// Return true if the pending readback is done, without waiting
+	bool isReadbackDone();
+
+	// Wait for the pending readback and copy the result into the shadow VRAM
+	void completeReadback();
+
+	// Flag a VRAM area as modified by the GPU
+	void markVramWritten(const VramRect& rect);
+
 	SDL_GLContext m_glContext;
 	SDL_Window* m_window;
 
@@ -176,6 +372,101 @@ private:
 	// Current number of vertices in the buffers
 	uint32_t m_numOfVertices;
 
+	// Index of the first vertex not yet submitted to the GPU
+	uint32_t m_firstVertex;
+
+	// Incremented each time the buffered vertices are submitted
+	uint32_t m_batch;
+
 	// Index of the "offset" shader uniform
 	GLint m_uniformOffset;
+
+	// Current drawing offset
+	int16_t m_drawOffsetX, m_drawOffsetY;
+
+	// Index of the "texture_window" shader uniform
+	GLint m_uniformTextureWindow;
+
+	// Current texture window, packed to detect changes
+	uint32_t m_textureWindow;
+
+	// Decoded texture pages
+	TextureCache m_textureCache;
+
+	// Current drawing area, used to cull primitives and to clip the
+	// VRAM areas flagged as drawn
+	VramRect m_drawingArea;
+
+	CullStats m_cullStats;
+
+	// False while the pacer skips the rendering of a field
+	bool m_drawingEnabled;
+
+	// Texture holding the emulated VRAM in the native 1555 format
+	GLuint m_vramTexture;
+
+	// Framebuffer object rendering into m_vramTexture
+	GLuint m_framebufferObject;
+
+	// Scratch texture used to copy between overlapping VRAM rectangles
+	GLuint m_copyTexture;
+
+	// Copy of the VRAM sampled by the fragment shader to blend the
+	// semi-transparent primitives
+	GLuint m_blendTexture;
+
+	// Tiles written since they were last copied to m_blendTexture
+	VramTileMap m_blendSourceDirty;
+
+	// Converts the displayed VRAM area to RGBA8
+	DisplayOut m_displayOut;
+
+	// Tiles written since the last frame conversion
+	VramTileMap m_displayDirty;
+
+	// Display area of the last converted or shown frame
+	DisplayArea m_convertedArea;
+
+	// Number of consecutive conversions with no change to the displayed
+	// VRAM. Saturates at 2, enough to cover both interlaced fields.
+	uint8_t m_staticFields;
+
+	// False until a first frame has been converted or shown in the window
+	bool m_displayStarted;
+
+	// Display area read back and waiting to be converted
+	DisplayArea m_pendingArea;
+	bool m_displayPending;
+
+	// Number of the converted frame shown in the window, 0 when the window
+	// shows the VRAM directly
+	uint32_t m_presentedFrame;
+
+	// Set when the displayed VRAM changed since it was last blitted
+	bool m_windowStale;
+
+	// Texture receiving the converted frames and the framebuffer object
+	// used to blit it to the window
+	GLuint m_displayTexture;
+	GLuint m_displayFramebuffer;
+
+	// Copy of the VRAM in system memory, used to service VRAM to CPU transfers
+	std::vector<uint16_t> m_vramShadow;
+
+	// Tiles of the shadow VRAM which are older than the GPU copy because
+	// something has been drawn there since the last readback was issued
+	VramTileMap m_shadowStale;
+
+	// Pixel pack buffer receiving the asynchronous readbacks
+	GLuint m_readbackBuffer;
+
+	// VRAM rectangles copied in the readback buffer, one after the other
+	VramRect m_readbackRects[4];
+
+	// Number of valid entries in m_readbackRects
+	uint8_t m_readbackRectCount;
+
+	// Fence signaled once the pending readback is done or nullptr if
+	// there's no readback in flight
+	GLsync m_readbackFence;
 };
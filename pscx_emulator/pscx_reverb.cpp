@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cstring>
+
+#include "pscx_reverb.h"
+#include "pscx_spu.h"
+#include "pscx_simd.h"
+
+// Half-band filter of the hardware, in 1/32768 units. Every other tap is
+// zero except the center one.
+alignas(16) static const int16_t REVERB_FIR[REVERB_FIR_TAPS] =
+{
+	-0x0001, 0x0000, 0x0002, 0x0000, -0x000a, 0x0000, 0x0023, 0x0000,
+	-0x0067, 0x0000, 0x010a, 0x0000, -0x0268, 0x0000, 0x0534, 0x0000,
+	-0x0b90, 0x0000, 0x2806, 0x4000, 0x2806, 0x0000, -0x0b90, 0x0000,
+	0x0534, 0x0000, -0x0268, 0x0000, 0x010a, 0x0000, -0x0067, 0x0000,
+	0x0023, 0x0000, -0x000a, 0x0000, 0x0002, 0x0000, -0x0001, 0x0000,
+};
+
+static int16_t clampSample(int32_t value)
+{
+	return (int16_t)std::min(std::max(value, -0x8000), 0x7fff);
+}
+
+static int32_t applyFir(const int16_t* samples)
+{
+#ifdef PSCX_SSE2
+	__m128i sums = _mm_setzero_si128();
+	for (uint32_t i = 0; i < REVERB_FIR_TAPS; i += 8)
+	{
+		sums = _mm_add_epi32(sums, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)(samples + i)), _mm_load_si128((const __m128i*)(REVERB_FIR + i))));
+	}
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sums);
+#else
+	int32_t sum = 0;
+	for (uint32_t i = 0; i < REVERB_FIR_TAPS; ++i)
+	{
+		sum += (int32_t)samples[i] * REVERB_FIR[i];
+	}
+	return sum;
+#endif
+}
+
+#ifdef PSCX_SSE2
+// Sign extend the 4 low 16 bit values to 32 bits
+static inline __m128i widenLow(__m128i values)
+{
+	return _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16);
+}
+#else
+static int16_t mulQ15(int16_t a, int16_t b)
+{
+	return (int16_t)(((int32_t)a * b) >> 15);
+}
+#endif
+
+// ********************** SpuReverb implementation **********************
+SpuReverb::FirHistory::FirHistory() :
+	m_index(0x0)
+{
+	memset(m_samples, 0x0, sizeof(m_samples));
+}
+
+void SpuReverb::FirHistory::push(int16_t sample)
+{
+	m_index = (m_index + 1) % REVERB_FIR_RING;
+	m_samples[m_index] = sample;
+	m_samples[m_index + REVERB_FIR_RING] = sample;
+}
+
+SpuReverb::SpuReverb() :
+	m_position(0x0),
+	m_oddFrame(false)
+{
+}
+
+void SpuReverb::run(const uint16_t* registers, uint16_t* ram, bool writeEnabled,
+	int16_t inLeft, int16_t inRight, int16_t& outLeft, int16_t& outRight)
+{
+	m_downsample[0].push(inLeft);
+	m_downsample[1].push(inRight);
+
+	m_oddFrame = !m_oddFrame;
+	if (m_oddFrame)
+	{
+		int16_t left = clampSample(applyFir(m_downsample[0].getWindow()) >> 15);
+		int16_t right = clampSample(applyFir(m_downsample[1].getWindow()) >> 15);
+
+		process(registers, ram, writeEnabled, left, right, left, right);
+
+		m_upsample[0].push(left);
+		m_upsample[1].push(right);
+	}
+	else
+	{
+		m_upsample[0].push(0x0);
+		m_upsample[1].push(0x0);
+	}
+
+	// Half the upsampled signal is zeros, the filter gain is doubled
+	outLeft = clampSample(applyFir(m_upsample[0].getWindow()) >> 14);
+	outRight = clampSample(applyFir(m_upsample[1].getWindow()) >> 14);
+}
+
+void SpuReverb::process(const uint16_t* registers, uint16_t* ram, bool writeEnabled,
+	int16_t inLeft, int16_t inRight, int16_t& outLeft, int16_t& outRight)
+{
+	// Addresses and offsets are in 8 byte units
+	uint32_t base = (uint32_t)registers[regmap::REVERB_BASE] << 2;
+	uint32_t size = SPU_RAM_SIZE - base;
+	m_position %= size;
+
+	auto reg = [registers](size_t index) { return (uint32_t)registers[index] << 2; };
+	auto volume = [registers](size_t index) { return (int16_t)registers[index]; };
+
+	// 'offset' can go up to twice the work area size, a negative offset is
+	// passed with 'size' added
+	auto address = [&](uint32_t offset) { return base + (m_position + offset % size) % size; };
+	auto read = [&](uint32_t offset) { return (int16_t)ram[address(offset)]; };
+	auto write = [&](uint32_t offset, int16_t value)
+	{
+		if (writeEnabled)
+		{
+			ram[address(offset)] = (uint16_t)value;
+		}
+	};
+
+	int16_t inputLeft = (int16_t)((inLeft * volume(regmap::REVERB_INPUT_VOLUME_LEFT)) >> 15);
+	int16_t inputRight = (int16_t)((inRight * volume(regmap::REVERB_INPUT_VOLUME_RIGHT)) >> 15);
+
+	// Reflections, lanes: same side left, different side left, same side
+	// right, different side right. The different side lanes read from the
+	// other channel. Each one is written one sample ahead of where it's read
+	// back.
+	const uint32_t reflectAddresses[4] =
+	{
+		reg(regmap::REVERB_REFLECT_SAME_LEFT1), reg(regmap::REVERB_REFLECT_DIFF_LEFT1),
+		reg(regmap::REVERB_REFLECT_SAME_RIGHT1), reg(regmap::REVERB_REFLECT_DIFF_RIGHT1),
+	};
+	const uint32_t reflectSources[4] =
+	{
+		reg(regmap::REVERB_REFLECT_SAME_LEFT2), reg(regmap::REVERB_REFLECT_DIFF_RIGHT2),
+		reg(regmap::REVERB_REFLECT_SAME_RIGHT2), reg(regmap::REVERB_REFLECT_DIFF_LEFT2),
+	};
+
+	alignas(16) int16_t reflectInput[8] = { inputLeft, inputLeft, inputRight, inputRight };
+	alignas(16) int16_t reflectSource[8] = {};
+	alignas(16) int16_t reflectPrevious[8] = {};
+	alignas(16) int16_t reflect[8];
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		reflectSource[i] = read(reflectSources[i]);
+		reflectPrevious[i] = read(reflectAddresses[i] + size - 1);
+	}
+
+	// Comb filters, lanes: left 1-4 then right 1-4
+	const uint32_t combAddresses[8] =
+	{
+		reg(regmap::REVERB_COMB_LEFT1), reg(regmap::REVERB_COMB_LEFT2),
+		reg(regmap::REVERB_COMB_LEFT3), reg(regmap::REVERB_COMB_LEFT4),
+		reg(regmap::REVERB_COMB_RIGHT1), reg(regmap::REVERB_COMB_RIGHT2),
+		reg(regmap::REVERB_COMB_RIGHT3), reg(regmap::REVERB_COMB_RIGHT4),
+	};
+	alignas(16) int16_t comb[8];
+	alignas(16) int16_t combVolume[8];
+	for (uint32_t i = 0; i < 8; ++i)
+	{
+		comb[i] = read(combAddresses[i]);
+		combVolume[i] = volume(regmap::REVERB_COMB_VOLUME1 + (i & 3));
+	}
+
+	int16_t reflectVolume = volume(regmap::REVERB_REFLECT_VOLUME1);
+	int16_t wallVolume = volume(regmap::REVERB_REFLECT_VOLUME2);
+
+	// All-pass filters, lanes: left and right
+	uint32_t apfAddresses1[2] = { reg(regmap::REVERB_APF_LEFT1), reg(regmap::REVERB_APF_RIGHT1) };
+	uint32_t apfAddresses2[2] = { reg(regmap::REVERB_APF_LEFT2), reg(regmap::REVERB_APF_RIGHT2) };
+	uint32_t apfDelay1 = size - reg(regmap::REVERB_APF_OFFSET1) % size;
+	uint32_t apfDelay2 = size - reg(regmap::REVERB_APF_OFFSET2) % size;
+	int16_t apfVolume1 = volume(regmap::REVERB_APF_VOLUME1);
+	int16_t apfVolume2 = volume(regmap::REVERB_APF_VOLUME2);
+
+	alignas(16) int16_t apf[8] = {};
+	alignas(16) int16_t apfOutput[8];
+	int16_t out[2];
+
+#ifdef PSCX_SSE2
+	// reflect = (input + source * wall - previous) * iir + previous, the
+	// sums are done in 32 bits and clamped once like the scalar code
+	__m128i previous = widenLow(_mm_load_si128((const __m128i*)reflectPrevious));
+	__m128i wall = widenLow(mulQ15(_mm_load_si128((const __m128i*)reflectSource), _mm_set1_epi16(wallVolume)));
+	__m128i value = _mm_sub_epi32(_mm_add_epi32(widenLow(_mm_load_si128((const __m128i*)reflectInput)), wall), previous);
+	value = _mm_packs_epi32(value, value);
+	value = _mm_add_epi32(widenLow(mulQ15(value, _mm_set1_epi16(reflectVolume))), previous);
+	_mm_store_si128((__m128i*)reflect, _mm_packs_epi32(value, value));
+
+	// The four combs of each side summed in 32 bits
+	__m128i sums = _mm_madd_epi16(_mm_load_si128((const __m128i*)comb), _mm_load_si128((const __m128i*)combVolume));
+	sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 4));
+	out[0] = clampSample(_mm_cvtsi128_si32(sums) >> 15);
+	out[1] = clampSample(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)) >> 15);
+#else
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		int32_t value = reflectInput[i] + mulQ15(reflectSource[i], wallVolume) - reflectPrevious[i];
+		reflect[i] = clampSample(mulQ15(clampSample(value), reflectVolume) + reflectPrevious[i]);
+	}
+
+	for (uint32_t side = 0; side < 2; ++side)
+	{
+		int32_t sum = 0;
+		for (uint32_t i = side * 4; i < side * 4 + 4; ++i)
+		{
+			sum += comb[i] * combVolume[i];
+		}
+		out[side] = clampSample(sum >> 15);
+	}
+#endif
+
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		write(reflectAddresses[i], reflect[i]);
+	}
+
+	// Two all-pass stages: t = out - apf * volume is stored, the output
+	// is t * volume + apf
+	const uint32_t* apfAddresses[2] = { apfAddresses1, apfAddresses2 };
+	const uint32_t apfDelays[2] = { apfDelay1, apfDelay2 };
+	const int16_t apfVolumes[2] = { apfVolume1, apfVolume2 };
+	for (uint32_t stage = 0; stage < 2; ++stage)
+	{
+		apf[0] = read(apfAddresses[stage][0] + apfDelays[stage]);
+		apf[1] = read(apfAddresses[stage][1] + apfDelays[stage]);
+
+#ifdef PSCX_SSE2
+		__m128i apfVolume = _mm_set1_epi16(apfVolumes[stage]);
+		__m128i delayed = _mm_load_si128((const __m128i*)apf);
+		__m128i stored = _mm_subs_epi16(_mm_setr_epi16(out[0], out[1], 0, 0, 0, 0, 0, 0), mulQ15(delayed, apfVolume));
+		_mm_store_si128((__m128i*)apfOutput, stored);
+		_mm_store_si128((__m128i*)apf, _mm_adds_epi16(mulQ15(stored, apfVolume), delayed));
+#else
+		for (uint32_t side = 0; side < 2; ++side)
+		{
+			apfOutput[side] = clampSample(out[side] - mulQ15(apf[side], apfVolumes[stage]));
+			apf[side] = clampSample(mulQ15(apfOutput[side], apfVolumes[stage]) + apf[side]);
+		}
+#endif
+
+		write(apfAddresses[stage][0], apfOutput[0]);
+		write(apfAddresses[stage][1], apfOutput[1]);
+		out[0] = apf[0];
+		out[1] = apf[1];
+	}
+
+	outLeft = out[0];
+	outRight = out[1];
+
+	m_position = (m_position + 1) % size;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+
+// The reverb runs at 22.05kHz, half the mixer rate. Both conversions go
+// through the same 39 tap half-band filter, padded to 40 taps for the
+// vector code.
+const uint32_t REVERB_FIR_TAPS = 40;
+
+// Samples kept by the filters. They're stored twice so that the last
+// REVERB_FIR_TAPS samples are always contiguous.
+const uint32_t REVERB_FIR_RING = 64;
+
+// Reverb unit of the SPU. Its work area is a ring buffer in SPU RAM going
+// from the REVERB_BASE address to the end of the RAM.
+struct SpuReverb
+{
+	SpuReverb();
+
+	// Feed one 44.1kHz input frame and return one output frame, before
+	// the reverb output volume. 'registers' are the SPU registers. The work
+	// area in 'ram' is only written when 'writeEnabled' is set.
+	void run(const uint16_t* registers, uint16_t* ram, bool writeEnabled,
+		int16_t inLeft, int16_t inRight, int16_t& outLeft, int16_t& outRight);
+
+private:
+	struct FirHistory
+	{
+		FirHistory();
+
+		void push(int16_t sample);
+
+		// Last REVERB_FIR_TAPS samples, oldest first
+		const int16_t* getWindow() const { return m_samples + m_index + REVERB_FIR_RING - (REVERB_FIR_TAPS - 1); }
+
+		int16_t m_samples[2 * REVERB_FIR_RING];
+		uint32_t m_index;
+	};
+
+	// Run the reverb for one 22.05kHz sample
+	void process(const uint16_t* registers, uint16_t* ram, bool writeEnabled,
+		int16_t inLeft, int16_t inRight, int16_t& outLeft, int16_t& outRight);
+
+	// Input of the downsampling filter, one per channel
+	FirHistory m_downsample[2];
+
+	// Reverb output with zeros between the samples, filtered back to 44.1kHz
+	FirHistory m_upsample[2];
+
+	// Position in the work area relative to its start, in halfwords.
+	// Advances by one every reverb sample.
+	uint32_t m_position;
+
+	// The reverb runs on every other frame
+	bool m_oddFrame;
+};
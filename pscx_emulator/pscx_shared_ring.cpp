@@ -0,0 +1,219 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#include "pscx_shared_ring.h"
+#include "pscx_common.h"
+
+// The atomics are accessed from several processes, they must not hide a lock
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "32 bit atomics must be lock free");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "64 bit atomics must be lock free");
+
+// Size of the structures in the mapping, rounded to a cache line so that
+// the writer and the readers don't share lines between sections
+static uint32_t alignSection(size_t size)
+{
+	return (uint32_t)((size + 63) & ~(size_t)63);
+}
+
+// ***************** SharedFrameRing implementation ******************
+SharedFrameRing::SharedFrameRing() :
+	m_mapping(nullptr),
+	m_size(0x0)
+#ifdef _WIN32
+	, m_handle(nullptr)
+#endif
+{
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+	close();
+}
+
+bool SharedFrameRing::open(const std::string& name, bool withAudio)
+{
+	close();
+
+	uint32_t frameStride = alignSection(sizeof(SharedFrameSlot) + (size_t)DISPLAY_MAX_WIDTH * DISPLAY_MAX_HEIGHT * sizeof(uint32_t));
+	uint32_t audioStride = alignSection(sizeof(SharedAudioBlock) + SHARED_RING_AUDIO_BLOCK_FRAMES * 2 * sizeof(int16_t));
+	uint32_t audioBlocks = withAudio ? SHARED_RING_AUDIO_BLOCKS : 0;
+
+	uint32_t frameOffset = alignSection(sizeof(SharedRingHeader));
+	uint32_t audioOffset = frameOffset + frameStride * SHARED_RING_FRAME_SLOTS;
+	size_t size = (size_t)audioOffset + (size_t)audioStride * audioBlocks;
+
+#ifdef _WIN32
+	std::string path = "Local\\" + name;
+	HANDLE handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+									   (DWORD)((uint64_t)size >> 32), (DWORD)size, path.c_str());
+	if (handle == nullptr)
+	{
+		WARN("Can't create the shared memory " << path << ", error " << GetLastError());
+		return false;
+	}
+
+	void* mapping = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (mapping == nullptr)
+	{
+		WARN("Can't map the shared memory " << path << ", error " << GetLastError());
+		CloseHandle(handle);
+		return false;
+	}
+
+	m_handle = handle;
+#else
+	std::string path = "/" + name;
+	int fd = shm_open(path.c_str(), O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+	{
+		WARN("Can't create the shared memory " << path);
+		return false;
+	}
+
+	void* mapping = MAP_FAILED;
+	if (ftruncate(fd, (off_t)size) == 0)
+	{
+		mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+
+	// The mapping keeps the object alive
+	::close(fd);
+
+	if (mapping == MAP_FAILED)
+	{
+		WARN("Can't map the shared memory " << path);
+		shm_unlink(path.c_str());
+		return false;
+	}
+#endif
+
+	m_mapping = (uint8_t*)mapping;
+	m_size = size;
+	m_name = path;
+
+	// A previous instance might have left data, start from scratch. The
+	// magic is written last so readers don't see a half initialized header.
+	memset(m_mapping, 0x0, size);
+
+	SharedRingHeader* header = getHeader();
+	header->m_version = SHARED_RING_VERSION;
+	header->m_frameSlots = SHARED_RING_FRAME_SLOTS;
+	header->m_frameStride = frameStride;
+	header->m_frameOffset = frameOffset;
+	header->m_maxWidth = DISPLAY_MAX_WIDTH;
+	header->m_maxHeight = DISPLAY_MAX_HEIGHT;
+	header->m_audioBlocks = audioBlocks;
+	header->m_audioStride = audioStride;
+	header->m_audioOffset = audioOffset;
+	header->m_audioBlockFrames = SHARED_RING_AUDIO_BLOCK_FRAMES;
+	header->m_alive.store(1, std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_release);
+	header->m_magic = SHARED_RING_MAGIC;
+
+	return true;
+}
+
+void SharedFrameRing::close()
+{
+	if (m_mapping == nullptr) return;
+
+	getHeader()->m_alive.store(0, std::memory_order_release);
+
+#ifdef _WIN32
+	// The mapping disappears with the last handle
+	UnmapViewOfFile(m_mapping);
+	CloseHandle((HANDLE)m_handle);
+	m_handle = nullptr;
+#else
+	// Readers which have it mapped keep their view, new ones can't open it
+	munmap(m_mapping, m_size);
+	shm_unlink(m_name.c_str());
+#endif
+
+	m_mapping = nullptr;
+	m_size = 0x0;
+}
+
+void SharedFrameRing::pushFrame(const DisplayFrame& frame)
+{
+	if (m_mapping == nullptr) return;
+
+	SharedRingHeader* header = getHeader();
+
+	uint64_t index = header->m_frameCount.load(std::memory_order_relaxed);
+	uint8_t* base = m_mapping + header->m_frameOffset + (size_t)(index % header->m_frameSlots) * header->m_frameStride;
+
+	SharedFrameSlot* slot = (SharedFrameSlot*)base;
+	uint32_t* pixels = (uint32_t*)(base + sizeof(SharedFrameSlot));
+
+	uint64_t field = header->m_fieldCount.load(std::memory_order_relaxed) + 1;
+
+	// Readers seeing an odd sequence skip the slot, the fence orders the
+	// increment before the data writes
+	uint32_t sequence = slot->m_sequence.load(std::memory_order_relaxed);
+	slot->m_sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	slot->m_width = frame.m_width;
+	slot->m_height = frame.m_height;
+	slot->m_fieldNumber = field;
+	slot->m_fieldRate = frame.m_fieldRate;
+	memcpy(pixels, frame.m_pixels.data(), frame.m_pixels.size() * sizeof(uint32_t));
+
+	slot->m_sequence.store(sequence + 2, std::memory_order_release);
+
+	header->m_fieldCount.store(field, std::memory_order_release);
+	header->m_frameCount.store(index + 1, std::memory_order_release);
+}
+
+void SharedFrameRing::repeatFrame(const DisplayFrame& /*frame*/)
+{
+	if (m_mapping == nullptr) return;
+
+	// The picture of the last slot stays valid, only the field advances
+	getHeader()->m_fieldCount.fetch_add(1, std::memory_order_release);
+}
+
+void SharedFrameRing::pushAudio(const int16_t* samples, size_t frames)
+{
+	if (m_mapping == nullptr) return;
+
+	SharedRingHeader* header = getHeader();
+	if (header->m_audioBlocks == 0x0) return;
+
+	while (frames > 0)
+	{
+		uint32_t count = (uint32_t)std::min(frames, (size_t)header->m_audioBlockFrames);
+
+		uint64_t index = header->m_audioCount.load(std::memory_order_relaxed);
+		uint8_t* base = m_mapping + header->m_audioOffset + (size_t)(index % header->m_audioBlocks) * header->m_audioStride;
+
+		SharedAudioBlock* block = (SharedAudioBlock*)base;
+
+		uint32_t sequence = block->m_sequence.load(std::memory_order_relaxed);
+		block->m_sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		block->m_frames = count;
+		block->m_sampleRate = AUDIO_SAMPLE_RATE;
+		block->m_blockNumber = index + 1;
+		memcpy(base + sizeof(SharedAudioBlock), samples, (size_t)count * 2 * sizeof(int16_t));
+
+		block->m_sequence.store(sequence + 2, std::memory_order_release);
+		header->m_audioCount.store(index + 1, std::memory_order_release);
+
+		samples += (size_t)count * 2;
+		frames -= count;
+	}
+}
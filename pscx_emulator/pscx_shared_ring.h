@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+#include "pscx_audio_sink.h"
+#include "pscx_display.h"
+
+// Shared memory layout version, bumped on incompatible changes
+const uint32_t SHARED_RING_MAGIC = 0x52585350; // "PSXR"
+const uint32_t SHARED_RING_VERSION = 1;
+
+// Number of frame slots. Readers have that many frames of slack before
+// the writer reuses the slot they're reading.
+const uint32_t SHARED_RING_FRAME_SLOTS = 4;
+
+// Audio blocks, each holding up to SHARED_RING_AUDIO_BLOCK_FRAMES stereo
+// 16 bit samples
+const uint32_t SHARED_RING_AUDIO_BLOCKS = 16;
+const uint32_t SHARED_RING_AUDIO_BLOCK_FRAMES = 1024;
+
+// All the structures below live in the shared memory and are read by other
+// processes: fixed size fields only, 64 byte aligned sections. The reader
+// protocol for a frame or an audio block is a sequence lock:
+//
+//   1. n = m_frameCount (acquire), the newest frame is in slot (n - 1) % slots
+//   2. s = slot m_sequence (acquire), retry if odd: the slot is being written
+//   3. use the slot in place (or copy it)
+//   4. acquire fence, retry if m_sequence != s: the writer reused the slot
+//
+// The writer never waits for the readers.
+struct SharedRingHeader
+{
+	uint32_t m_magic;
+	uint32_t m_version;
+
+	// Frame slots: m_frameSlots slots of m_frameStride bytes, starting
+	// m_frameOffset bytes after the beginning of the mapping. A slot is a
+	// SharedFrameSlot followed by the RGBA8 pixels.
+	uint32_t m_frameSlots;
+	uint32_t m_frameStride;
+	uint32_t m_frameOffset;
+	uint32_t m_maxWidth, m_maxHeight;
+
+	// Audio blocks, same organization. m_audioBlocks is 0 when the audio
+	// isn't published. A block is a SharedAudioBlock followed by the
+	// interleaved stereo samples.
+	uint32_t m_audioBlocks;
+	uint32_t m_audioStride;
+	uint32_t m_audioOffset;
+	uint32_t m_audioBlockFrames;
+
+	// Set to 0 by the writer when it stops publishing
+	std::atomic<uint32_t> m_alive;
+
+	// Number of frames published, the last one is in slot
+	// (m_frameCount - 1) % m_frameSlots
+	std::atomic<uint64_t> m_frameCount;
+
+	// Number of video fields, incremented for each frame and for each
+	// field which repeated the previous picture
+	std::atomic<uint64_t> m_fieldCount;
+
+	// Number of audio blocks published
+	std::atomic<uint64_t> m_audioCount;
+};
+
+struct SharedFrameSlot
+{
+	// Odd while the slot is written
+	std::atomic<uint32_t> m_sequence;
+
+	uint32_t m_width, m_height;
+
+	// Value of m_fieldCount when the frame was published
+	uint64_t m_fieldNumber;
+
+	// Fields per second of the video mode
+	double m_fieldRate;
+};
+
+struct SharedAudioBlock
+{
+	// Odd while the block is written
+	std::atomic<uint32_t> m_sequence;
+
+	// Number of stereo samples in the block
+	uint32_t m_frames;
+
+	uint32_t m_sampleRate;
+
+	// Value of m_audioCount when the block was published
+	uint64_t m_blockNumber;
+};
+
+// Frame and audio sink publishing the video output (and optionally the
+// audio) in a named shared memory mapping, so that other processes can
+// consume the frames without sockets or copies on their side
+struct SharedFrameRing : public FrameSink, public AudioSink
+{
+	SharedFrameRing();
+	~SharedFrameRing();
+
+	// Create the mapping 'name' ("Local\name" on Windows, "/name" in the
+	// POSIX shared memory namespace elsewhere). Return false on failure.
+	bool open(const std::string& name, bool withAudio);
+	void close();
+
+	bool isOpen() const { return m_mapping != nullptr; }
+
+	void pushFrame(const DisplayFrame& frame) override;
+	void repeatFrame(const DisplayFrame& frame) override;
+
+	// Publish 'frames' interleaved stereo samples at AUDIO_SAMPLE_RATE,
+	// split in as many blocks as needed. Ignored without audio section.
+	void pushAudio(const int16_t* samples, size_t frames) override;
+
+private:
+	SharedRingHeader* getHeader() const { return (SharedRingHeader*)m_mapping; }
+
+	uint8_t* m_mapping;
+	size_t m_size;
+
+	// Name the mapping was created with, needed to unlink it
+	std::string m_name;
+
+#ifdef _WIN32
+	void* m_handle;
+#endif
+};
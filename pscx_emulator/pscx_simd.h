@@ -0,0 +1,23 @@
+#pragma once
+
+// SSE2 is part of x86-64, 32 bit MSVC builds enable it by default.
+// Code using it keeps a scalar path for the other targets.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PSCX_SSE2 1
+#include <emmintrin.h>
+
+// (a * b) >> 15 for 8 signed 16 bit values, rebuilt from the high and low
+// halves of the products
+static inline __m128i mulQ15(__m128i a, __m128i b)
+{
+	__m128i high = _mm_mulhi_epi16(a, b);
+	__m128i low = _mm_mullo_epi16(a, b);
+	return _mm_or_si128(_mm_slli_epi16(high, 1), _mm_srli_epi16(low, 15));
+}
+#endif
+
+// AVX2 kernels are selected at runtime. MSVC always accepts the intrinsics,
+// other compilers need AVX2 enabled at compile time (-mavx2).
+#if defined(__AVX2__) || (defined(_MSC_VER) && defined(_M_X64))
+#define PSCX_AVX2 1
+#endif
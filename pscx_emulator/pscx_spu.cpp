@@ -1,12 +1,211 @@
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 
 #include "pscx_spu.h"
 #include "pscx_common.h"
+#include "pscx_simd.h"
+
+// Source halfword of each position of a 8 halfword group for the SPU RAM
+// transfer types (TRANSFER_CONTROL bits 1-3). 2 is the normal one, the
+// others repeat some of the halfwords; 0, 1, 6 and 7 fill the group with
+// the last one.
+static const uint8_t SPU_TRANSFER_PATTERNS[8][8] =
+{
+	{ 7, 7, 7, 7, 7, 7, 7, 7 },
+	{ 7, 7, 7, 7, 7, 7, 7, 7 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7 },
+	{ 1, 1, 3, 3, 5, 5, 7, 7 },
+	{ 3, 3, 3, 3, 7, 7, 7, 7 },
+	{ 7, 7, 7, 7, 7, 7, 7, 7 },
+	{ 7, 7, 7, 7, 7, 7, 7, 7 },
+	{ 7, 7, 7, 7, 7, 7, 7, 7 },
+};
+
+// ADPCM predictor filters, in 1/64 units
+static const int32_t SPU_FILTER_POSITIVE[5] = { 0, 60, 115, 98, 122 };
+static const int32_t SPU_FILTER_NEGATIVE[5] = { 0, 0, -52, -55, -60 };
+
+// Gaussian interpolation weights of the hardware, in 1/32768 units. Entry
+// k weighs a sample (511 - k) / 256 samples away from the output position.
+static const int16_t GAUSS_TABLE[512] =
+{
+	-0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001,
+	-0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001, -0x0001,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0001,
+	0x0001, 0x0001, 0x0001, 0x0002, 0x0002, 0x0002, 0x0003, 0x0003,
+	0x0003, 0x0004, 0x0004, 0x0005, 0x0005, 0x0006, 0x0007, 0x0007,
+	0x0008, 0x0009, 0x0009, 0x000a, 0x000b, 0x000c, 0x000d, 0x000e,
+	0x000f, 0x0010, 0x0011, 0x0012, 0x0013, 0x0015, 0x0016, 0x0018,
+	0x0019, 0x001b, 0x001c, 0x001e, 0x0020, 0x0021, 0x0023, 0x0025,
+	0x0027, 0x0029, 0x002c, 0x002e, 0x0030, 0x0033, 0x0035, 0x0038,
+	0x003a, 0x003d, 0x0040, 0x0043, 0x0046, 0x0049, 0x004d, 0x0050,
+	0x0054, 0x0057, 0x005b, 0x005f, 0x0063, 0x0067, 0x006b, 0x006f,
+	0x0074, 0x0078, 0x007d, 0x0082, 0x0087, 0x008c, 0x0091, 0x0096,
+	0x009c, 0x00a1, 0x00a7, 0x00ad, 0x00b3, 0x00ba, 0x00c0, 0x00c7,
+	0x00cd, 0x00d4, 0x00db, 0x00e3, 0x00ea, 0x00f2, 0x00fa, 0x0101,
+	0x010a, 0x0112, 0x011b, 0x0123, 0x012c, 0x0135, 0x013f, 0x0148,
+	0x0152, 0x015c, 0x0166, 0x0171, 0x017b, 0x0186, 0x0191, 0x019c,
+	0x01a8, 0x01b4, 0x01c0, 0x01cc, 0x01d9, 0x01e5, 0x01f2, 0x0200,
+	0x020d, 0x021b, 0x0229, 0x0237, 0x0246, 0x0255, 0x0264, 0x0273,
+	0x0283, 0x0293, 0x02a3, 0x02b4, 0x02c4, 0x02d6, 0x02e7, 0x02f9,
+	0x030b, 0x031d, 0x0330, 0x0343, 0x0356, 0x036a, 0x037e, 0x0392,
+	0x03a7, 0x03bc, 0x03d1, 0x03e7, 0x03fc, 0x0413, 0x042a, 0x0441,
+	0x0458, 0x0470, 0x0488, 0x04a0, 0x04b9, 0x04d2, 0x04ec, 0x0506,
+	0x0520, 0x053b, 0x0556, 0x0572, 0x058e, 0x05aa, 0x05c7, 0x05e4,
+	0x0601, 0x061f, 0x063e, 0x065c, 0x067c, 0x069b, 0x06bb, 0x06dc,
+	0x06fd, 0x071e, 0x0740, 0x0762, 0x0784, 0x07a7, 0x07cb, 0x07ef,
+	0x0813, 0x0838, 0x085d, 0x0883, 0x08a9, 0x08d0, 0x08f7, 0x091e,
+	0x0946, 0x096f, 0x0998, 0x09c1, 0x09eb, 0x0a16, 0x0a40, 0x0a6c,
+	0x0a98, 0x0ac4, 0x0af1, 0x0b1e, 0x0b4c, 0x0b7a, 0x0ba9, 0x0bd8,
+	0x0c07, 0x0c38, 0x0c68, 0x0c99, 0x0ccb, 0x0cfd, 0x0d30, 0x0d63,
+	0x0d97, 0x0dcb, 0x0e00, 0x0e35, 0x0e6b, 0x0ea1, 0x0ed7, 0x0f0f,
+	0x0f46, 0x0f7f, 0x0fb7, 0x0ff1, 0x102a, 0x1065, 0x109f, 0x10db,
+	0x1116, 0x1153, 0x118f, 0x11cd, 0x120b, 0x1249, 0x1288, 0x12c7,
+	0x1307, 0x1347, 0x1388, 0x13c9, 0x140b, 0x144d, 0x1490, 0x14d4,
+	0x1517, 0x155c, 0x15a0, 0x15e6, 0x162c, 0x1672, 0x16b9, 0x1700,
+	0x1747, 0x1790, 0x17d8, 0x1821, 0x186b, 0x18b5, 0x1900, 0x194b,
+	0x1996, 0x19e2, 0x1a2e, 0x1a7b, 0x1ac8, 0x1b16, 0x1b64, 0x1bb3,
+	0x1c02, 0x1c51, 0x1ca1, 0x1cf1, 0x1d42, 0x1d93, 0x1de5, 0x1e37,
+	0x1e89, 0x1edc, 0x1f2f, 0x1f82, 0x1fd6, 0x202a, 0x207f, 0x20d4,
+	0x2129, 0x217f, 0x21d5, 0x222c, 0x2282, 0x22da, 0x2331, 0x2389,
+	0x23e1, 0x2439, 0x2492, 0x24eb, 0x2545, 0x259e, 0x25f8, 0x2653,
+	0x26ad, 0x2708, 0x2763, 0x27be, 0x281a, 0x2876, 0x28d2, 0x292e,
+	0x298b, 0x29e7, 0x2a44, 0x2aa1, 0x2aff, 0x2b5c, 0x2bba, 0x2c18,
+	0x2c76, 0x2cd4, 0x2d33, 0x2d91, 0x2df0, 0x2e4f, 0x2eae, 0x2f0d,
+	0x2f6c, 0x2fcc, 0x302b, 0x308b, 0x30ea, 0x314a, 0x31aa, 0x3209,
+	0x3269, 0x32c9, 0x3329, 0x3389, 0x33e9, 0x3449, 0x34a9, 0x3509,
+	0x3569, 0x35c9, 0x3629, 0x3689, 0x36e8, 0x3748, 0x37a8, 0x3807,
+	0x3867, 0x38c6, 0x3926, 0x3985, 0x39e4, 0x3a43, 0x3aa2, 0x3b00,
+	0x3b5f, 0x3bbd, 0x3c1b, 0x3c79, 0x3cd7, 0x3d34, 0x3d92, 0x3def,
+	0x3e4c, 0x3ea8, 0x3f05, 0x3f61, 0x3fbd, 0x4018, 0x4074, 0x40cf,
+	0x4129, 0x4184, 0x41de, 0x4237, 0x4291, 0x42ea, 0x4342, 0x439b,
+	0x43f3, 0x444a, 0x44a1, 0x44f8, 0x454e, 0x45a4, 0x45fa, 0x464f,
+	0x46a4, 0x46f8, 0x474c, 0x479f, 0x47f2, 0x4845, 0x4897, 0x48e9,
+	0x4939, 0x4988, 0x49d8, 0x4a27, 0x4a76, 0x4ac4, 0x4b11, 0x4b5e,
+	0x4bab, 0x4bf6, 0x4c41, 0x4c8c, 0x4cd6, 0x4d1f, 0x4d68, 0x4daf,
+	0x4df7, 0x4e3d, 0x4e84, 0x4ec8, 0x4f0d, 0x4f51, 0x4f94, 0x4fd6,
+	0x5018, 0x5059, 0x5098, 0x50d9, 0x5117, 0x5155, 0x5193, 0x51cf,
+	0x520a, 0x5246, 0x5280, 0x52b8, 0x52f2, 0x532a, 0x5360, 0x5396,
+	0x53cb, 0x5400, 0x5433, 0x5467, 0x5498, 0x54c9, 0x54f9, 0x5529,
+	0x5557, 0x5584, 0x55b1, 0x55dd, 0x5608, 0x5631, 0x565a, 0x5682,
+	0x56a9, 0x56cf, 0x56f5, 0x571a, 0x573d, 0x5760, 0x5781, 0x57a2,
+	0x57c2, 0x57e0, 0x57ff, 0x581c, 0x5837, 0x5853, 0x586c, 0x5885,
+	0x589c, 0x58b4, 0x58ca, 0x58df, 0x58f3, 0x5906, 0x5918, 0x5929,
+	0x593a, 0x5948, 0x5957, 0x5963, 0x5970, 0x597b, 0x5985, 0x598e,
+	0x5997, 0x599e, 0x59a4, 0x59a9, 0x59ad, 0x59b0, 0x59b2, 0x59b3,
+};
+
+static int16_t clampSample(int32_t value)
+{
+	return (int16_t)std::min(std::max(value, -0x8000), 0x7fff);
+}
+
+#ifdef PSCX_SSE2
+static int32_t horizontalSum(__m128i sums)
+{
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sums);
+}
+#endif
+
+// ********************** SpuEnvelope implementation **********************
+void SpuEnvelope::tick(bool exponential, bool decrease, uint32_t shift, uint32_t step)
+{
+	if (m_wait > 0)
+	{
+		m_wait -= 1;
+		return;
+	}
+
+	int32_t delta = decrease ? (int32_t)step - 8 : 7 - (int32_t)step;
+	uint32_t samples = 1;
+	if (shift < 11)
+	{
+		delta *= 1 << (11 - shift);
+	}
+	else
+	{
+		samples <<= shift - 11;
+	}
+
+	if (exponential)
+	{
+		if (decrease)
+		{
+			// Smaller steps as the level goes down
+			delta = delta * m_level / 0x8000;
+		}
+		else if (m_level > 0x6000)
+		{
+			// Slower near the top
+			samples *= 4;
+		}
+	}
+
+	m_level = std::min(std::max(m_level + delta, 0x0), 0x7fff);
+	m_wait = samples - 1;
+}
+
+// ********************** SpuVolume implementation **********************
+void SpuVolume::setConfig(uint16_t config)
+{
+	m_config = config;
+
+	if (config & 0x8000)
+	{
+		// The sweep starts from the current level
+		m_sweep.m_level = std::abs((int32_t)m_level);
+		m_sweep.m_wait = 0x0;
+	}
+	else
+	{
+		// Fixed volume, 15 bit signed
+		m_level = (int16_t)(config << 1);
+	}
+}
+
+void SpuVolume::tick()
+{
+	if (!(m_config & 0x8000)) return;
+
+	m_sweep.tick(m_config & 0x4000, m_config & 0x2000, (m_config >> 2) & 0x1f, m_config & 0x3);
+
+	// Bit 12 inverts the phase
+	m_level = (int16_t)((m_config & 0x1000) ? -m_sweep.m_level : m_sweep.m_level);
+}
+
+// ********************** Spu implementation **********************
+Spu::Spu() :
+	m_ramIndex(0x0),
+	m_voices(),
+	m_endFlags(0x0),
+	m_pitchModulation(0x0),
+	m_noise(0x0),
+	m_noiseTimer(0x0),
+	m_noiseLevel(0x1),
+	m_keyOnPending(0x0),
+	m_keyOffPending(0x0),
+	m_irqFlag(false),
+	m_cycleRemainder(0x0),
+	m_blockFrames(SPU_DEFAULT_BLOCK_FRAMES),
+	m_cdInput(nullptr)
+{
+	memset(m_shadowRegisters, 0x0, sizeof(m_shadowRegisters));
+	for (size_t i = 0; i < SPU_RAM_SIZE; ++i) m_ram[i] = 0xbad;
+
+	for (uint32_t voice = 0; voice < SPU_VOICE_COUNT; ++voice)
+	{
+		m_voices.m_adsrPhase[voice] = ADSR_PHASE_OFF;
+	}
+}
 
 template<typename T>
-void Spu::store(uint32_t offset, T value)
+void Spu::store(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t offset, T value)
 {
 	assert(("Unhandled SPU store", (std::is_same<uint16_t, T>::value)));
+	sync(timeKeeper, irqState);
 
 	// Convert into a halfword index.
 	size_t index = offset >> 1;
@@ -24,6 +223,7 @@ void Spu::store(uint32_t offset, T value)
 		case regmap::voice::CURRENT_ADSR_VOLUME:
 		case regmap::voice::ADPCM_REPEAT_INDEX:
 		{
+			setVoiceRegister((uint32_t)(index >> 3), (uint32_t)(index & 0x7), (uint16_t)value);
 			break;
 		}
 		default:
@@ -37,7 +237,15 @@ void Spu::store(uint32_t offset, T value)
 		switch (index)
 		{
 		case regmap::MAIN_VOLUME_LEFT:
+		{
+			m_mainLeft.setConfig((uint16_t)value);
+			break;
+		}
 		case regmap::MAIN_VOLUME_RIGHT:
+		{
+			m_mainRight.setConfig((uint16_t)value);
+			break;
+		}
 		case regmap::REVERB_VOLUME_LEFT:
 		case regmap::REVERB_VOLUME_RIGHT:
 		{
@@ -45,33 +253,60 @@ void Spu::store(uint32_t offset, T value)
 		}
 		case regmap::VOICE_ON_LOW:
 		{
-			m_shadowRegisters[regmap::VOICE_STATUS_LOW] |= value;
+			m_keyOnPending |= (uint32_t)(uint16_t)value;
 			break;
 		}
 		case regmap::VOICE_ON_HIGH:
 		{
-			m_shadowRegisters[regmap::VOICE_STATUS_HIGH] |= value;
+			m_keyOnPending |= ((uint32_t)value & 0xff) << 16;
 			break;
 		}
 		case regmap::VOICE_OFF_LOW:
 		{
-			m_shadowRegisters[regmap::VOICE_STATUS_LOW] &= ~value;
+			m_keyOffPending |= (uint32_t)(uint16_t)value;
 			break;
 		}
 		case regmap::VOICE_OFF_HIGH:
 		{
-			m_shadowRegisters[regmap::VOICE_STATUS_HIGH] &= ~value;
+			m_keyOffPending |= ((uint32_t)value & 0xff) << 16;
 			break;
 		}
 		case regmap::VOICE_PITCH_MOD_EN_LOW:
+		{
+			// Voice 0 can't be modulated
+			m_pitchModulation = (m_pitchModulation & 0xffff0000) | ((uint32_t)(uint16_t)value & 0xfffe);
+			break;
+		}
 		case regmap::VOICE_PITCH_MOD_EN_HIGH:
+		{
+			m_pitchModulation = (m_pitchModulation & 0xffff) | (((uint32_t)value & 0xff) << 16);
+			break;
+		}
 		case regmap::VOICE_NOISE_EN_LOW:
+		{
+			m_noise = (m_noise & 0xffff0000) | (uint32_t)(uint16_t)value;
+			break;
+		}
 		case regmap::VOICE_NOISE_EN_HIGH:
+		{
+			m_noise = (m_noise & 0xffff) | (((uint32_t)value & 0xff) << 16);
+			break;
+		}
 		case regmap::VOICE_REVERB_EN_LOW:
 		case regmap::VOICE_REVERB_EN_HIGH:
+		{
+			// 16 voices per register
+			uint32_t first = (index == regmap::VOICE_REVERB_EN_LOW) ? 0 : 16;
+			for (uint32_t voice = first; voice < std::min(first + 16, SPU_VOICE_COUNT); ++voice)
+			{
+				m_voices.m_reverbMask[voice] = ((uint16_t)value & (1 << (voice - first))) ? -1 : 0;
+			}
+			break;
+		}
 		case regmap::VOICE_STATUS_LOW:
 		case regmap::VOICE_STATUS_HIGH:
 		case regmap::REVERB_BASE:
+		case regmap::IRQ_ADDRESS:
 		{
 			break;
 		}
@@ -82,7 +317,7 @@ void Spu::store(uint32_t offset, T value)
 		}
 		case regmap::TRANSFER_FIFO:
 		{
-			fifoWrite(value);
+			fifoWrite(irqState, value);
 			break;
 		}
 		case regmap::CONTROL:
@@ -143,26 +378,39 @@ void Spu::store(uint32_t offset, T value)
 
 	if (index < 0x100)
 		m_shadowRegisters[index] = value;
+
+	// Key on, the IRQ address or the voice addresses may have changed
+	scheduleNextSync(timeKeeper);
 }
 
-template void Spu::store<uint32_t>(uint32_t, uint32_t);
-template void Spu::store<uint16_t>(uint32_t, uint16_t);
-template void Spu::store<uint8_t >(uint32_t, uint8_t );
+template void Spu::store<uint32_t>(TimeKeeper&, InterruptState&, uint32_t, uint32_t);
+template void Spu::store<uint16_t>(TimeKeeper&, InterruptState&, uint32_t, uint16_t);
+template void Spu::store<uint8_t >(TimeKeeper&, InterruptState&, uint32_t, uint8_t );
 
 template<typename T>
-T Spu::load(uint32_t offset)
+T Spu::load(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t offset)
 {
 	assert(("Unhandled SPU load", (std::is_same<uint16_t, T>::value)));
+	sync(timeKeeper, irqState);
 
 	size_t index = offset >> 1;
 
 	uint16_t shadowRegister = 0x0;
 	if (index < 0xc0)
 	{
+		uint32_t voice = (uint32_t)(index >> 3);
 		switch (index & 0x7)
 		{
 		case regmap::voice::CURRENT_ADSR_VOLUME:
+		{
+			shadowRegister = (uint16_t)m_voices.m_adsr[voice].m_level;
+			break;
+		}
 		case regmap::voice::ADPCM_REPEAT_INDEX:
+		{
+			shadowRegister = (uint16_t)(m_voices.m_repeatAddress[voice] >> 2);
+			break;
+		}
 		default:
 		{
 			shadowRegister = m_shadowRegisters[index];
@@ -180,24 +428,37 @@ T Spu::load(uint32_t offset)
 		case regmap::VOICE_OFF_HIGH:
 		case regmap::VOICE_REVERB_EN_LOW:
 		case regmap::VOICE_REVERB_EN_HIGH:
-		case regmap::VOICE_STATUS_LOW:
-		case regmap::VOICE_STATUS_HIGH:
 		case regmap::TRANSFER_START_INDEX:
 		case regmap::CONTROL:
 		case regmap::TRANSFER_CONTROL:
+		case regmap::IRQ_ADDRESS:
 		{
 			shadowRegister = m_shadowRegisters[index];
 			break;
 		}
+		case regmap::VOICE_STATUS_LOW:
+		{
+			shadowRegister = (uint16_t)m_endFlags;
+			break;
+		}
+		case regmap::VOICE_STATUS_HIGH:
+		{
+			shadowRegister = (uint16_t)(m_endFlags >> 16);
+			break;
+		}
 		case regmap::STATUS:
 		{
 			shadowRegister = getStatus();
 			break;
 		}
 		case regmap::CURRENT_VOLUME_LEFT:
+		{
+			shadowRegister = (uint16_t)m_mainLeft.m_level;
+			break;
+		}
 		case regmap::CURRENT_VOLUME_RIGHT:
 		{
-			shadowRegister = m_shadowRegisters[index];
+			shadowRegister = (uint16_t)m_mainRight.m_level;
 			break;
 		}
 		default:
@@ -209,23 +470,708 @@ T Spu::load(uint32_t offset)
 	return static_cast<T>(shadowRegister);
 }
 
-template uint32_t Spu::load<uint32_t>(uint32_t);
-template uint16_t Spu::load<uint16_t>(uint32_t);
-template uint8_t  Spu::load<uint8_t >(uint32_t);
+template uint32_t Spu::load<uint32_t>(TimeKeeper&, InterruptState&, uint32_t);
+template uint16_t Spu::load<uint16_t>(TimeKeeper&, InterruptState&, uint32_t);
+template uint8_t  Spu::load<uint8_t >(TimeKeeper&, InterruptState&, uint32_t);
+
+void Spu::sync(TimeKeeper& timeKeeper, InterruptState& irqState)
+{
+	Cycles delta = timeKeeper.sync(Peripheral::PERIPHERAL_SPU);
+
+	m_cycleRemainder += delta;
+	size_t frames = (size_t)(m_cycleRemainder / SPU_CYCLES_PER_SAMPLE);
+	m_cycleRemainder %= SPU_CYCLES_PER_SAMPLE;
+
+	run(irqState, frames);
+
+	scheduleNextSync(timeKeeper);
+}
+
+void Spu::setBlockSize(uint32_t frames)
+{
+	m_blockFrames = std::min(std::max(frames, SPU_MIN_BLOCK_FRAMES), SPU_MAX_BLOCK_FRAMES);
+}
+
+void Spu::scheduleNextSync(TimeKeeper& timeKeeper)
+{
+	uint32_t frames = std::min(m_blockFrames, predictIrq(m_blockFrames));
+
+	timeKeeper.setNextSyncDelta(Peripheral::PERIPHERAL_SPU, frames * SPU_CYCLES_PER_SAMPLE - m_cycleRemainder);
+}
+
+uint32_t Spu::predictIrq(uint32_t maxFrames) const
+{
+	if (!(getControl() & 0x40) || m_irqFlag) return ~0u;
+
+	const SpuVoices& voices = m_voices;
+	uint32_t irqAddress = (uint32_t)m_shadowRegisters[regmap::IRQ_ADDRESS] << 2;
+	uint32_t earliest = ~0u;
+
+	auto containsIrq = [&](uint32_t address)
+	{
+		return ((irqAddress - address) & (SPU_RAM_SIZE - 1)) < SPU_BLOCK_HALFWORDS;
+	};
+
+	for (uint32_t voice = 0; voice < SPU_VOICE_COUNT; ++voice)
+	{
+		uint32_t counter = voices.m_counter[voice];
+		uint32_t address = voices.m_currentAddress[voice];
+		uint32_t repeat = voices.m_repeatAddress[voice];
+		uint8_t flags = voices.m_blockFlags[voice];
+
+		// A pending key on loads the start block during the next sample,
+		// which then advances the counter like any other
+		if (m_keyOnPending & (1 << voice))
+		{
+			counter = 0x0;
+			address = voices.m_startAddress[voice];
+			if (containsIrq(address))
+			{
+				return 1;
+			}
+
+			flags = (uint8_t)(m_ram[address] >> 8);
+			if (flags & 0x4)
+			{
+				repeat = address;
+			}
+		}
+
+		// The modulated pitch can't be known in advance, assume the
+		// fastest one
+		uint32_t step = (m_pitchModulation & (1 << voice)) ? 0x4000 : std::min<uint32_t>(voices.m_pitch[voice], 0x4000);
+		if (step == 0x0) continue;
+
+		// Follow the blocks the voice will load, like nextBlock does
+		const uint32_t blockEnd = SPU_SAMPLES_PER_BLOCK << 12;
+		uint32_t frame = 0;
+		while (true)
+		{
+			uint32_t samples = (blockEnd - counter + step - 1) / step;
+			frame += samples;
+			if (frame > maxFrames || frame >= earliest) break;
+
+			counter = counter + samples * step - blockEnd;
+
+			address = (flags & 0x1) ? repeat : ((address + SPU_BLOCK_HALFWORDS) & (SPU_RAM_SIZE - 1));
+			if (containsIrq(address))
+			{
+				earliest = frame;
+				break;
+			}
+
+			flags = (uint8_t)(m_ram[address] >> 8);
+			if (flags & 0x4)
+			{
+				repeat = address;
+			}
+		}
+	}
+
+	return earliest;
+}
+
+uint16_t Spu::getStatus() const
+{
+	return (getControl() & 0x3f) | ((uint16_t)m_irqFlag << 6);
+}
 
 void Spu::setControl(uint16_t value)
 {
-	assert(("Unhandled SPU control", (value & 0x3f4a) == 0x0));
+	// Disabling the interrupt acknowledges it
+	if (!(value & 0x40))
+	{
+		m_irqFlag = false;
+	}
+
+	// Bits 1 and 3 enable the external audio input, nothing is connected
+	assert(("Unhandled SPU control", (value & 0x000a) == 0x0));
 }
 
 void Spu::setTransferControl(uint16_t value)
 {
-	assert(("Unhandled SPU RAM access pattern", value == 0x4));
+	// The transfer type is read from the shadow register by writeRam
+	if (((value >> 1) & 0x7) != 0x2)
+	{
+		LOG("SPU RAM transfer type 0x" << std::hex << ((value >> 1) & 0x7));
+	}
+}
+
+void Spu::fifoWrite(InterruptState& irqState, uint16_t value)
+{
+	uint8_t bytes[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+	writeRam(irqState, bytes, 1);
+}
+
+void Spu::dmaWrite(TimeKeeper& timeKeeper, InterruptState& irqState, const uint8_t* data, uint32_t halfwords)
+{
+	// The voices must not see the new samples before the current date
+	sync(timeKeeper, irqState);
+
+	writeRam(irqState, data, halfwords);
+
+	// The blocks ahead of the voices may have changed
+	scheduleNextSync(timeKeeper);
+}
+
+void Spu::dmaRead(TimeKeeper& timeKeeper, InterruptState& irqState, uint8_t* data, uint32_t halfwords)
+{
+	sync(timeKeeper, irqState);
+
+	checkIrq(m_ramIndex, halfwords, irqState);
+
+	// SPU RAM is kept in host order, the supported hosts are little endian
+	// like the console
+	while (halfwords > 0)
+	{
+		uint32_t count = std::min(halfwords, SPU_RAM_SIZE - m_ramIndex);
+		memcpy(data, m_ram + m_ramIndex, count * sizeof(uint16_t));
+
+		data += count * sizeof(uint16_t);
+		halfwords -= count;
+		m_ramIndex = (m_ramIndex + count) & (SPU_RAM_SIZE - 1);
+	}
+}
+
+void Spu::writeRam(InterruptState& irqState, const uint8_t* data, uint32_t halfwords)
+{
+	checkIrq(m_ramIndex, halfwords, irqState);
+	invalidateBlocks(m_ramIndex, halfwords);
+
+	uint32_t type = (m_shadowRegisters[regmap::TRANSFER_CONTROL] >> 1) & 0x7;
+	if (type != 0x2)
+	{
+		// The patterns apply to whole groups, single FIFO writes and the
+		// end of an odd sized transfer are stored as they are
+		const uint8_t* pattern = SPU_TRANSFER_PATTERNS[type];
+		uint32_t groups = halfwords / SPU_BLOCK_HALFWORDS;
+		for (uint32_t group = 0; group < groups; ++group)
+		{
+			uint16_t source[SPU_BLOCK_HALFWORDS];
+			memcpy(source, data + group * sizeof(source), sizeof(source));
+
+			for (uint32_t i = 0; i < SPU_BLOCK_HALFWORDS; ++i)
+			{
+				m_ram[m_ramIndex] = source[pattern[i]];
+				m_ramIndex = (m_ramIndex + 1) & (SPU_RAM_SIZE - 1);
+			}
+		}
+
+		data += groups * SPU_BLOCK_HALFWORDS * sizeof(uint16_t);
+		halfwords -= groups * SPU_BLOCK_HALFWORDS;
+	}
+
+	// Normal transfer, one copy per pass over the end of the RAM
+	while (halfwords > 0)
+	{
+		uint32_t count = std::min(halfwords, SPU_RAM_SIZE - m_ramIndex);
+		memcpy(m_ram + m_ramIndex, data, count * sizeof(uint16_t));
+
+		data += count * sizeof(uint16_t);
+		halfwords -= count;
+		m_ramIndex = (m_ramIndex + count) & (SPU_RAM_SIZE - 1);
+	}
+}
+
+void Spu::run(InterruptState& irqState, size_t frames)
+{
+	int16_t samples[2 * 128];
+
+	while (frames > 0)
+	{
+		size_t count = std::min(frames, _countof(samples) / 2);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			tickNoise();
+			runVoices(irqState);
+
+			int32_t left = 0;
+			int32_t right = 0;
+			int32_t reverbLeft = 0;
+			int32_t reverbRight = 0;
+			mixVoices(left, right, reverbLeft, reverbRight);
+
+			// The CD FIFO is drained even when the input is disabled so
+			// that it doesn't stall the CD-ROM
+			int16_t cdLeft = 0;
+			int16_t cdRight = 0;
+			if (m_cdInput)
+			{
+				m_cdInput->pop(cdLeft, cdRight);
+			}
+			cdLeft = (int16_t)((cdLeft * (int16_t)m_shadowRegisters[regmap::CD_VOLUME_LEFT]) >> 15);
+			cdRight = (int16_t)((cdRight * (int16_t)m_shadowRegisters[regmap::CD_VOLUME_RIGHT]) >> 15);
+
+			// Bit 2 sends the CD audio to the reverb
+			if (getControl() & 0x4)
+			{
+				reverbLeft += cdLeft;
+				reverbRight += cdRight;
+			}
+
+			// Bit 7 lets the reverb write its work area, it's still read
+			// when cleared
+			int16_t echoLeft;
+			int16_t echoRight;
+			m_reverb.run(m_shadowRegisters, m_ram, getControl() & 0x80,
+				clampSample(reverbLeft), clampSample(reverbRight), echoLeft, echoRight);
+			left += (echoLeft * (int16_t)m_shadowRegisters[regmap::REVERB_VOLUME_LEFT]) >> 15;
+			right += (echoRight * (int16_t)m_shadowRegisters[regmap::REVERB_VOLUME_RIGHT]) >> 15;
+
+			// Bit 15 enables the SPU, bit 14 unmutes it. Neither affect
+			// the CD input.
+			if ((getControl() & 0xc000) != 0xc000)
+			{
+				left = 0;
+				right = 0;
+			}
+
+			m_mainLeft.tick();
+			m_mainRight.tick();
+			left = (clampSample(left) * m_mainLeft.m_level) >> 15;
+			right = (clampSample(right) * m_mainRight.m_level) >> 15;
+
+			if (getControl() & 0x1)
+			{
+				left += cdLeft;
+				right += cdRight;
+			}
+
+			samples[i * 2] = clampSample(left);
+			samples[i * 2 + 1] = clampSample(right);
+		}
+
+		m_audioOut.push(samples, count);
+		frames -= count;
+	}
+}
+
+void Spu::runVoices(InterruptState& irqState)
+{
+	SpuVoices& voices = m_voices;
+
+	// Key on and off take effect on the next sample
+	if (m_keyOnPending | m_keyOffPending)
+	{
+		for (uint32_t voice = 0; voice < SPU_VOICE_COUNT; ++voice)
+		{
+			if (m_keyOffPending & (1 << voice))
+			{
+				keyOff(voice);
+			}
+			if (m_keyOnPending & (1 << voice))
+			{
+				keyOn(voice, irqState);
+			}
+		}
+		m_keyOnPending = 0x0;
+		m_keyOffPending = 0x0;
+	}
+
+	for (uint32_t voice = 0; voice < SPU_VOICE_COUNT; ++voice)
+	{
+		uint32_t counter = voices.m_counter[voice];
+
+		int32_t step = voices.m_pitch[voice];
+		if (m_pitchModulation & (1 << voice))
+		{
+			// Uses the previous voice's output of the previous sample,
+			// one sample late compared to the hardware
+			int32_t factor = (int32_t)voices.m_output[voice - 1] + 0x8000;
+			step = (((int32_t)(int16_t)step * factor) >> 15) & 0xffff;
+		}
+		step = std::min(step, 0x4000);
+
+		if (m_noise & (1 << voice))
+		{
+			voices.m_sample[voice] = (int16_t)m_noiseLevel;
+		}
+		else if (voices.m_adsrPhase[voice] == ADSR_PHASE_OFF && voices.m_adsr[voice].m_level == 0x0)
+		{
+			// Silent voices still play, for ENDX and the IRQ, but don't
+			// need the interpolation
+			voices.m_sample[voice] = 0x0;
+		}
+		else
+		{
+			const int16_t* samples = voices.m_samples[voice] + (counter >> 12);
+			uint32_t i = (counter >> 4) & 0xff;
+
+			int32_t sample = (GAUSS_TABLE[0x0ff - i] * samples[0]) >> 15;
+			sample += (GAUSS_TABLE[0x1ff - i] * samples[1]) >> 15;
+			sample += (GAUSS_TABLE[0x100 + i] * samples[2]) >> 15;
+			sample += (GAUSS_TABLE[0x000 + i] * samples[3]) >> 15;
+			voices.m_sample[voice] = clampSample(sample);
+		}
+
+		counter += step;
+		if ((counter >> 12) >= SPU_SAMPLES_PER_BLOCK)
+		{
+			counter -= SPU_SAMPLES_PER_BLOCK << 12;
+			voices.m_counter[voice] = counter;
+			nextBlock(voice, irqState);
+		}
+		else
+		{
+			voices.m_counter[voice] = counter;
+		}
+
+		tickAdsr(voice);
+
+		voices.m_left[voice].tick();
+		voices.m_right[voice].tick();
+		voices.m_volumeLeft[voice] = voices.m_left[voice].m_level;
+		voices.m_volumeRight[voice] = voices.m_right[voice].m_level;
+	}
+}
+
+void Spu::mixVoices(int32_t& left, int32_t& right, int32_t& reverbLeft, int32_t& reverbRight)
+{
+	SpuVoices& voices = m_voices;
+
+#ifdef PSCX_SSE2
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i sumLeft = _mm_setzero_si128();
+	__m128i sumRight = _mm_setzero_si128();
+	__m128i sumReverbLeft = _mm_setzero_si128();
+	__m128i sumReverbRight = _mm_setzero_si128();
+
+	for (uint32_t voice = 0; voice < SPU_VOICE_COUNT; voice += 8)
+	{
+		__m128i output = mulQ15(_mm_load_si128((const __m128i*)(voices.m_sample + voice)), _mm_load_si128((const __m128i*)(voices.m_envelope + voice)));
+		_mm_store_si128((__m128i*)(voices.m_output + voice), output);
+
+		// madd with ones adds pairs of voices in 32 bits
+		__m128i outLeft = mulQ15(output, _mm_load_si128((const __m128i*)(voices.m_volumeLeft + voice)));
+		__m128i outRight = mulQ15(output, _mm_load_si128((const __m128i*)(voices.m_volumeRight + voice)));
+		sumLeft = _mm_add_epi32(sumLeft, _mm_madd_epi16(outLeft, ones));
+		sumRight = _mm_add_epi32(sumRight, _mm_madd_epi16(outRight, ones));
+
+		// The mask selects the voices sent to the reverb
+		__m128i reverbMask = _mm_load_si128((const __m128i*)(voices.m_reverbMask + voice));
+		sumReverbLeft = _mm_add_epi32(sumReverbLeft, _mm_madd_epi16(_mm_and_si128(outLeft, reverbMask), ones));
+		sumReverbRight = _mm_add_epi32(sumReverbRight, _mm_madd_epi16(_mm_and_si128(outRight, reverbMask), ones));
+	}
+
+	left = horizontalSum(sumLeft);
+	right = horizontalSum(sumRight);
+	reverbLeft = horizontalSum(sumReverbLeft);
+	reverbRight = horizontalSum(sumReverbRight);
+#else
+	left = 0;
+	right = 0;
+	reverbLeft = 0;
+	reverbRight = 0;
+	for (uint32_t voice = 0; voice < SPU_VOICE_COUNT; ++voice)
+	{
+		int32_t output = (voices.m_sample[voice] * voices.m_envelope[voice]) >> 15;
+		voices.m_output[voice] = (int16_t)output;
+
+		int32_t outLeft = (output * voices.m_volumeLeft[voice]) >> 15;
+		int32_t outRight = (output * voices.m_volumeRight[voice]) >> 15;
+		left += outLeft;
+		right += outRight;
+		reverbLeft += outLeft & voices.m_reverbMask[voice];
+		reverbRight += outRight & voices.m_reverbMask[voice];
+	}
+#endif
+}
+
+void Spu::keyOn(uint32_t voice, InterruptState& irqState)
+{
+	SpuVoices& voices = m_voices;
+
+	voices.m_currentAddress[voice] = voices.m_startAddress[voice];
+	voices.m_counter[voice] = 0x0;
+	voices.m_old[voice] = 0x0;
+	voices.m_older[voice] = 0x0;
+	memset(voices.m_samples[voice], 0x0, sizeof(voices.m_samples[voice]));
+
+	voices.m_adsrPhase[voice] = ADSR_PHASE_ATTACK;
+	voices.m_adsr[voice] = SpuEnvelope();
+	voices.m_envelope[voice] = 0x0;
+
+	m_endFlags &= ~(1 << voice);
+
+	loadBlock(voice, irqState);
+}
+
+void Spu::keyOff(uint32_t voice)
+{
+	if (m_voices.m_adsrPhase[voice] != ADSR_PHASE_OFF)
+	{
+		m_voices.m_adsrPhase[voice] = ADSR_PHASE_RELEASE;
+		m_voices.m_adsr[voice].m_wait = 0x0;
+	}
+}
+
+void Spu::loadBlock(uint32_t voice, InterruptState& irqState)
+{
+	SpuVoices& voices = m_voices;
+	uint32_t address = voices.m_currentAddress[voice];
+
+	checkIrq(address, SPU_BLOCK_HALFWORDS, irqState);
+
+	uint8_t flags = (uint8_t)(m_ram[address] >> 8);
+	voices.m_blockFlags[voice] = flags;
+
+	// Loop start
+	if (flags & 0x4)
+	{
+		voices.m_repeatAddress[voice] = address;
+	}
+
+	// The interpolation needs the end of the previous block
+	int16_t* samples = voices.m_samples[voice];
+	samples[0] = samples[SPU_SAMPLES_PER_BLOCK];
+	samples[1] = samples[SPU_SAMPLES_PER_BLOCK + 1];
+	samples[2] = samples[SPU_SAMPLES_PER_BLOCK + 2];
+
+	memcpy(samples + 3, decodeBlock(voice, address), SPU_SAMPLES_PER_BLOCK * sizeof(int16_t));
+}
+
+void Spu::nextBlock(uint32_t voice, InterruptState& irqState)
+{
+	SpuVoices& voices = m_voices;
+	uint8_t flags = voices.m_blockFlags[voice];
+
+	if (flags & 0x1)
+	{
+		// Loop end: jump to the repeat address. Without the repeat flag
+		// the voice is released and muted.
+		m_endFlags |= 1 << voice;
+		voices.m_currentAddress[voice] = voices.m_repeatAddress[voice];
+
+		if (!(flags & 0x2))
+		{
+			voices.m_adsrPhase[voice] = ADSR_PHASE_OFF;
+			voices.m_adsr[voice].m_level = 0x0;
+		}
+	}
+	else
+	{
+		voices.m_currentAddress[voice] = (voices.m_currentAddress[voice] + SPU_BLOCK_HALFWORDS) & (SPU_RAM_SIZE - 1);
+	}
+
+	loadBlock(voice, irqState);
 }
 
-void Spu::fifoWrite(uint16_t value)
+const int16_t* Spu::decodeBlock(uint32_t voice, uint32_t address)
 {
-	LOG("SPU RAM store 0x" << std::hex << m_ramIndex << " 0x" << value);
-	m_ram[m_ramIndex] = value;
-	m_ramIndex = (m_ramIndex + 1) & 0x3ffff;
+	SpuVoices& voices = m_voices;
+	SpuCachedBlock& block = m_blockCache[(address / SPU_BLOCK_HALFWORDS) % SPU_BLOCK_CACHE_SIZE];
+
+	// The reverb writes its work area without invalidating the cache,
+	// blocks in there are always decoded
+	uint32_t reverbBase = (uint32_t)m_shadowRegisters[regmap::REVERB_BASE] << 2;
+	if ((getControl() & 0x80) && address + SPU_BLOCK_HALFWORDS > reverbBase)
+	{
+		block.m_address = ~0u;
+	}
+
+	if (block.m_address != address || block.m_old != voices.m_old[voice] || block.m_older != voices.m_older[voice])
+	{
+		block.m_address = address;
+		block.m_old = voices.m_old[voice];
+		block.m_older = voices.m_older[voice];
+
+		uint16_t header = m_ram[address];
+		uint32_t shift = header & 0xf;
+		uint32_t filter = std::min((header >> 4) & 0x7, 4);
+
+		// Shifts 13 to 15 behave like 9
+		if (shift > 12)
+		{
+			shift = 9;
+		}
+
+		int32_t positive = SPU_FILTER_POSITIVE[filter];
+		int32_t negative = SPU_FILTER_NEGATIVE[filter];
+		int32_t old = block.m_old;
+		int32_t older = block.m_older;
+
+		for (uint32_t i = 0; i < SPU_SAMPLES_PER_BLOCK; ++i)
+		{
+			uint16_t data = m_ram[(address + 1 + i / 4) & (SPU_RAM_SIZE - 1)];
+			int32_t sample = (int16_t)(((data >> ((i & 3) * 4)) & 0xf) << 12);
+
+			sample = (sample >> shift) + ((old * positive + older * negative + 32) >> 6);
+			sample = clampSample(sample);
+
+			older = old;
+			old = sample;
+			block.m_samples[i] = (int16_t)sample;
+		}
+	}
+
+	voices.m_old[voice] = block.m_samples[SPU_SAMPLES_PER_BLOCK - 1];
+	voices.m_older[voice] = block.m_samples[SPU_SAMPLES_PER_BLOCK - 2];
+	return block.m_samples;
+}
+
+void Spu::invalidateBlocks(uint32_t address, uint32_t size)
+{
+	// Large uploads, e.g. at level load, replace most of the samples
+	if (size >= SPU_BLOCK_CACHE_SIZE * SPU_BLOCK_HALFWORDS)
+	{
+		for (SpuCachedBlock& block : m_blockCache)
+		{
+			block.m_address = ~0u;
+		}
+		return;
+	}
+
+	// Blocks start on 4 halfword boundaries, the one starting 4 halfwords
+	// before 'address' overlaps it too
+	uint32_t first = (address & ~0x3) - 4;
+	for (uint32_t start = first; start != ((address + size + 3) & ~0x3); start += 4)
+	{
+		uint32_t blockAddress = start & (SPU_RAM_SIZE - 1);
+		SpuCachedBlock& block = m_blockCache[(blockAddress / SPU_BLOCK_HALFWORDS) % SPU_BLOCK_CACHE_SIZE];
+		if (block.m_address == blockAddress)
+		{
+			block.m_address = ~0u;
+		}
+	}
+}
+
+void Spu::tickAdsr(uint32_t voice)
+{
+	SpuVoices& voices = m_voices;
+	SpuEnvelope& envelope = voices.m_adsr[voice];
+
+	uint32_t low = voices.m_adsrConfig[voice] & 0xffff;
+	uint32_t high = voices.m_adsrConfig[voice] >> 16;
+
+	switch (voices.m_adsrPhase[voice])
+	{
+	case ADSR_PHASE_ATTACK:
+	{
+		envelope.tick(low & 0x8000, false, (low >> 10) & 0x1f, (low >> 8) & 0x3);
+		if (envelope.m_level == 0x7fff)
+		{
+			voices.m_adsrPhase[voice] = ADSR_PHASE_DECAY;
+			envelope.m_wait = 0x0;
+		}
+		break;
+	}
+	case ADSR_PHASE_DECAY:
+	{
+		envelope.tick(true, true, (low >> 4) & 0xf, 0x0);
+
+		int32_t sustainLevel = std::min(((int32_t)(low & 0xf) + 1) * 0x800, 0x7fff);
+		if (envelope.m_level <= sustainLevel)
+		{
+			voices.m_adsrPhase[voice] = ADSR_PHASE_SUSTAIN;
+			envelope.m_wait = 0x0;
+		}
+		break;
+	}
+	case ADSR_PHASE_SUSTAIN:
+	{
+		// Lasts until the voice is keyed off
+		envelope.tick(high & 0x8000, high & 0x4000, (high >> 8) & 0x1f, (high >> 6) & 0x3);
+		break;
+	}
+	case ADSR_PHASE_RELEASE:
+	{
+		envelope.tick(high & 0x20, true, high & 0x1f, 0x0);
+		if (envelope.m_level == 0x0)
+		{
+			voices.m_adsrPhase[voice] = ADSR_PHASE_OFF;
+		}
+		break;
+	}
+	case ADSR_PHASE_OFF:
+	{
+		break;
+	}
+	}
+
+	voices.m_envelope[voice] = (int16_t)envelope.m_level;
+}
+
+void Spu::tickNoise()
+{
+	uint16_t control = getControl();
+	uint32_t shift = (control >> 10) & 0xf;
+	int32_t step = ((control >> 8) & 0x3) + 4;
+
+	uint16_t parity = ((m_noiseLevel >> 15) ^ (m_noiseLevel >> 12) ^ (m_noiseLevel >> 11) ^ (m_noiseLevel >> 10) ^ 1) & 1;
+
+	m_noiseTimer -= step;
+	if (m_noiseTimer < 0)
+	{
+		m_noiseLevel = (uint16_t)(m_noiseLevel * 2 + parity);
+		m_noiseTimer += 0x20000 >> shift;
+		if (m_noiseTimer < 0)
+		{
+			m_noiseTimer += 0x20000 >> shift;
+		}
+	}
+}
+
+void Spu::checkIrq(uint32_t address, uint32_t size, InterruptState& irqState)
+{
+	if (!(getControl() & 0x40) || m_irqFlag) return;
+
+	uint32_t irqAddress = (uint32_t)m_shadowRegisters[regmap::IRQ_ADDRESS] << 2;
+	if (((irqAddress - address) & (SPU_RAM_SIZE - 1)) < size)
+	{
+		m_irqFlag = true;
+		irqState.raiseAssert(Interrupt::INTERRUPT_SPU);
+	}
+}
+
+void Spu::setVoiceRegister(uint32_t voice, uint32_t index, uint16_t value)
+{
+	SpuVoices& voices = m_voices;
+
+	switch (index)
+	{
+	case regmap::voice::VOLUME_LEFT:
+	{
+		voices.m_left[voice].setConfig(value);
+		voices.m_volumeLeft[voice] = voices.m_left[voice].m_level;
+		break;
+	}
+	case regmap::voice::VOLUME_RIGHT:
+	{
+		voices.m_right[voice].setConfig(value);
+		voices.m_volumeRight[voice] = voices.m_right[voice].m_level;
+		break;
+	}
+	case regmap::voice::ADPCM_SAMPLE_RATE:
+	{
+		voices.m_pitch[voice] = value;
+		break;
+	}
+	case regmap::voice::ADPCM_START_INDEX:
+	{
+		// Addresses are in 8 byte units
+		voices.m_startAddress[voice] = (uint32_t)value << 2;
+		break;
+	}
+	case regmap::voice::ADPCM_ADSR_LOW:
+	{
+		voices.m_adsrConfig[voice] = (voices.m_adsrConfig[voice] & 0xffff0000) | value;
+		break;
+	}
+	case regmap::voice::ADPCM_ADSR_HIGH:
+	{
+		voices.m_adsrConfig[voice] = (voices.m_adsrConfig[voice] & 0xffff) | ((uint32_t)value << 16);
+		break;
+	}
+	case regmap::voice::CURRENT_ADSR_VOLUME:
+	{
+		voices.m_adsr[voice].m_level = value & 0x7fff;
+		break;
+	}
+	case regmap::voice::ADPCM_REPEAT_INDEX:
+	{
+		voices.m_repeatAddress[voice] = (uint32_t)value << 2;
+		break;
+	}
+	}
 }
@@ -3,6 +3,12 @@
 #include <cstdint>
 #include <memory.h>
 
+#include "pscx_audio.h"
+#include "pscx_audio_sink.h"
+#include "pscx_timekeeper.h"
+#include "pscx_interrupts.h"
+#include "pscx_reverb.h"
+
 namespace regmap 
 {
 	// SPU register map: offset from the base 
@@ -39,6 +45,7 @@ namespace regmap
 	const size_t VOICE_STATUS_HIGH = 0xcf;
 
 	const size_t REVERB_BASE = 0xd1;
+	const size_t IRQ_ADDRESS = 0xd2;
 	const size_t TRANSFER_START_INDEX = 0xd3;
 	const size_t TRANSFER_FIFO = 0xd4;
 	const size_t CONTROL = 0xd5;
@@ -85,40 +92,267 @@ namespace regmap
 	const size_t REVERB_INPUT_VOLUME_RIGHT = 0xff;
 }
 
+// Number of voices
+const uint32_t SPU_VOICE_COUNT = 24;
+
+// SPU RAM size in halfwords, 512kB
+const uint32_t SPU_RAM_SIZE = 256 * 1024;
+
+// The SPU produces one stereo sample every 768 CPU cycles ( 44.1kHz )
+const uint32_t SPU_CYCLES_PER_SAMPLE = 768;
+
+// The SPU is run by blocks of samples between two syncs, unless a
+// register access or an IRQ needs it to catch up earlier
+const uint32_t SPU_MIN_BLOCK_FRAMES = 32;
+const uint32_t SPU_MAX_BLOCK_FRAMES = 256;
+const uint32_t SPU_DEFAULT_BLOCK_FRAMES = 128;
+
+// ADPCM blocks: one header halfword followed by 28 4 bit samples
+const uint32_t SPU_BLOCK_HALFWORDS = 8;
+const uint32_t SPU_SAMPLES_PER_BLOCK = 28;
+
+// Decoded blocks kept in the cache, direct mapped on the block address
+const uint32_t SPU_BLOCK_CACHE_SIZE = 1024;
+
+enum AdsrPhase
+{
+	ADSR_PHASE_ATTACK,
+	ADSR_PHASE_DECAY,
+	ADSR_PHASE_SUSTAIN,
+	ADSR_PHASE_RELEASE,
+	ADSR_PHASE_OFF
+};
+
+// Volume level changing over time, shared by the ADSR envelopes and the
+// volume sweeps. The level goes from 0 to 0x7fff.
+struct SpuEnvelope
+{
+	SpuEnvelope() :
+		m_level(0x0),
+		m_wait(0x0)
+	{}
+
+	// Advance by one sample. 'step' is the 2 bit step field of the
+	// register, 'shift' the 5 bit shift.
+	void tick(bool exponential, bool decrease, uint32_t shift, uint32_t step);
+
+	int32_t m_level;
+
+	// Samples left until the next change
+	uint32_t m_wait;
+};
+
+// Volume register in sweep mode ( bit 15 ) follows an envelope, otherwise
+// it's a fixed 15 bit level
+struct SpuVolume
+{
+	SpuVolume() :
+		m_config(0x0),
+		m_level(0x0)
+	{}
+
+	void setConfig(uint16_t config);
+	void tick();
+
+	uint16_t m_config;
+	int16_t m_level;
+	SpuEnvelope m_sweep;
+};
+
+// Decoded ADPCM block. The result depends on the two samples preceding
+// the block, an entry is only reused if they match.
+struct SpuCachedBlock
+{
+	SpuCachedBlock() :
+		m_address(~0u),
+		m_old(0x0),
+		m_older(0x0)
+	{}
+
+	// Halfword address of the block in SPU RAM, ~0 when the entry is empty
+	uint32_t m_address;
+	int16_t m_old;
+	int16_t m_older;
+	int16_t m_samples[SPU_SAMPLES_PER_BLOCK];
+};
+
+// State of the 24 voices stored as one array per field, the mixing stage
+// processes 8 voices at once.
+struct SpuVoices
+{
+	// Output of the interpolation or of the noise generator
+	alignas(16) int16_t m_sample[SPU_VOICE_COUNT];
+	// ADSR envelope level
+	alignas(16) int16_t m_envelope[SPU_VOICE_COUNT];
+	// Sample after the envelope, used for pitch modulation
+	alignas(16) int16_t m_output[SPU_VOICE_COUNT];
+	alignas(16) int16_t m_volumeLeft[SPU_VOICE_COUNT];
+	alignas(16) int16_t m_volumeRight[SPU_VOICE_COUNT];
+	// 0xffff for the voices sent to the reverb, 0 for the others
+	alignas(16) int16_t m_reverbMask[SPU_VOICE_COUNT];
+
+	// Position in the current block: sample index in bits 12 and up,
+	// interpolation index in bits 4-11
+	uint32_t m_counter[SPU_VOICE_COUNT];
+	uint16_t m_pitch[SPU_VOICE_COUNT];
+
+	// Halfword addresses in SPU RAM
+	uint32_t m_startAddress[SPU_VOICE_COUNT];
+	uint32_t m_repeatAddress[SPU_VOICE_COUNT];
+	uint32_t m_currentAddress[SPU_VOICE_COUNT];
+
+	// Flags of the current block
+	uint8_t m_blockFlags[SPU_VOICE_COUNT];
+
+	// Current block preceded by the last 3 samples of the previous one,
+	// needed by the interpolation
+	int16_t m_samples[SPU_VOICE_COUNT][3 + SPU_SAMPLES_PER_BLOCK];
+
+	// Predictor state
+	int16_t m_old[SPU_VOICE_COUNT];
+	int16_t m_older[SPU_VOICE_COUNT];
+
+	uint32_t m_adsrConfig[SPU_VOICE_COUNT];
+	AdsrPhase m_adsrPhase[SPU_VOICE_COUNT];
+	SpuEnvelope m_adsr[SPU_VOICE_COUNT];
+
+	SpuVolume m_left[SPU_VOICE_COUNT];
+	SpuVolume m_right[SPU_VOICE_COUNT];
+};
+
 // Sound Processing Unit
 struct Spu
 {
-	Spu()
-	{
-		memset(m_shadowRegisters, 0x0, sizeof(m_shadowRegisters));
-		for (size_t i = 0; i < 256 * 1024; ++i) m_ram[i] = 0xbad;
-		m_ramIndex = 0x0;
-	}
+	Spu();
 
 	template<typename T>
-	void store(uint32_t offset, T value);
+	void store(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t offset, T value);
 
 	template<typename T>
-	T load(uint32_t offset);
+	T load(TimeKeeper& timeKeeper, InterruptState& irqState, uint32_t offset);
+
+	// Produce the samples up to the current date
+	void sync(TimeKeeper& timeKeeper, InterruptState& irqState);
+
+	// Number of samples produced per sync, clamped to
+	// [SPU_MIN_BLOCK_FRAMES, SPU_MAX_BLOCK_FRAMES]
+	void setBlockSize(uint32_t frames);
+	uint32_t getBlockSize() const { return m_blockFrames; }
 
 	uint16_t getControl() const { return m_shadowRegisters[regmap::CONTROL]; };
-	uint16_t getStatus() const { return getControl() & 0x3f; }
+	uint16_t getStatus() const;
 
 	void setControl(uint16_t value);
 
 	// Set the SPU RAM access pattern.
 	void setTransferControl(uint16_t value);
-	void fifoWrite(uint16_t value);
+	void fifoWrite(InterruptState& irqState, uint16_t value);
+
+	// DMA transfers of 'halfwords' little endian halfwords between 'data'
+	// and SPU RAM at the transfer address, which then advances
+	void dmaWrite(TimeKeeper& timeKeeper, InterruptState& irqState, const uint8_t* data, uint32_t halfwords);
+	void dmaRead(TimeKeeper& timeKeeper, InterruptState& irqState, uint8_t* data, uint32_t halfwords);
+
+	// Connect the output of the CD-ROM mixer to the CD audio input
+	void setCdInput(AudioFifo* input) { m_cdInput = input; }
+
+	// 44.1kHz stereo output
+	AudioOut& getAudioOut() { return m_audioOut; }
 
 private:
+	// Produce 'frames' stereo samples
+	void run(InterruptState& irqState, size_t frames);
+
+	// Schedule the next sync at the end of the block or when the IRQ
+	// address is expected to be reached, whichever comes first
+	void scheduleNextSync(TimeKeeper& timeKeeper);
+
+	// Return the number of samples after which a voice will load the
+	// block containing the IRQ address, or ~0 if it can't happen within
+	// 'maxFrames'. Errs on the early side for pitch modulated voices.
+	uint32_t predictIrq(uint32_t maxFrames) const;
+
+	// Compute the sample of every voice and advance them by one sample
+	void runVoices(InterruptState& irqState);
+
+	// Apply the envelopes and the volumes, return the sum of the voices
+	// and the sum of the ones sent to the reverb
+	void mixVoices(int32_t& left, int32_t& right, int32_t& reverbLeft, int32_t& reverbRight);
+
+	void keyOn(uint32_t voice, InterruptState& irqState);
+	void keyOff(uint32_t voice);
+
+	// Load the block at the voice's current address
+	void loadBlock(uint32_t voice, InterruptState& irqState);
+
+	// Move to the block following the current one, following the loop
+	// flags
+	void nextBlock(uint32_t voice, InterruptState& irqState);
+
+	// Decode the block at 'address' for 'voice', using the cache
+	const int16_t* decodeBlock(uint32_t voice, uint32_t address);
+
+	// Store 'halfwords' halfwords at the transfer address following the
+	// transfer type
+	void writeRam(InterruptState& irqState, const uint8_t* data, uint32_t halfwords);
+
+	// Drop the cached blocks overlapping 'size' halfwords at 'address'
+	void invalidateBlocks(uint32_t address, uint32_t size);
+
+	void tickAdsr(uint32_t voice);
+	void tickNoise();
+
+	// Raise the interrupt if it's enabled and the IRQ address is within
+	// 'size' halfwords at 'address'
+	void checkIrq(uint32_t address, uint32_t size, InterruptState& irqState);
+
+	void setVoiceRegister(uint32_t voice, uint32_t index, uint16_t value);
+
 	// Most of the SPU registers aren't updated by the hardware,
 	// their value is just moved to the internal registers when needed.
 	// Therefore we can emulate those registers like a RAM of sorts.
 	uint16_t m_shadowRegisters[0x100];
 
 	// SPU RAM: 256k 16bit samples.
-	uint16_t m_ram[256 * 1024];
+	uint16_t m_ram[SPU_RAM_SIZE];
 	// Write pointer in the SPU RAM.
 	uint32_t m_ramIndex;
-};
 
+	SpuVoices m_voices;
+
+	// Decoded blocks, indexed by block number modulo the size
+	SpuCachedBlock m_blockCache[SPU_BLOCK_CACHE_SIZE];
+
+	// Voices which reached the end of a block with the end flag ( ENDX )
+	uint32_t m_endFlags;
+
+	// Voices with pitch modulation and noise enabled, bit 0 is voice 0
+	uint32_t m_pitchModulation;
+	uint32_t m_noise;
+
+	// Noise generator
+	int32_t m_noiseTimer;
+	uint16_t m_noiseLevel;
+
+	SpuVolume m_mainLeft;
+	SpuVolume m_mainRight;
+
+	SpuReverb m_reverb;
+
+	// Voices keyed on and off since the last sample, bit 0 is voice 0
+	uint32_t m_keyOnPending;
+	uint32_t m_keyOffPending;
+
+	// Set when the IRQ address is reached, cleared when the interrupt is
+	// disabled
+	bool m_irqFlag;
+
+	// CPU cycles not yet converted to samples
+	Cycles m_cycleRemainder;
+	uint32_t m_blockFrames;
+
+	// CD audio input: CD-DA and XA-ADPCM samples at 44.1kHz.
+	AudioFifo* m_cdInput;
+
+	AudioOut m_audioOut;
+};
@@ -0,0 +1,255 @@
+#include "pscx_texture_cache.h"
+#include "pscx_common.h"
+
+// ***************** TextureKey implementation ******************
+uint8_t TextureKey::getPageRects(VramRect rects[4]) const
+{
+	// A line of a page is 64, 128 or 256 VRAM pixels wide
+	// depending on the texel depth
+	uint16_t width = 64 << m_depth;
+	return VramRect::splitWrapped(m_pageX * 64, m_pageY * 256, width, TEXTURE_PAGE_SIZE, rects);
+}
+
+VramRect TextureKey::getClutRect() const
+{
+	if (m_depth == 2) return VramRect();
+
+	uint16_t right = m_clutX + (m_depth == 0 ? 16 : 256);
+	if (right > VRAM_WIDTH)
+	{
+		right = VRAM_WIDTH;
+	}
+	return VramRect(m_clutX, m_clutY, right, m_clutY + 1);
+}
+
+// Convert a 1555 VRAM pixel to RGBA8 using the alpha encoding described
+// in pscx_texture_cache.h
+static uint32_t decodeTexel(uint16_t pixel)
+{
+	if (pixel == 0x0) return 0x0;
+
+	uint32_t r = pixel & 0x1f;
+	uint32_t g = (pixel >> 5) & 0x1f;
+	uint32_t b = (pixel >> 10) & 0x1f;
+	uint32_t a = (pixel & 0x8000) ? 0xff : 0x80;
+
+	// Replicate the top bits to use the full 8 bit range
+	r = (r << 3) | (r >> 2);
+	g = (g << 3) | (g >> 2);
+	b = (b << 3) | (b >> 2);
+
+	return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+// ***************** TextureCache implementation ******************
+TextureCache::TextureCache() :
+	m_lastLayer(-1),
+	m_useCounter(0x0),
+	m_texture(0x0),
+	m_hitCount(0x0),
+	m_missCount(0x0)
+{
+	m_decodeBuffer.resize(TEXTURE_PAGE_SIZE * TEXTURE_PAGE_SIZE, 0x0);
+}
+
+void TextureCache::OnCreate()
+{
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, TEXTURE_PAGE_SIZE, TEXTURE_PAGE_SIZE, TEXTURE_CACHE_LAYERS);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+void TextureCache::drop()
+{
+	glDeleteTextures(1, &m_texture);
+}
+
+GLint TextureCache::find(const TextureKey& key, uint32_t batch)
+{
+	GLint layer = -1;
+	if (m_lastLayer >= 0 && m_entries[m_lastLayer].m_valid && m_entries[m_lastLayer].m_key == key)
+	{
+		layer = m_lastLayer;
+	}
+	else
+	{
+		for (GLint i = 0; i < TEXTURE_CACHE_LAYERS; ++i)
+		{
+			if (m_entries[i].m_valid && m_entries[i].m_key == key)
+			{
+				layer = i;
+				break;
+			}
+		}
+	}
+
+	if (layer < 0) return -1;
+
+	m_useCounter += 1;
+	m_entries[layer].m_lastUse = m_useCounter;
+	m_entries[layer].m_batch = batch;
+	m_lastLayer = layer;
+	m_hitCount += 1;
+
+	return layer;
+}
+
+GLint TextureCache::allocate(uint32_t batch, bool& pendingBatch)
+{
+	// Use a free layer if there's one, the least recently used otherwise
+	GLint layer = 0;
+	for (GLint i = 0; i < TEXTURE_CACHE_LAYERS; ++i)
+	{
+		if (!m_entries[i].m_valid)
+		{
+			layer = i;
+			break;
+		}
+
+		if (m_entries[i].m_lastUse < m_entries[layer].m_lastUse)
+		{
+			layer = i;
+		}
+	}
+
+	// Invalidated entries keep their batch number, primitives queued
+	// before the invalidation might still sample them
+	pendingBatch = (m_entries[layer].m_batch == batch) && (m_entries[layer].m_lastUse != 0x0);
+
+	m_entries[layer].m_valid = false;
+	return layer;
+}
+
+void TextureCache::decode(GLint layer, const TextureKey& key, const uint16_t* vram, uint32_t batch)
+{
+	uint32_t palette[256];
+
+	VramRect clut = key.getClutRect();
+	for (uint16_t i = 0; i < clut.getWidth(); ++i)
+	{
+		palette[i] = decodeTexel(vram[(size_t)clut.m_top * VRAM_WIDTH + clut.m_left + i]);
+	}
+
+	uint16_t pageLeft = key.m_pageX * 64;
+	uint16_t pageTop = key.m_pageY * 256;
+
+	uint32_t* dst = m_decodeBuffer.data();
+	for (uint16_t v = 0; v < TEXTURE_PAGE_SIZE; ++v)
+	{
+		const uint16_t* line = vram + (size_t)((pageTop + v) & (VRAM_HEIGHT - 1)) * VRAM_WIDTH;
+
+		switch (key.m_depth)
+		{
+		case 0:
+		{
+			// Four 4 bit CLUT indices per VRAM pixel
+			for (uint16_t u = 0; u < TEXTURE_PAGE_SIZE; u += 4)
+			{
+				uint16_t pixel = line[(pageLeft + u / 4) & (VRAM_WIDTH - 1)];
+				dst[0] = palette[pixel & 0xf];
+				dst[1] = palette[(pixel >> 4) & 0xf];
+				dst[2] = palette[(pixel >> 8) & 0xf];
+				dst[3] = palette[pixel >> 12];
+				dst += 4;
+			}
+			break;
+		}
+		case 1:
+		{
+			// Two 8 bit CLUT indices per VRAM pixel, the CLUT can be
+			// clipped by the right edge of the VRAM
+			uint16_t clutSize = clut.getWidth();
+			for (uint16_t u = 0; u < TEXTURE_PAGE_SIZE; u += 2)
+			{
+				uint16_t pixel = line[(pageLeft + u / 2) & (VRAM_WIDTH - 1)];
+				uint8_t low = pixel & 0xff;
+				uint8_t high = pixel >> 8;
+				dst[0] = (low < clutSize) ? palette[low] : 0x0;
+				dst[1] = (high < clutSize) ? palette[high] : 0x0;
+				dst += 2;
+			}
+			break;
+		}
+		default:
+		{
+			// Direct 15 bit color
+			for (uint16_t u = 0; u < TEXTURE_PAGE_SIZE; ++u)
+			{
+				*dst = decodeTexel(line[(pageLeft + u) & (VRAM_WIDTH - 1)]);
+				dst += 1;
+			}
+			break;
+		}
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, TEXTURE_PAGE_SIZE, TEXTURE_PAGE_SIZE, 1,
+					GL_RGBA, GL_UNSIGNED_BYTE, m_decodeBuffer.data());
+
+	Entry& entry = m_entries[layer];
+	entry.m_valid = true;
+	entry.m_key = key;
+	entry.m_pageRectCount = key.getPageRects(entry.m_pageRects);
+	entry.m_clutRect = clut;
+
+	m_useCounter += 1;
+	entry.m_lastUse = m_useCounter;
+	entry.m_batch = batch;
+	m_lastLayer = layer;
+	m_missCount += 1;
+
+	for (uint8_t i = 0; i < entry.m_pageRectCount; ++i)
+	{
+		m_cachedTiles.mark(entry.m_pageRects[i]);
+	}
+	m_cachedTiles.mark(entry.m_clutRect);
+}
+
+void TextureCache::invalidate(const VramRect& rect)
+{
+	// Fast path: most writes go to the framebuffers, far from the textures
+	if (!m_cachedTiles.any(rect)) return;
+
+	bool dropped = false;
+	for (GLint i = 0; i < TEXTURE_CACHE_LAYERS; ++i)
+	{
+		Entry& entry = m_entries[i];
+		if (!entry.m_valid) continue;
+
+		bool overlaps = entry.m_clutRect.overlaps(rect);
+		for (uint8_t j = 0; j < entry.m_pageRectCount && !overlaps; ++j)
+		{
+			overlaps = entry.m_pageRects[j].overlaps(rect);
+		}
+
+		if (overlaps)
+		{
+			entry.m_valid = false;
+			dropped = true;
+		}
+	}
+
+	if (dropped)
+	{
+		updateCachedTiles();
+	}
+}
+
+void TextureCache::updateCachedTiles()
+{
+	m_cachedTiles.clearAll();
+	for (GLint i = 0; i < TEXTURE_CACHE_LAYERS; ++i)
+	{
+		const Entry& entry = m_entries[i];
+		if (!entry.m_valid) continue;
+
+		for (uint8_t j = 0; j < entry.m_pageRectCount; ++j)
+		{
+			m_cachedTiles.mark(entry.m_pageRects[j]);
+		}
+		m_cachedTiles.mark(entry.m_clutRect);
+	}
+}
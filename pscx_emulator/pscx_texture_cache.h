@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vector>
+
+#include "glad.h"
+
+#include "pscx_vram.h"
+
+// Number of decoded texture pages kept in the texture array
+const uint16_t TEXTURE_CACHE_LAYERS = 64;
+
+// Size of a texture page in texels, in both directions
+const uint16_t TEXTURE_PAGE_SIZE = 256;
+
+// Texture page, depth and CLUT used by a textured primitive
+struct TextureKey
+{
+	TextureKey() :
+		m_pageX(0x0),
+		m_pageY(0x0),
+		m_depth(0x0),
+		m_clutX(0x0),
+		m_clutY(0x0)
+	{}
+
+	// 'depth' uses the GP0(0xe1) encoding: 0 for 4 bits, 1 for 8 bits
+	// and 2 for 15 bits per texel
+	TextureKey(uint8_t pageX, uint8_t pageY, uint8_t depth, uint16_t clutX, uint16_t clutY) :
+		m_pageX(pageX),
+		m_pageY(pageY),
+		m_depth(depth),
+		// The CLUT is not used by 15 bit textures
+		m_clutX(depth == 2 ? 0x0 : clutX),
+		m_clutY(depth == 2 ? 0x0 : clutY)
+	{}
+
+	bool operator==(const TextureKey& other) const
+	{
+		return m_pageX == other.m_pageX && m_pageY == other.m_pageY && m_depth == other.m_depth &&
+			   m_clutX == other.m_clutX && m_clutY == other.m_clutY;
+	}
+
+	// VRAM area containing the texels. Return the number of rectangles
+	// written to 'rects', 15 bit pages can wrap around the right edge.
+	uint8_t getPageRects(VramRect rects[4]) const;
+
+	// VRAM area containing the CLUT, empty for 15 bit textures
+	VramRect getClutRect() const;
+
+	// Texture page base in 64 pixel (x) and 256 line (y) steps
+	uint8_t m_pageX, m_pageY;
+
+	// Texel depth
+	uint8_t m_depth;
+
+	// CLUT position in VRAM
+	uint16_t m_clutX, m_clutY;
+};
+
+// Cache of texture pages decoded to RGBA8. Each entry lives in a layer of
+// a GL_TEXTURE_2D_ARRAY, the alpha channel encodes the transparency:
+// 0 for the fully transparent texel value 0x0000, 128 for opaque texels
+// and 255 for texels with the semi-transparency bit set.
+struct TextureCache
+{
+	TextureCache();
+
+	void OnCreate();
+	void drop();
+
+	// Return the layer holding 'key' or -1 on a miss
+	GLint find(const TextureKey& key, uint32_t batch);
+
+	// Return the layer to use for a new entry. The least recently used
+	// entry is evicted. 'pendingBatch' is set if the evicted entry might
+	// still be referenced by primitives of 'batch' which haven't been drawn.
+	GLint allocate(uint32_t batch, bool& pendingBatch);
+
+	// Decode 'key' from 'vram' into 'layer', the entry is used by 'batch'
+	void decode(GLint layer, const TextureKey& key, const uint16_t* vram, uint32_t batch);
+
+	// Drop all the entries sourced from a VRAM area overlapping 'rect'
+	void invalidate(const VramRect& rect);
+
+	// Texture array holding the decoded pages
+	GLuint getTexture() const { return m_texture; }
+
+	// Number of cache lookups which found a decoded entry
+	uint32_t getHitCount() const { return m_hitCount; }
+
+	// Number of pages decoded
+	uint32_t getMissCount() const { return m_missCount; }
+
+private:
+	// Recompute m_cachedTiles after entries have been dropped
+	void updateCachedTiles();
+
+	struct Entry
+	{
+		Entry() :
+			m_valid(false),
+			m_lastUse(0x0),
+			m_batch(0x0),
+			m_pageRectCount(0x0)
+		{}
+
+		bool m_valid;
+		TextureKey m_key;
+
+		// Value of m_useCounter the last time the entry was looked up
+		uint32_t m_lastUse;
+
+		// Last draw batch referencing the entry
+		uint32_t m_batch;
+
+		// Source VRAM areas, used to detect overwrites
+		VramRect m_pageRects[4];
+		uint8_t m_pageRectCount;
+		VramRect m_clutRect;
+	};
+
+	Entry m_entries[TEXTURE_CACHE_LAYERS];
+
+	// Entry returned by the last lookup, checked first since consecutive
+	// primitives usually share the same texture
+	GLint m_lastLayer;
+
+	// Monotonic counter used for the LRU eviction
+	uint32_t m_useCounter;
+
+	// Tiles containing the source of at least one valid entry. VRAM writes
+	// outside of those tiles can't invalidate anything and are rejected early.
+	VramTileMap m_cachedTiles;
+
+	// Staging area for the decoded texels
+	std::vector<uint32_t> m_decodeBuffer;
+
+	// OpenGL texture array object
+	GLuint m_texture;
+
+	uint32_t m_hitCount;
+	uint32_t m_missCount;
+};
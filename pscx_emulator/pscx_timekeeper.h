@@ -17,7 +17,9 @@ enum Peripheral
 	// Gamepad/Memory Card controller
 	PERIPHERAL_PAD_MEMCARD,
 	// CD-ROM controller
-	PERIPHERAL_CDROM
+	PERIPHERAL_CDROM,
+	// Sound Processing Unit
+	PERIPHERAL_SPU
 };
 
 // Struct used to keep track of individual peripherals
@@ -76,7 +78,7 @@ private:
 	// Next time a peripheral needs an update
 	Cycles m_nextSync;
 	// Time sheets for keeping track of the various peripherals
-	TimeSheet m_timesheets[6];
+	TimeSheet m_timesheets[7];
 };
 
 // Fixed point representation of a cycle counter used to store non-integer cycle counts.
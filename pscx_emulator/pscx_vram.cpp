@@ -0,0 +1,114 @@
+#include <cstdlib>
+
+#include "pscx_vram.h"
+
+// ***************** VramRect implementation ******************
+uint8_t VramRect::splitWrapped(uint16_t x, uint16_t y, uint16_t width, uint16_t height, VramRect rects[4])
+{
+	x &= VRAM_WIDTH - 1;
+	y &= VRAM_HEIGHT - 1;
+
+	// Horizontal spans: the part before the right edge and the wrapped part
+	uint16_t columns[2][2] = { { x, x }, { 0x0, 0x0 } };
+	uint32_t right = (uint32_t)x + width;
+	columns[0][1] = (uint16_t)(right > VRAM_WIDTH ? VRAM_WIDTH : right);
+	if (right > VRAM_WIDTH)
+	{
+		columns[1][1] = (uint16_t)(right - VRAM_WIDTH);
+	}
+
+	// Vertical spans, same thing
+	uint16_t lines[2][2] = { { y, y }, { 0x0, 0x0 } };
+	uint32_t bottom = (uint32_t)y + height;
+	lines[0][1] = (uint16_t)(bottom > VRAM_HEIGHT ? VRAM_HEIGHT : bottom);
+	if (bottom > VRAM_HEIGHT)
+	{
+		lines[1][1] = (uint16_t)(bottom - VRAM_HEIGHT);
+	}
+
+	uint8_t count = 0;
+	for (size_t j = 0; j < 2; ++j)
+	{
+		for (size_t i = 0; i < 2; ++i)
+		{
+			VramRect rect(columns[i][0], lines[j][0], columns[i][1], lines[j][1]);
+			if (!rect.isEmpty())
+			{
+				rects[count] = rect;
+				count += 1;
+			}
+		}
+	}
+	return count;
+}
+
+// ***************** VramTileMap implementation ******************
+
+// Return the mask of the tile columns in the range [first; last]
+static uint32_t columnMask(uint32_t first, uint32_t last)
+{
+	uint32_t highMask = (last >= 31) ? 0xffffffff : ((1u << (last + 1)) - 1);
+	uint32_t lowMask = (1u << first) - 1;
+	return highMask & ~lowMask;
+}
+
+void VramTileMap::mark(const VramRect& rect)
+{
+	if (rect.isEmpty()) return;
+
+	uint32_t mask = columnMask(rect.m_left / VRAM_TILE_SIZE, (rect.m_right - 1) / VRAM_TILE_SIZE);
+	for (uint32_t row = rect.m_top / VRAM_TILE_SIZE; row <= (uint32_t)(rect.m_bottom - 1) / VRAM_TILE_SIZE; ++row)
+	{
+		m_rows[row] |= mask;
+	}
+}
+
+void VramTileMap::clearCovered(const VramRect& rect)
+{
+	if (rect.isEmpty()) return;
+
+	// Round inwards to only keep the fully covered tiles
+	uint32_t firstColumn = (rect.m_left + VRAM_TILE_SIZE - 1) / VRAM_TILE_SIZE;
+	uint32_t endColumn = rect.m_right / VRAM_TILE_SIZE;
+	uint32_t firstRow = (rect.m_top + VRAM_TILE_SIZE - 1) / VRAM_TILE_SIZE;
+	uint32_t endRow = rect.m_bottom / VRAM_TILE_SIZE;
+
+	if (firstColumn >= endColumn) return;
+
+	uint32_t mask = columnMask(firstColumn, endColumn - 1);
+	for (uint32_t row = firstRow; row < endRow; ++row)
+	{
+		m_rows[row] &= ~mask;
+	}
+}
+
+bool VramTileMap::any(const VramRect& rect) const
+{
+	if (rect.isEmpty()) return false;
+
+	uint32_t mask = columnMask(rect.m_left / VRAM_TILE_SIZE, (rect.m_right - 1) / VRAM_TILE_SIZE);
+	for (uint32_t row = rect.m_top / VRAM_TILE_SIZE; row <= (uint32_t)(rect.m_bottom - 1) / VRAM_TILE_SIZE; ++row)
+	{
+		if (m_rows[row] & mask)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void VramTileMap::markAll()
+{
+	for (size_t i = 0; i < _countof(m_rows); ++i)
+	{
+		m_rows[i] = 0xffffffff;
+	}
+}
+
+void VramTileMap::clearAll()
+{
+	for (size_t i = 0; i < _countof(m_rows); ++i)
+	{
+		m_rows[i] = 0x0;
+	}
+}
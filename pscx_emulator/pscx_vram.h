@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+// PlayStation VRAM width in 16 bit pixels
+const uint16_t VRAM_WIDTH = 1024;
+
+// PlayStation VRAM height in lines
+const uint16_t VRAM_HEIGHT = 512;
+
+// Rectangle in VRAM coordinates. Left and top are inclusive,
+// right and bottom are exclusive.
+struct VramRect
+{
+	VramRect() :
+		m_left(0x0),
+		m_top(0x0),
+		m_right(0x0),
+		m_bottom(0x0)
+	{}
+
+	VramRect(uint16_t left, uint16_t top, uint16_t right, uint16_t bottom) :
+		m_left(left),
+		m_top(top),
+		m_right(right),
+		m_bottom(bottom)
+	{}
+
+	uint16_t getWidth() const { return m_right - m_left; }
+	uint16_t getHeight() const { return m_bottom - m_top; }
+
+	bool isEmpty() const
+	{
+		return m_left >= m_right || m_top >= m_bottom;
+	}
+
+	// Return true if both rectangles share at least one pixel
+	bool overlaps(const VramRect& other) const
+	{
+		return m_left < other.m_right && other.m_left < m_right &&
+			   m_top < other.m_bottom && other.m_top < m_bottom;
+	}
+
+	// Split a transfer of 'width'x'height' pixels starting at 'x', 'y' into
+	// at most four rectangles. The VRAM "wraps around" so a transfer crossing
+	// the right or bottom edge continues on the other side. Return the number
+	// of rectangles written to 'rects'.
+	static uint8_t splitWrapped(uint16_t x, uint16_t y, uint16_t width, uint16_t height, VramRect rects[4]);
+
+	uint16_t m_left, m_top, m_right, m_bottom;
+};
+
+// Size of a tile of the VRAM tile map, in pixels in both directions
+const uint16_t VRAM_TILE_SIZE = 32;
+
+// Coarse bitmap of the VRAM with one bit per 32x32 tile. Each row of tiles
+// fits in a single 32 bit word so that a rectangle can be tested or updated
+// with a handful of mask operations.
+struct VramTileMap
+{
+	VramTileMap()
+	{
+		clearAll();
+	}
+
+	// Flag all the tiles touched by 'rect'
+	void mark(const VramRect& rect);
+
+	// Clear the tiles which are entirely covered by 'rect'. Tiles only partially
+	// covered are left untouched.
+	void clearCovered(const VramRect& rect);
+
+	// Return true if any tile touched by 'rect' is flagged
+	bool any(const VramRect& rect) const;
+
+	void markAll();
+	void clearAll();
+
+private:
+	uint32_t m_rows[VRAM_HEIGHT / VRAM_TILE_SIZE];
+};
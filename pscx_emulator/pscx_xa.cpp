@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cstring>
+
+#include "pscx_xa.h"
+#include "pscx_simd.h"
+
+// Predictor filters, in 1/64 units
+static const int32_t XA_FILTER_POSITIVE[4] = { 0, 60, 115, 98 };
+static const int32_t XA_FILTER_NEGATIVE[4] = { 0, 0, -52, -55 };
+
+// Blackman windowed sinc cut at 90% of the input Nyquist frequency, one
+// row per phase, in 1/16384 units. The cutoff being relative to the input
+// rate the same filter works for 37.8kHz and 18.9kHz.
+alignas(16) static const int16_t XA_RESAMPLE_FILTER[XA_RESAMPLE_PHASES][XA_RESAMPLE_TAPS] =
+{
+	{ 93, -521, 1247, 14746, 1247, -521, 93, 0 },
+	{ 40, -155, -292, 14274, 3317, -959, 161, -2 },
+	{ 7, 96, -1252, 12923, 5775, -1384, 225, -6 },
+	{ -8, 227, -1675, 10873, 8390, -1672, 259, -10 },
+	{ -10, 259, -1672, 8390, 10873, -1675, 227, -8 },
+	{ -6, 225, -1384, 5775, 12923, -1252, 96, 7 },
+	{ -2, 161, -959, 3317, 14274, -292, -155, 40 },
+};
+
+static int16_t clampSample(int32_t value)
+{
+	return (int16_t)std::min(std::max(value, -0x8000), 0x7fff);
+}
+
+static int16_t applyFilter(const int16_t* samples, const int16_t* filter)
+{
+#ifdef PSCX_SSE2
+	// The 8 taps fit in one register, madd leaves 4 partial sums to add
+	__m128i sums = _mm_madd_epi16(_mm_loadu_si128((const __m128i*)samples), _mm_load_si128((const __m128i*)filter));
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+	int32_t sum = _mm_cvtsi128_si32(sums);
+#else
+	int32_t sum = 0;
+	for (uint32_t i = 0; i < XA_RESAMPLE_TAPS; ++i)
+	{
+		sum += (int32_t)samples[i] * filter[i];
+	}
+#endif
+	return clampSample((sum + 0x2000) >> 14);
+}
+
+// ****************** XaAdpcmDecoder implementation *******************
+XaAdpcmDecoder::XaAdpcmDecoder() :
+	m_stereo(false),
+	m_halfRate(false),
+	m_phase(0x0)
+{
+	reset();
+}
+
+void XaAdpcmDecoder::reset()
+{
+	for (Channel& channel : m_channels)
+	{
+		channel.m_old = 0x0;
+		channel.m_older = 0x0;
+
+		// Start with silence in the history so that the first sector
+		// goes through the filter like the others
+		memset(channel.m_samples, 0x0, sizeof(channel.m_samples));
+		channel.m_sampleCount = XA_RESAMPLE_TAPS - 1;
+	}
+	m_phase = 0x0;
+}
+
+size_t XaAdpcmDecoder::decodeSector(const uint8_t* sector, int16_t* output)
+{
+	// Coding information byte of the sub-header
+	uint8_t coding = sector[19];
+	bool stereo = (coding & 0x3) == 0x1;
+	bool halfRate = ((coding >> 2) & 0x3) == 0x1;
+	bool eightBit = ((coding >> 4) & 0x3) == 0x1;
+
+	if (stereo != m_stereo || halfRate != m_halfRate)
+	{
+		reset();
+		m_stereo = stereo;
+		m_halfRate = halfRate;
+	}
+
+	uint32_t blocks = eightBit ? 4 : 8;
+	for (uint32_t i = 0; i < XA_SOUND_GROUPS; ++i)
+	{
+		const uint8_t* group = sector + XA_SOUND_GROUP_OFFSET + i * XA_SOUND_GROUP_SIZE;
+		for (uint32_t block = 0; block < blocks; ++block)
+		{
+			// Stereo streams alternate left and right blocks
+			decodeBlock(group, block, eightBit, m_channels[stereo ? (block & 1) : 0]);
+		}
+	}
+
+	// An output frame is 6/7 of a 37.8kHz sample, 3/7 of a 18.9kHz one
+	return resample(output, halfRate ? 3 : 6);
+}
+
+void XaAdpcmDecoder::decodeBlock(const uint8_t* group, uint32_t block, bool eightBit, Channel& channel)
+{
+	// The parameters of the 8 blocks are at 4..11, surrounded by copies
+	uint8_t parameters = group[4 + block];
+	uint32_t shift = parameters & 0xf;
+	uint32_t filter = (parameters >> 4) & 0x3;
+
+	// Shifts 13 to 15 behave like 9
+	if (shift > 12)
+	{
+		shift = 9;
+	}
+
+	int32_t positive = XA_FILTER_POSITIVE[filter];
+	int32_t negative = XA_FILTER_NEGATIVE[filter];
+
+	const uint8_t* data = group + 16;
+	int16_t* out = channel.m_samples + channel.m_sampleCount;
+
+	// The predictor uses the previous output, this can't be vectorized
+	for (uint32_t i = 0; i < XA_SAMPLES_PER_BLOCK; ++i)
+	{
+		int32_t sample;
+		if (eightBit)
+		{
+			sample = (int16_t)(data[i * 4 + block] << 8);
+		}
+		else
+		{
+			uint8_t nibble = (data[i * 4 + (block >> 1)] >> ((block & 1) * 4)) & 0xf;
+			sample = (int16_t)(nibble << 12);
+		}
+
+		sample = (sample >> shift) + ((channel.m_old * positive + channel.m_older * negative + 32) >> 6);
+		sample = clampSample(sample);
+
+		channel.m_older = channel.m_old;
+		channel.m_old = sample;
+		out[i] = (int16_t)sample;
+	}
+
+	channel.m_sampleCount += XA_SAMPLES_PER_BLOCK;
+}
+
+size_t XaAdpcmDecoder::resample(int16_t* output, uint32_t step)
+{
+	// Mono streams only fill the left channel
+	Channel& left = m_channels[0];
+	Channel& right = m_channels[m_stereo ? 1 : 0];
+
+	size_t frames = 0;
+	uint32_t position = 0;
+	while (position + XA_RESAMPLE_TAPS <= left.m_sampleCount)
+	{
+		const int16_t* filter = XA_RESAMPLE_FILTER[m_phase];
+
+		int16_t sample = applyFilter(left.m_samples + position, filter);
+		output[frames * 2] = sample;
+		output[frames * 2 + 1] = m_stereo ? applyFilter(right.m_samples + position, filter) : sample;
+		frames += 1;
+
+		m_phase += step;
+		position += m_phase / XA_RESAMPLE_PHASES;
+		m_phase %= XA_RESAMPLE_PHASES;
+	}
+
+	// Keep the samples the next outputs need
+	for (Channel& channel : m_channels)
+	{
+		if (channel.m_sampleCount < position) continue;
+
+		channel.m_sampleCount -= position;
+		memmove(channel.m_samples, channel.m_samples + position, channel.m_sampleCount * sizeof(int16_t));
+	}
+
+	return frames;
+}
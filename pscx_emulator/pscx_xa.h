@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// An XA-ADPCM sector holds 18 sound groups of 128 bytes after the
+// sub-header: 16 bytes of block parameters followed by 28 words of
+// sample data interleaving the blocks.
+const uint32_t XA_SOUND_GROUPS = 18;
+const uint32_t XA_SOUND_GROUP_SIZE = 128;
+const uint32_t XA_SOUND_GROUP_OFFSET = 24;
+const uint32_t XA_SAMPLES_PER_BLOCK = 28;
+
+// Samples per channel in a sector, the most is 8 blocks of 4 bit mono
+const uint32_t XA_MAX_SECTOR_SAMPLES = XA_SOUND_GROUPS * 8 * XA_SAMPLES_PER_BLOCK;
+
+// The decoded samples are resampled to 44.1kHz with a polyphase filter.
+// 44100 / 37800 = 7 / 6, so the output positions fall on 7 phases between
+// two input samples, 18.9kHz streams step over them twice as fast.
+const uint32_t XA_RESAMPLE_PHASES = 7;
+const uint32_t XA_RESAMPLE_TAPS = 8;
+
+// Most 44.1kHz frames produced by a sector: 18.9kHz mono
+const size_t XA_MAX_SECTOR_FRAMES = XA_MAX_SECTOR_SAMPLES * XA_RESAMPLE_PHASES / 3 + 1;
+
+// Decoder of the XA-ADPCM sectors streamed by the CD-ROM controller.
+// The predictor state and the resampler history carry over from one
+// sector to the next.
+struct XaAdpcmDecoder
+{
+	XaAdpcmDecoder();
+
+	// Forget the stream, called when the drive seeks
+	void reset();
+
+	// Decode the raw Form 2 sector 'sector' to 44.1kHz interleaved stereo
+	// frames in 'output', which must have room for XA_MAX_SECTOR_FRAMES.
+	// Return the number of frames written.
+	size_t decodeSector(const uint8_t* sector, int16_t* output);
+
+private:
+	struct Channel
+	{
+		// Last two decoded samples, used by the predictor
+		int32_t m_old;
+		int32_t m_older;
+
+		// Samples waiting to be resampled, starting with the ones kept
+		// from the previous sector
+		int16_t m_samples[XA_RESAMPLE_TAPS + XA_MAX_SECTOR_SAMPLES];
+		uint32_t m_sampleCount;
+	};
+
+	// Decode the 28 samples of 'block' in the sound group at 'group' and
+	// append them to 'channel'
+	void decodeBlock(const uint8_t* group, uint32_t block, bool eightBit, Channel& channel);
+
+	// Resample the pending samples to 'output', advancing by 'step'
+	// phases per output frame. Return the number of frames written.
+	size_t resample(int16_t* output, uint32_t step);
+
+	Channel m_channels[2];
+
+	bool m_stereo;
+	bool m_halfRate;
+
+	// Position of the next output between two input samples
+	uint32_t m_phase;
+};